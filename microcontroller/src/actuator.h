@@ -0,0 +1,105 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+// Output stage between an HBridgeTask loop and its H-bridge unit. Every
+// write costs a PaHub select plus a register write on the shared I2C bus,
+// so it remembers what the unit holds and asks only for the writes that
+// change something, with a rewrite now and then in case the unit reset.
+//
+// It also limits how fast the PWM can move (slewRate, PWM per second), and
+// takes a signed target so the motor can be run backward: going from one
+// direction to the other, the output slews to 0, the direction register is
+// written there, then it slews up the other way.
+//
+// tools/sim's tank-sim drives it through HBridgeTask, and counts the writes
+// that reach the simulated units.
+
+#define ACTUATOR_REFRESH_US 1000000  // Rewrites an unchanged output this often
+
+// As the H-bridge's direction register
+enum ActuatorDirection : uint8_t {
+  ACTUATOR_STOP = 0,
+  ACTUATOR_FORWARD = 1,
+  ACTUATOR_BACKWARD = 2,
+};
+
+// Which registers need writing this tick
+typedef struct {
+  bool direction;
+  bool speed;
+} ActuatorWrites;
+
+class ActuatorOutput {
+ public:
+  // PWM per second, 0 for no limit
+  void setSlewRate(float _slewRate) { slewRate = _slewRate; }
+  float getSlewRate() const { return slewRate; }
+
+  // Forgets what the unit holds, so the next update writes both
+  // registers, e.g. after the unit was set up again
+  void invalidate() { known = false; }
+
+  // Signed PWM, negative for backward
+  void setTarget(int _target) { target = _target; }
+
+  // Moves the output toward the target over dtUs and returns what has to
+  // be sent. getDirection() and getSpeed() give the values, call written()
+  // once they are on the unit.
+  ActuatorWrites update(uint32_t dtUs, uint32_t nowUs) {
+    float step = getSlewStep(dtUs);
+    bool crossing = (target > 0 && output < 0) || (target < 0 && output > 0);
+    float goal = crossing ? 0 : target;
+    output += fminf(fmaxf(goal - output, -step), step);
+
+    // At 0 the direction stays as it was, so stopping costs no extra write
+    if (output != 0) {
+      direction = output > 0 ? ACTUATOR_FORWARD : ACTUATOR_BACKWARD;
+    } else if (!known) {
+      direction = target < 0 ? ACTUATOR_BACKWARD : ACTUATOR_FORWARD;
+    }
+    speed = lroundf(fminf(fabsf(output), 255));
+
+    bool refresh = !known || nowUs - writtenUs >= ACTUATOR_REFRESH_US;
+    ActuatorWrites writes = {refresh || direction != writtenDirection, refresh || speed != writtenSpeed};
+    if (!writes.direction && !writes.speed) {
+      skipped++;
+    }
+    return writes;
+  }
+
+  void written(const ActuatorWrites& writes, uint32_t nowUs) {
+    writtenDirection = direction;
+    writtenSpeed = speed;
+    writtenUs = nowUs;
+    known = true;
+    this->writes += writes.direction + writes.speed;
+  }
+
+  ActuatorDirection getDirection() const { return direction; }
+  uint8_t getSpeed() const { return speed; }
+  // Signed, where the slew has got to
+  float getOutput() const { return output; }
+
+  // Furthest the output can move in dtUs, infinite with no slew limit
+  float getSlewStep(uint32_t dtUs) const { return slewRate > 0 ? slewRate * dtUs * 1e-6f : INFINITY; }
+
+  // Register writes sent, and updates that needed none
+  uint32_t getWrites() const { return writes; }
+  uint32_t getSkipped() const { return skipped; }
+
+ private:
+  float slewRate = 0;
+  int target = 0;
+  float output = 0;
+  ActuatorDirection direction = ACTUATOR_FORWARD;
+  uint8_t speed = 0;
+
+  bool known = false;
+  ActuatorDirection writtenDirection = ACTUATOR_STOP;
+  uint8_t writtenSpeed = 0;
+  uint32_t writtenUs = 0;
+  uint32_t writes = 0;
+  uint32_t skipped = 0;
+};
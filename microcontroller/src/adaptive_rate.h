@@ -0,0 +1,228 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+// Adaptive sample intervals for the sensors that aren't in a control loop
+// (thermocouple, conductivity, the knobs). A fixed interval oversamples a
+// tank sitting at steady state and undersamples a tracer injection, so
+// each sensor runs between a fast and a slow interval instead.
+//
+// Each sample updates a level and slope (an alpha-beta filter over about
+// ADAPTIVE_TREND_S) and the variance of the samples about that trend. The
+// sensor is active, and drops straight to the fast interval, when:
+//
+// - rate of change: the slope would move the signal by threshold within
+//   ADAPTIVE_RATE_S, which catches a slow drift such as the heater ramp
+//   long before it has gone far;
+// - variance: the latest sample is more than threshold off the trend, or
+//   the spread about it over ADAPTIVE_VARIANCE_S passes threshold /
+//   ADAPTIVE_SPREAD, which catches steps and a signal that's jumping about.
+//
+// Noise sits well inside the threshold and averages out of the slope. Once
+// quiet for ADAPTIVE_HOLD_US the interval grows by ADAPTIVE_DECAY per
+// sample, back out to the slow one.
+//
+// SampleBudget bounds the I2C time of everything on the bus. The control
+// loops (encoder, flow sensor, HBridges) join it through FixedRate: they
+// are never slowed, but their load counts. Each adaptive sensor reports how
+// long its reads take, and can't go faster than the share of the budget the
+// others leave it, though it always gets an even share of what the fixed
+// users leave. It can always go as slow as its slow interval, so the budget
+// only ever limits how far a sensor speeds up.
+//
+// tools/bench/sampling_bench compares it with fixed intervals on a
+// simulated tank.
+
+#define ADAPTIVE_TREND_S 3.0f
+#define ADAPTIVE_RATE_S 20.0f
+#define ADAPTIVE_VARIANCE_S 2.0f
+#define ADAPTIVE_SPREAD 2.0f
+#define ADAPTIVE_HOLD_US 5000000
+#define ADAPTIVE_DECAY 1.25f
+#define ADAPTIVE_COST_WEIGHT 0.2f  // Of each new read time in the average
+#define SAMPLE_BUDGET_MAX_CLIENTS 12
+
+class SampleBudget {
+ public:
+  // Fraction of bus time everything on it may use between them
+  void setBudget(float _budget) { budget = _budget; }
+  float getBudget() const { return budget; }
+
+  // Returns the new client's index, or -1 when full. Fixed clients only
+  // count against the budget.
+  int add(bool fixed = false) {
+    if (clients == SAMPLE_BUDGET_MAX_CLIENTS) {
+      return -1;
+    }
+    costUs[clients] = 0;
+    intervalMs[clients] = 0;
+    isFixed[clients] = fixed;
+    adaptiveClients += fixed ? 0 : 1;
+    return clients++;
+  }
+
+  // Shortest interval client can take with costUs per sample: what the
+  // others leave of the budget, or its even share of what the fixed clients
+  // leave if the other adaptive ones are using more than theirs. They give
+  // that back as they next sample.
+  uint32_t minIntervalMs(int client, float costUs) const {
+    float share = (budget - getLoad(true)) / adaptiveClients;
+    float available = fmaxf(budget - getLoad() + load(client), share);
+    float intervalMs = available > 0 ? ceilf(costUs / (available * 1000)) : INFINITY;
+    return intervalMs < 4e9f ? intervalMs : UINT32_MAX;
+  }
+
+  void set(int client, float _costUs, uint32_t _intervalMs) {
+    costUs[client] = _costUs;
+    intervalMs[client] = _intervalMs;
+  }
+
+  // Fraction of bus time used at the current intervals, by everything or
+  // only the fixed clients
+  float getLoad(bool fixedOnly = false) const {
+    float total = 0;
+    for (int i = 0; i < clients; i++) {
+      if (isFixed[i] || !fixedOnly) {
+        total += load(i);
+      }
+    }
+    return total;
+  }
+
+ private:
+  float load(int client) const { return intervalMs[client] > 0 ? costUs[client] / (intervalMs[client] * 1000.0f) : 0; }
+
+  float budget = 0.1f;
+  int clients = 0;
+  int adaptiveClients = 0;
+  float costUs[SAMPLE_BUDGET_MAX_CLIENTS];
+  uint32_t intervalMs[SAMPLE_BUDGET_MAX_CLIENTS];
+  bool isFixed[SAMPLE_BUDGET_MAX_CLIENTS];
+};
+
+// A bus user on its own fixed interval, reporting its load to a
+// SampleBudget
+class FixedRate {
+ public:
+  // NULL for no budget. Joins it once, so can be called again.
+  void setBudget(SampleBudget* _budget) {
+    if (_budget != budget) {
+      budget = _budget;
+      client = budget != NULL ? budget->add(true) : -1;
+    }
+  }
+
+  // busUs is the bus time this tick took, 0 when it had nothing to send
+  void update(uint32_t busUs, uint32_t intervalMs) {
+    costUs += (busUs - costUs) * ADAPTIVE_COST_WEIGHT;
+    if (client >= 0) {
+      budget->set(client, costUs, intervalMs);
+    }
+  }
+
+  // Average bus time a tick takes
+  float getCostUs() const { return costUs; }
+
+ private:
+  SampleBudget* budget = NULL;
+  int client = -1;
+  float costUs = 0;
+};
+
+class AdaptiveRate {
+ public:
+  // threshold in the signal's own units. Starts out fast.
+  void configure(uint32_t _fastMs, uint32_t _slowMs, float _threshold) {
+    fastMs = _fastMs;
+    slowMs = _slowMs > _fastMs ? _slowMs : _fastMs;
+    threshold = _threshold;
+    intervalMs = fastMs;
+  }
+
+  // NULL for no budget. Joins it once, so can be called again.
+  void setBudget(SampleBudget* _budget) {
+    if (_budget != budget) {
+      budget = _budget;
+      client = budget != NULL ? budget->add() : -1;
+    }
+  }
+
+  // Takes each sample and how long reading it took, returns the interval
+  // until the next one
+  uint32_t update(float value, uint32_t nowUs, uint32_t readUs) {
+    costUs = costUs == 0 ? readUs : costUs + (readUs - costUs) * ADAPTIVE_COST_WEIGHT;
+    if (!primed) {
+      level = value;
+      lastUs = nowUs;
+      activeUs = nowUs;
+      primed = true;
+    }
+    float dt = (nowUs - lastUs) * 1e-6f;
+    lastUs = nowUs;
+    if (dt > 0) {
+      // Alpha-beta filter, critically damped, with its gains worked out
+      // from dt as the interval varies
+      float predicted = level + slope * dt;
+      float residual = value - predicted;
+      float alpha = 1 - expf(-dt / ADAPTIVE_TREND_S);
+      float beta = alpha * alpha / (2 - alpha);
+      level = predicted + alpha * residual;
+      slope += beta * residual / dt;
+      variance += (residual * residual - variance) * dt / (ADAPTIVE_VARIANCE_S + dt);
+      deviation = fabsf(residual);
+    }
+
+    uint32_t wanted = intervalMs;
+    if (isMoving()) {
+      activeUs = nowUs;
+      wanted = fastMs;
+    } else if (nowUs - activeUs > ADAPTIVE_HOLD_US) {
+      wanted = fminf(intervalMs * ADAPTIVE_DECAY + 0.5f, slowMs);
+    }
+    if (client >= 0) {
+      uint32_t floor = budget->minIntervalMs(client, costUs);
+      wanted = wanted > floor ? wanted : (floor < slowMs ? floor : slowMs);
+      budget->set(client, costUs, wanted);
+    }
+    intervalMs = wanted;
+    return intervalMs;
+  }
+
+  uint32_t getIntervalMs() const { return intervalMs; }
+  uint32_t getFastMs() const { return fastMs; }
+  uint32_t getSlowMs() const { return slowMs; }
+  bool isActive(uint32_t nowUs) const { return nowUs - activeUs <= ADAPTIVE_HOLD_US; }
+  // Of the latest sample from the trend
+  float getDeviation() const { return deviation; }
+  // Units per second
+  float getSlope() const { return slope; }
+  // RMS of the samples about the trend
+  float getSpread() const { return sqrtf(variance); }
+  float getThreshold() const { return threshold; }
+  // Average time a read takes
+  float getCostUs() const { return costUs; }
+
+ private:
+  bool isMoving() const {
+    bool drifting = fabsf(slope) * ADAPTIVE_RATE_S > threshold;
+    bool scattered = deviation > threshold || sqrtf(variance) * ADAPTIVE_SPREAD > threshold;
+    return drifting || scattered;
+  }
+
+  uint32_t fastMs = 100;
+  uint32_t slowMs = 100;
+  float threshold = 0;
+  SampleBudget* budget = NULL;
+  int client = -1;
+
+  bool primed = false;
+  float level = 0;
+  float slope = 0;
+  float variance = 0;
+  float deviation = 0;
+  float costUs = 0;
+  uint32_t intervalMs = 100;
+  uint32_t lastUs = 0;
+  uint32_t activeUs = 0;
+};
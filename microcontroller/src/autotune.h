@@ -0,0 +1,203 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "pid.h"
+
+// Relay feedback (Astrom-Hagglund) autotuning for the HBridge loops. The
+// controller is swapped for a relay: the output sits at bias + step while
+// the measurement is below the setpoint and bias - step above it, with some
+// hysteresis so measurement noise can't chatter it. The loop settles into a
+// limit cycle at its ultimate period Tu, and the cycle's amplitude a gives
+// the ultimate gain Ku = 4 step / (pi a), the proportional gain at which the
+// loop would oscillate on its own. PI gains come from those by a rule
+// between Ziegler-Nichols (kp = 0.45 Ku, too oscillatory on a light
+// stirrer) and Tyreus-Luyben (integral time 2.2 Tu, very slow on the pump),
+// picked on the plants in tools/bench/autotune_bench.
+//
+// The bias is nudged every cycle until the output spends as long high as
+// low, so the cycle centres on the setpoint even if the bias it started from
+// was off. Each update is a few comparisons, so it runs in the HBridgeTask
+// tick in place of the controller.
+
+#define AUTOTUNE_CYCLES 6         // Full cycles run
+#define AUTOTUNE_SETTLE_CYCLES 2  // First ones ignored while the bias settles
+#define AUTOTUNE_MAX_SPREAD 0.2f  // Largest period difference from the mean, as a fraction
+#define AUTOTUNE_KP_FACTOR 0.2f   // kp = factor * Ku
+#define AUTOTUNE_TI_FACTOR 0.8f   // Integral time = factor * Tu
+
+enum AutotuneState : uint8_t {
+  AUTOTUNE_IDLE,
+  AUTOTUNE_RUNNING,
+  AUTOTUNE_DONE,
+  AUTOTUNE_FAILED,
+};
+
+class RelayAutotuner {
+ public:
+  // step is the relay swing either side of the bias, hysteresis in
+  // measurement units
+  void configure(float _step, float _hysteresis, float _outMin, float _outMax, uint32_t _timeoutUs) {
+    step = _step;
+    hysteresis = _hysteresis;
+    outMin = _outMin;
+    outMax = _outMax;
+    timeoutUs = _timeoutUs;
+  }
+
+  // bias is the output that roughly holds setpoint, e.g. what the
+  // controller was giving
+  void start(float _setpoint, float _bias, float measurement, uint32_t nowUs) {
+    setpoint = _setpoint;
+    bias = _bias;
+    high = measurement < setpoint;
+    state = AUTOTUNE_RUNNING;
+    error = NULL;
+    startUs = nowUs;
+    switchUs = nowUs;
+    cycleStarted = false;
+    cycles = 0;
+    periodSum = 0;
+    periodMin = 0;
+    periodMax = 0;
+    amplitudeSum = 0;
+    swingSum = 0;
+    peakHigh = measurement;
+    peakLow = measurement;
+    output = relayOutput();
+  }
+
+  void cancel() {
+    if (state == AUTOTUNE_RUNNING) {
+      fail("cancelled");
+    }
+  }
+
+  // Returns the output to apply until the next update
+  float update(float measurement, uint32_t nowUs) {
+    if (state != AUTOTUNE_RUNNING) {
+      return output;
+    }
+    if (nowUs - startUs > timeoutUs) {
+      fail(cycles == 0 ? "no oscillation, try a larger step" : "oscillation didn't settle in time");
+      return output;
+    }
+    peakHigh = fmaxf(peakHigh, measurement);
+    peakLow = fminf(peakLow, measurement);
+
+    if (high && measurement > setpoint + hysteresis) {
+      high = false;
+      highUs = nowUs - switchUs;
+      switchUs = nowUs;
+    } else if (!high && measurement < setpoint - hysteresis) {
+      // A cycle runs from one switch to high to the next
+      high = true;
+      lowUs = nowUs - switchUs;
+      switchUs = nowUs;
+      if (cycleStarted) {
+        endCycle(nowUs);
+      }
+      cycleStarted = true;
+      cycleStartUs = nowUs;
+      peakHigh = measurement;
+      peakLow = measurement;
+    }
+    if (state == AUTOTUNE_RUNNING) {
+      output = relayOutput();
+    }
+    return output;
+  }
+
+  AutotuneState getState() const { return state; }
+  bool isRunning() const { return state == AUTOTUNE_RUNNING; }
+  // Why it failed, NULL otherwise
+  const char* getError() const { return error; }
+  int getCycles() const { return cycles; }
+  uint32_t getElapsedUs(uint32_t nowUs) const { return nowUs - startUs; }
+
+  // Valid once done
+  float getUltimateGain() const { return ultimateGain; }
+  float getUltimatePeriod() const { return ultimatePeriod; }  // s
+
+  // PI gains into gains, leaving the rest of it alone
+  void getGains(PidGains* gains) const {
+    gains->kp = AUTOTUNE_KP_FACTOR * ultimateGain;
+    gains->ki = gains->kp / (AUTOTUNE_TI_FACTOR * ultimatePeriod);
+  }
+
+ private:
+  float relayOutput() const { return fminf(fmaxf(bias + (high ? step : -step), outMin), outMax); }
+
+  void endCycle(uint32_t nowUs) {
+    cycles++;
+    float period = (nowUs - cycleStartUs) * 1e-6f;
+    float amplitude = (peakHigh - peakLow) / 2;
+    // Half the output swing actually applied, less if a limit clipped it
+    float swing = (fminf(bias + step, outMax) - fmaxf(bias - step, outMin)) / 2;
+    if (cycles > AUTOTUNE_SETTLE_CYCLES) {
+      periodSum += period;
+      periodMin = periodMin == 0 ? period : fminf(periodMin, period);
+      periodMax = fmaxf(periodMax, period);
+      amplitudeSum += amplitude;
+      swingSum += swing;
+    }
+    bias += step * (highUs - (float)lowUs) / (highUs + lowUs) / 2;
+    bias = fminf(fmaxf(bias, outMin), outMax);
+
+    if (cycles < AUTOTUNE_CYCLES) {
+      return;
+    }
+    int counted = AUTOTUNE_CYCLES - AUTOTUNE_SETTLE_CYCLES;
+    float meanPeriod = periodSum / counted;
+    float meanAmplitude = amplitudeSum / counted;
+    if (periodMax - periodMin > 2 * AUTOTUNE_MAX_SPREAD * meanPeriod) {
+      fail("period too irregular, try a larger step");
+      return;
+    }
+    if (meanAmplitude <= hysteresis) {
+      fail("oscillation within the hysteresis, try a larger step");
+      return;
+    }
+    // Describing function of a relay with hysteresis
+    ultimateGain = 4 * (swingSum / counted) / (M_PI * sqrtf(meanAmplitude * meanAmplitude - hysteresis * hysteresis));
+    ultimatePeriod = meanPeriod;
+    state = AUTOTUNE_DONE;
+    output = bias;
+  }
+
+  void fail(const char* _error) {
+    state = AUTOTUNE_FAILED;
+    error = _error;
+    output = bias;
+  }
+
+  float step = 30;
+  float hysteresis = 0;
+  float outMin = 0;
+  float outMax = 255;
+  uint32_t timeoutUs = 55000000;
+
+  AutotuneState state = AUTOTUNE_IDLE;
+  const char* error = NULL;
+  float setpoint = 0;
+  float bias = 0;
+  float output = 0;
+  bool high = true;
+  uint32_t startUs = 0;
+  uint32_t switchUs = 0;
+  uint32_t highUs = 0;
+  uint32_t lowUs = 0;
+  bool cycleStarted = false;
+  uint32_t cycleStartUs = 0;
+  int cycles = 0;
+  float peakHigh = 0;
+  float peakLow = 0;
+  float periodSum = 0;
+  float periodMin = 0;
+  float periodMax = 0;
+  float amplitudeSum = 0;
+  float swingSum = 0;
+  float ultimateGain = 0;
+  float ultimatePeriod = 0;
+};
@@ -1,43 +1,216 @@
+#pragma once
+
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <FS.h>
+#include <Preferences.h>
 #include <SPIFFS.h>
+#include <esp_partition.h>
+#include <stddef.h>
+
+#include "config_fields.h"
+
+// Device configuration. config.json on SPIFFS is parsed and validated once
+// into the typed `config` struct, which is then cached in NVS along with the
+// SHA-256 of the SPIFFS partition. Later boots only hash the partition and
+// read the struct back; SPIFFS is mounted and the JSON parsed again only when
+// the partition changed, i.e. after `pio run -t uploadfs`. The struct and
+// its field table are in config_fields.h.
 
-StaticJsonDocument<512> config;
+#define CONFIG_JSON_SIZE 1536
+
+Config config;
 
 const char* configSpiffsError = "Spiffs Error";
 const char* configFileNotFound = "File not found";
+const char* configNvsError = "NVS Error";
+char configError[64];
+// Not fatal, so loadConfig carries on. Kept for setup() to print once
+// SerialTelemetryTask is up, as the port may be carrying binary frames.
+char configWarning[64];
 
-const char* loadConfigFile() {
-  if (!SPIFFS.begin(false)) {
-    Serial.println("SPIFFS Mount Failed, attempting to format...");
-    SPIFFS.format();  // Format the filesystem
-
-    // Attempt to mount again after formatting
-    if (!SPIFFS.begin(true)) {
-      Serial.println("SPIFFS Mount Failed after formatting");
-      return configSpiffsError;
+// Returns an error message, or NULL when the value was stored
+const char* setConfigField(const ConfigField& field, JsonVariantConst value) {
+  void* target = (uint8_t*)&config + field.offset;
+  switch (field.type) {
+    case CONFIG_STRING: {
+      const char* text = value.as<const char*>();
+      if (!value.is<const char*>()) {
+        snprintf(configError, sizeof(configError), "%s must be a string", field.key);
+      } else if (strlen(text) >= field.size) {
+        snprintf(configError, sizeof(configError), "%s is longer than %d", field.key, field.size - 1);
+      } else if (field.check != NULL && field.check(text) != NULL) {
+        snprintf(configError, sizeof(configError), "%s: %s", field.key, field.check(text));
+      } else {
+        strlcpy((char*)target, text, field.size);
+        return NULL;
+      }
+      return configError;
+    }
+    case CONFIG_INT:
+    case CONFIG_FLOAT: {
+      if (field.type == CONFIG_INT ? !value.is<long>() : !value.is<float>()) {
+        snprintf(configError, sizeof(configError), "%s must be %s", field.key, field.type == CONFIG_INT ? "an integer" : "a number");
+        return configError;
+      }
+      float number = value.as<float>();
+      // Written so that NaN fails too
+      if (!(number >= field.minimum && number <= field.maximum)) {
+        snprintf(configError, sizeof(configError), "%s must be %g to %g", field.key, field.minimum, field.maximum);
+        return configError;
+      }
+      if (field.type == CONFIG_INT) {
+        *(int*)target = value.as<long>();
+      } else {
+        *(float*)target = number;
+      }
+      return NULL;
     }
   }
+  return NULL;
+}
+
+// For values typed in over serial or MQTT
+const char* setConfigFieldText(const ConfigField& field, const char* text) {
+  StaticJsonDocument<32> value;
+  char* end = NULL;
+  switch (field.type) {
+    case CONFIG_STRING:
+      value.set(text);
+      break;
+    case CONFIG_INT:
+      value.set(strtol(text, &end, 10));
+      break;
+    case CONFIG_FLOAT:
+      value.set(strtof(text, &end));
+      break;
+  }
+  if (end != NULL && (end == text || *end != '\0')) {
+    snprintf(configError, sizeof(configError), "%s must be a number", field.key);
+    return configError;
+  }
+  return setConfigField(field, value.as<JsonVariantConst>());
+}
+
+// Secrets come out as ***
+void formatConfigField(const ConfigField& field, char* out, size_t size) {
+  const void* source = (const uint8_t*)&config + field.offset;
+  if (field.secret) {
+    strlcpy(out, "***", size);
+    return;
+  }
+  switch (field.type) {
+    case CONFIG_STRING:
+      strlcpy(out, (const char*)source, size);
+      break;
+    case CONFIG_INT:
+      snprintf(out, size, "%d", *(const int*)source);
+      break;
+    case CONFIG_FLOAT:
+      snprintf(out, size, "%.4f", *(const float*)source);
+      break;
+  }
+}
+
+void printConfigField(const ConfigField& field, Print& out) {
+  char text[CONFIG_TEXT_SIZE];
+  formatConfigField(field, text, sizeof(text));
+  out.print(text);
+}
 
+const char* parseConfigFile() {
+  // Only mounted when config.json changed, and never formatted: a blank
+  // partition means the filesystem image hasn't been uploaded yet
+  if (!SPIFFS.begin(false)) {
+    return configSpiffsError;
+  }
   File configFile = SPIFFS.open("/config.json", "r");
   if (!configFile) {
+    SPIFFS.end();
     return configFileNotFound;
   }
-  DeserializationError error = deserializeJson(config, configFile);
+  StaticJsonDocument<CONFIG_JSON_SIZE> json;
+  DeserializationError error = deserializeJson(json, configFile);
+  configFile.close();
+  SPIFFS.end();
   if (error) {
-    Serial.println("DeserializationError error = deserializeJson(config, configFile)");
-    return error.c_str();
+    snprintf(configError, sizeof(configError), "config.json: %s", error.c_str());
+    return configError;
+  }
+
+  setConfigDefaults(config);
+  int unknownKeys = 0;
+  for (JsonPairConst pair : json.as<JsonObjectConst>()) {
+    const ConfigField* field = findConfigField(pair.key().c_str());
+    if (field == NULL) {
+      if (unknownKeys++ == 0) {
+        snprintf(configWarning, sizeof(configWarning), "config.json: ignoring unknown key %s", pair.key().c_str());
+      } else {
+        snprintf(configWarning, sizeof(configWarning), "config.json: ignoring %d unknown keys", unknownKeys);
+      }
+      continue;
+    }
+    const char* fieldError = setConfigField(*field, pair.value());
+    if (fieldError != NULL) {
+      return fieldError;
+    }
+  }
+  for (int i = 0; i < configFieldCount; i++) {
+    const ConfigField& field = configFields[i];
+    if (field.required && field.type == CONFIG_STRING && ((const char*)&config + field.offset)[0] == '\0') {
+      snprintf(configError, sizeof(configError), "%s is required", field.key);
+      return configError;
+    }
   }
   return NULL;
 }
 
-const char* getConfigValue(const char* key) {
-  return config[key];
+bool spiffsPartitionHash(uint8_t* sha) {
+  const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  return partition != NULL && esp_partition_get_sha256(partition, sha) == ESP_OK;
+}
+
+// Writes the current config to NVS. Changes made at runtime take effect on
+// the next boot, and last until config.json is uploaded again.
+const char* saveConfig() {
+  Preferences preferences;
+  if (!preferences.begin("config", false)) {
+    return configNvsError;
+  }
+  bool ok = preferences.putBytes("config", &config, sizeof(Config)) == sizeof(Config) &&
+            preferences.putUShort("version", CONFIG_VERSION);
+  preferences.end();
+  return ok ? NULL : configNvsError;
 }
-const int getConfigIntValue(const char* key) {
-  return config[key];
+
+const char* loadConfig() {
+  uint8_t sha[32];
+  uint8_t cachedSha[32];
+  bool hashed = spiffsPartitionHash(sha);
+
+  Preferences preferences;
+  preferences.begin("config", false);
+  bool cached = hashed && preferences.getUShort("version") == CONFIG_VERSION &&
+                preferences.getBytesLength("config") == sizeof(Config) &&
+                preferences.getBytes("sha", cachedSha, sizeof(cachedSha)) == sizeof(cachedSha) &&
+                memcmp(sha, cachedSha, sizeof(sha)) == 0;
+  if (cached) {
+    preferences.getBytes("config", &config, sizeof(Config));
+    preferences.end();
+    return NULL;
+  }
+
+  const char* error = parseConfigFile();
+  if (error != NULL) {
+    preferences.end();
+    return error;
+  }
+  bool ok = preferences.putBytes("config", &config, sizeof(Config)) == sizeof(Config) &&
+            (!hashed || preferences.putBytes("sha", sha, sizeof(sha)) == sizeof(sha)) &&
+            preferences.putUShort("version", CONFIG_VERSION);
+  preferences.end();
+  if (!ok) {
+    strlcpy(configWarning, "Unable to cache config in NVS", sizeof(configWarning));
+  }
+  return NULL;
 }
-const float getConfigFloatValue(const char* key, float fallback = 0) {
-  return config[key] | fallback;
-}
\ No newline at end of file
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "filters.h"
+#include "pid.h"
+
+// The Config struct and its field table: names, types, defaults and ranges.
+// Kept apart from config.h's SPIFFS, NVS and JSON handling so tools/sim can
+// build the same defaults on the host.
+//
+// Add a field to both Config and configFields, and bump CONFIG_VERSION
+// whenever the struct layout changes.
+
+#define CONFIG_VERSION 13
+#define CONFIG_TEXT_SIZE 128  // Longest string field
+
+typedef struct {
+  char deviceId[32];
+  char wifiUser[64];
+  char wifiPass[64];
+  char ntpServer[64];
+  char mqttServer[64];
+  int mqttPort;
+
+  float flowK;
+  float flowCorrectK;
+  // Stirrer PID, see pid.h
+  float rpmKp;
+  float rpmKi;        // Per second
+  float rpmKd;        // s
+  float rpmRamp;      // rpm/s, 0 for none
+  float rpmTracking;  // s, anti-windup, 0 for kp / ki
+  char rpmFeedforward[FEEDFORWARD_SPEC_SIZE];  // rpm:pwm pairs, empty to use the motor model
+  int maxRpm;
+  int encoderMinCounts;  // See rpm_estimator.h
+  int encoderMaxWindow;  // ms
+
+  // Pump flow control, see pid.h
+  int pumpFlowControl;  // 0 knob sets PWM, 1 knob sets flow
+  float maxFlow;        // L/min at full knob
+  float flowKp;         // PWM per L/min
+  float flowKi;         // Per second
+  float flowKd;         // s
+  char flowFeedforward[FEEDFORWARD_SPEC_SIZE];  // L/min:pwm pairs, empty for none
+
+  // H-bridge outputs, see actuator.h
+  float stirrerSlew;   // PWM/s, 0 for no limit
+  float pumpSlew;      // PWM/s, 0 for no limit
+  int stirrerReverse;  // 1 runs the stirrer backward
+
+  // Stirrer speed observer, see speed_observer.h
+  int rpmFeedback;  // 0 filtered encoder, 1 observer
+  float motorGain;
+  float motorOffset;
+  float motorTau;  // ms
+  float observerNoise;
+
+  // SensorFilter specs, see filters.h
+  char encoderFilter[SENSOR_FILTER_SPEC_SIZE];
+  char angleFilter[SENSOR_FILTER_SPEC_SIZE];
+  char flowFilter[SENSOR_FILTER_SPEC_SIZE];
+  char conductFilter[SENSOR_FILTER_SPEC_SIZE];
+
+  // ms
+  int encoderInterval;
+  int stirrerInterval;
+  int pumpInterval;
+  int angleInterval;
+  int conductInterval;
+  int thermocoupleInterval;
+  int flowInterval;
+  int hassInterval;
+
+  // Adaptive sampling of the angle, conductivity and thermocouple sensors,
+  // see adaptive_rate.h. Each runs between its interval above / sampleBoost
+  // and * sampleBackoff, never below the interval's minimum.
+  int adaptiveSampling;        // 0 fixed intervals
+  float sampleBudget;          // % of I2C time for everything on the bus
+  float sampleBoost;
+  float sampleBackoff;
+  float angleActivity;         // Raw counts
+  float conductActivity;       // ms/cm
+  float thermocoupleActivity;  // C
+
+  int serialBaud;
+  int serialInterval;
+  int renderFps;
+
+  char influxUrl[128];
+  char influxOrg[32];
+  char influxBucket[32];
+  char influxToken[128];
+  int influxBatchSize;
+  int influxGzip;
+  int influxFlushInterval;
+
+  char udpHost[64];
+  int udpPort;
+  int udpFlushInterval;
+
+  int httpPort;        // 0 for no web server
+  char httpToken[64];  // Required as ?token= when set
+  int wsMaxClients;
+} Config;
+
+enum ConfigFieldType : uint8_t {
+  CONFIG_STRING,
+  CONFIG_INT,
+  CONFIG_FLOAT,
+};
+
+typedef struct {
+  const char* key;
+  ConfigFieldType type;
+  uint16_t offset;
+  uint16_t size;
+  bool required;
+  const char* text;  // Default for strings
+  float number;      // Default for numbers
+  float minimum;
+  float maximum;
+  bool secret;  // Never printed back
+  // Checks a string beyond its length, returns an error message or NULL
+  const char* (*check)(const char* text);
+} ConfigField;
+
+#define CONFIG_TEXT(name, required, fallback, secret) {#name, CONFIG_STRING, offsetof(Config, name), sizeof(Config::name), required, fallback, 0, 0, 0, secret, nullptr}
+#define CONFIG_INT(name, fallback, minimum, maximum) {#name, CONFIG_INT, offsetof(Config, name), sizeof(int), false, NULL, fallback, minimum, maximum, false, nullptr}
+#define CONFIG_FLOAT(name, fallback, minimum, maximum) {#name, CONFIG_FLOAT, offsetof(Config, name), sizeof(float), false, NULL, fallback, minimum, maximum, false, nullptr}
+#define CONFIG_CHECKED(name, fallback, check) {#name, CONFIG_STRING, offsetof(Config, name), sizeof(Config::name), false, fallback, 0, 0, 0, false, check}
+#define CONFIG_FILTER(name, fallback) CONFIG_CHECKED(name, fallback, checkFilterSpec)
+
+inline const char* checkFilterSpec(const char* text) {
+  SensorFilterSpec spec;
+  return parseSensorFilterSpec(text, &spec);
+}
+
+inline const char* checkFeedforwardSpec(const char* text) {
+  FeedforwardMap map;
+  return map.parse(text);
+}
+
+const ConfigField configFields[] = {
+    CONFIG_TEXT(deviceId, true, "", false),
+    CONFIG_TEXT(wifiUser, true, "", false),
+    CONFIG_TEXT(wifiPass, true, "", true),
+    CONFIG_TEXT(ntpServer, false, "pool.ntp.org", false),
+    CONFIG_TEXT(mqttServer, true, "", false),
+    CONFIG_INT(mqttPort, 1883, 1, 65535),
+
+    CONFIG_FLOAT(flowK, 1.0, 0.001, 1000),
+    CONFIG_FLOAT(flowCorrectK, 1.0, 0.001, 1000),
+    CONFIG_FLOAT(rpmKp, 0.6, 0, 10),
+    CONFIG_FLOAT(rpmKi, 1, 0, 100),
+    CONFIG_FLOAT(rpmKd, 0, 0, 1),
+    CONFIG_FLOAT(rpmRamp, 300, 0, 10000),
+    CONFIG_FLOAT(rpmTracking, 0, 0, 10),
+    CONFIG_CHECKED(rpmFeedforward, "", checkFeedforwardSpec),
+    CONFIG_INT(maxRpm, 380, 1, 2000),
+    CONFIG_INT(encoderMinCounts, 8, 0, 420),
+    CONFIG_INT(encoderMaxWindow, 250, 10, 2000),
+
+    CONFIG_INT(pumpFlowControl, 0, 0, 1),
+    CONFIG_FLOAT(maxFlow, 2, 0.1, 100),
+    CONFIG_FLOAT(flowKp, 40, 0, 1000),
+    CONFIG_FLOAT(flowKi, 80, 0, 10000),
+    CONFIG_FLOAT(flowKd, 0, 0, 10),
+    CONFIG_CHECKED(flowFeedforward, "", checkFeedforwardSpec),
+
+    CONFIG_FLOAT(stirrerSlew, 0, 0, 10000),
+    CONFIG_FLOAT(pumpSlew, 0, 0, 10000),
+    CONFIG_INT(stirrerReverse, 0, 0, 1),
+
+    CONFIG_INT(rpmFeedback, 0, 0, 1),
+    CONFIG_FLOAT(motorGain, 1.8, 0.01, 50),
+    CONFIG_FLOAT(motorOffset, 40, 0, 255),
+    CONFIG_FLOAT(motorTau, 300, 10, 10000),
+    CONFIG_FLOAT(observerNoise, 20000, 0, 10000000),
+
+    CONFIG_FILTER(encoderFilter, "mean 5"),
+    CONFIG_FILTER(angleFilter, "deadband 10"),
+    CONFIG_FILTER(flowFilter, "mean 5"),
+    CONFIG_FILTER(conductFilter, "none"),
+
+    CONFIG_INT(encoderInterval, 25, 10, 1000),
+    CONFIG_INT(stirrerInterval, 25, 10, 1000),
+    CONFIG_INT(pumpInterval, 100, 10, 1000),
+    CONFIG_INT(angleInterval, 100, 10, 1000),
+    CONFIG_INT(conductInterval, 100, 50, 10000),
+    CONFIG_INT(thermocoupleInterval, 1000, 250, 10000),
+    CONFIG_INT(flowInterval, 100, 50, 10000),
+    CONFIG_INT(hassInterval, 2000, 500, 60000),
+
+    CONFIG_INT(adaptiveSampling, 1, 0, 1),
+    CONFIG_FLOAT(sampleBudget, 10, 0.1, 100),
+    CONFIG_FLOAT(sampleBoost, 4, 1, 100),
+    CONFIG_FLOAT(sampleBackoff, 1, 1, 100),
+    CONFIG_FLOAT(angleActivity, 30, 0, 4096),
+    CONFIG_FLOAT(conductActivity, 0.05, 0, 100),
+    CONFIG_FLOAT(thermocoupleActivity, 0.5, 0, 100),
+
+    CONFIG_INT(serialBaud, 115200, 9600, 2000000),
+    CONFIG_INT(serialInterval, 500, 50, 10000),
+    CONFIG_INT(renderFps, 10, 1, 50),
+
+    CONFIG_TEXT(influxUrl, false, "", false),
+    CONFIG_TEXT(influxOrg, false, "", false),
+    CONFIG_TEXT(influxBucket, false, "", false),
+    CONFIG_TEXT(influxToken, false, "", true),
+    CONFIG_INT(influxBatchSize, 100, 1, 1000),
+    CONFIG_INT(influxGzip, 1, 0, 1),
+    CONFIG_INT(influxFlushInterval, 1000, 100, 60000),
+
+    CONFIG_TEXT(udpHost, false, "", false),
+    CONFIG_INT(udpPort, 5555, 1, 65535),
+    CONFIG_INT(udpFlushInterval, 100, 10, 10000),
+
+    CONFIG_INT(httpPort, 0, 0, 65535),
+    CONFIG_TEXT(httpToken, false, "", true),
+    CONFIG_INT(wsMaxClients, 2, 1, 8),
+};
+const int configFieldCount = sizeof(configFields) / sizeof(ConfigField);
+
+inline const ConfigField* findConfigField(const char* key) {
+  for (int i = 0; i < configFieldCount; i++) {
+    if (strcmp(configFields[i].key, key) == 0) {
+      return &configFields[i];
+    }
+  }
+  return NULL;
+}
+
+inline void setConfigDefaults(Config& target) {
+  memset(&target, 0, sizeof(Config));
+  for (int i = 0; i < configFieldCount; i++) {
+    const ConfigField& field = configFields[i];
+    void* value = (uint8_t*)&target + field.offset;
+    switch (field.type) {
+      case CONFIG_STRING:
+        strncpy((char*)value, field.text, field.size - 1);  // Zeroed above, so terminated
+        break;
+      case CONFIG_INT:
+        *(int*)value = field.number;
+        break;
+      case CONFIG_FLOAT:
+        *(float*)value = field.number;
+        break;
+    }
+  }
+}
+
+// Without a map in config, the PWM the motor model says holds each speed
+inline void buildStirrerFeedforward(const Config& source, FeedforwardMap* feedforward) {
+  feedforward->clear();
+  if (source.rpmFeedforward[0] == '\0' || feedforward->parse(source.rpmFeedforward) != NULL) {
+    feedforward->add(0, source.motorOffset);
+    feedforward->add(source.maxRpm, source.motorOffset + source.maxRpm / source.motorGain);
+  }
+}
@@ -12,6 +12,18 @@ enum EventType : uint16_t
   MQTT_SERVER_CONNECTED,
   MQTT_SERVER_DISCONNECTED,
   MQTT_SERVER_CONNECT_FAILED,
+
+  CLOCK_OFFSET_DATA,
+  CLOCK_DRIFT_DATA,
+
+  HEAP_FREE_DATA,
+  HEAP_LARGEST_BLOCK_DATA,
+  HEAP_MIN_FREE_DATA,
+  PSRAM_USED_DATA,
+  STACK_LOOP_FREE_DATA,
+  STACK_MIN_FREE_DATA,
+  CPU_LOAD_CORE0_DATA,
+  CPU_LOAD_CORE1_DATA,
   
   SERIAL_DATA,
 
@@ -24,6 +36,8 @@ enum EventType : uint16_t
   ENCODER_1_CONNECTED,
   ENCODER_1_ERROR,
   ENCODER_1_DATA,
+  ENCODER_1_LATENCY_DATA,
+  ENCODER_1_NOISE_DATA,
 
   FLOW_SENSOR_1_CONNECTED,
   FLOW_SENSOR_1_DATA,
@@ -40,4 +54,10 @@ enum EventType : uint16_t
   UI_REQUEST_CALIBRATION,
 
   DEBUG_MESSAGE
-};
\ No newline at end of file
+};
+
+// Payload of the sensor *_DATA events
+typedef struct {
+  float value;
+  int64_t timestamp;  // Acquisition time in us since the Unix epoch, 0 before SNTP sync
+} SensorReading;
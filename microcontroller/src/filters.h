@@ -0,0 +1,311 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Smoothing for sensor readings. Each filter's storage is sized at compile
+// time and held inline, so nothing is allocated, and update() is O(1) apart
+// from the median's O(N) insert into its sorted window. tools/bench/
+// filter_bench times them, and test/test_filters checks their outputs.
+//
+// SensorFilter chains one of them with an optional deadband and is set up
+// from a short text spec, which is how sensor tasks take it from config.json:
+//
+//   "none", "mean 5", "ema 0.2", "median 5", "mean 5 deadband 2", "deadband 10"
+
+// Mean of the last window values, window <= N
+template <int N>
+class MovingAverage {
+ public:
+  MovingAverage(int _window = N) { setWindow(_window); }
+
+  void setWindow(int _window) {
+    window = _window < 1 ? 1 : (_window > N ? N : _window);
+    reset();
+  }
+
+  void reset() {
+    count = 0;
+    next = 0;
+    sum = 0;
+  }
+
+  float update(float value) {
+    if (count == window) {
+      sum -= values[next];
+    } else {
+      count++;
+    }
+    values[next] = value;
+    sum += value;
+    if (++next == window) {
+      // Re-add once per lap so float rounding in the running sum can't build up
+      next = 0;
+      sum = 0;
+      for (int i = 0; i < count; i++) {
+        sum += values[i];
+      }
+    }
+    return sum / count;
+  }
+
+  int getWindow() const { return window; }
+
+ private:
+  float values[N];
+  float sum;
+  int window;
+  int count;
+  int next;
+};
+
+// First order IIR, output += alpha * (input - output). Starts at the first
+// value rather than ramping up from 0.
+class ExponentialFilter {
+ public:
+  ExponentialFilter(float _alpha = 1) { setAlpha(_alpha); }
+
+  void setAlpha(float _alpha) {
+    alpha = _alpha;
+    reset();
+  }
+
+  void reset() { primed = false; }
+
+  float getAlpha() const { return alpha; }
+
+  float update(float value) {
+    output = primed ? output + alpha * (value - output) : value;
+    primed = true;
+    return output;
+  }
+
+ private:
+  float alpha;
+  float output = 0;
+  bool primed = false;
+};
+
+// Median of the last window values, window <= N. Rejects single spikes,
+// which a mean only spreads out.
+template <int N>
+class RunningMedian {
+ public:
+  RunningMedian(int _window = N) { setWindow(_window); }
+
+  void setWindow(int _window) {
+    window = _window < 1 ? 1 : (_window > N ? N : _window);
+    reset();
+  }
+
+  void reset() {
+    count = 0;
+    next = 0;
+  }
+
+  float update(float value) {
+    int i;
+    if (count == window) {
+      // Take the oldest value out of the sorted window
+      float oldest = values[next];
+      for (i = 0; i < count - 1 && sorted[i] != oldest; i++) {
+      }
+      for (; i < count - 1; i++) {
+        sorted[i] = sorted[i + 1];
+      }
+      count--;
+    }
+    for (i = count; i > 0 && sorted[i - 1] > value; i--) {
+      sorted[i] = sorted[i - 1];
+    }
+    sorted[i] = value;
+    count++;
+    values[next] = value;
+    next = next + 1 == window ? 0 : next + 1;
+
+    return count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+  }
+
+  int getWindow() const { return window; }
+
+ private:
+  float values[N];  // In arrival order
+  float sorted[N];
+  int window;
+  int count;
+  int next;
+};
+
+// Holds its output until the input has moved more than band away from it,
+// so noise around a steady value doesn't produce a stream of small changes
+class Deadband {
+ public:
+  Deadband(float _band = 0) { setBand(_band); }
+
+  void setBand(float _band) {
+    band = _band;
+    reset();
+  }
+
+  void reset() { primed = false; }
+
+  float update(float value) {
+    if (!primed || fabsf(value - output) > band) {
+      output = value;
+      primed = true;
+    }
+    return output;
+  }
+
+ private:
+  float band;
+  float output = 0;
+  bool primed = false;
+};
+
+#define SENSOR_FILTER_MAX_WINDOW 16
+#define SENSOR_FILTER_SPEC_SIZE 24
+
+enum SensorFilterType : uint8_t {
+  SENSOR_FILTER_NONE,
+  SENSOR_FILTER_MEAN,
+  SENSOR_FILTER_EMA,
+  SENSOR_FILTER_MEDIAN,
+};
+
+typedef struct {
+  SensorFilterType type;
+  int window;      // mean and median
+  float alpha;     // ema
+  float deadband;  // 0 for none
+} SensorFilterSpec;
+
+// Returns an error message, or NULL when spec was parsed into out
+inline const char* parseSensorFilterSpec(const char* spec, SensorFilterSpec* out) {
+  char text[SENSOR_FILTER_SPEC_SIZE];
+  if (strlen(spec) >= sizeof(text)) {
+    return "filter spec too long";
+  }
+  strcpy(text, spec);
+  *out = {SENSOR_FILTER_NONE, 1, 1, 0};
+
+  bool first = true;
+  char* save;
+  for (char* word = strtok_r(text, " ", &save); word != NULL; word = strtok_r(NULL, " ", &save), first = false) {
+    if (first && strcmp(word, "none") == 0) {
+      continue;
+    }
+    SensorFilterType type = SENSOR_FILTER_NONE;
+    if (first && strcmp(word, "mean") == 0) {
+      type = SENSOR_FILTER_MEAN;
+    } else if (first && strcmp(word, "ema") == 0) {
+      type = SENSOR_FILTER_EMA;
+    } else if (first && strcmp(word, "median") == 0) {
+      type = SENSOR_FILTER_MEDIAN;
+    } else if (strcmp(word, "deadband") != 0) {
+      return "use none|mean N|ema A|median N [deadband D]";
+    }
+
+    char* argument = strtok_r(NULL, " ", &save);
+    char* end = NULL;
+    float number = argument ? strtof(argument, &end) : 0;
+    if (argument == NULL || end == argument || *end != '\0') {
+      return "filter is missing a number";
+    }
+    switch (type) {
+      case SENSOR_FILTER_MEAN:
+      case SENSOR_FILTER_MEDIAN:
+        if (number != (int)number || number < 1 || number > SENSOR_FILTER_MAX_WINDOW) {
+          return "filter window must be 1 to 16";
+        }
+        out->window = number;
+        break;
+      case SENSOR_FILTER_EMA:
+        if (!(number > 0 && number <= 1)) {
+          return "ema alpha must be 0 to 1";
+        }
+        out->alpha = number;
+        break;
+      case SENSOR_FILTER_NONE:
+        if (!(number >= 0)) {
+          return "deadband must be at least 0";
+        }
+        out->deadband = number;
+        // Nothing may follow the deadband
+        if (strtok_r(NULL, " ", &save) != NULL) {
+          return "deadband must come last";
+        }
+        return NULL;
+    }
+    out->type = type;
+  }
+  return NULL;
+}
+
+class SensorFilter {
+ public:
+  SensorFilter() { configure("none"); }
+
+  // Returns an error message and leaves the filter as it was if spec is bad
+  const char* configure(const char* spec) {
+    SensorFilterSpec parsed;
+    const char* error = parseSensorFilterSpec(spec, &parsed);
+    if (error != NULL) {
+      return error;
+    }
+    type = parsed.type;
+    mean.setWindow(parsed.window);
+    median.setWindow(parsed.window);
+    ema.setAlpha(parsed.alpha);
+    deadband.setBand(parsed.deadband);
+    return NULL;
+  }
+
+  void reset() {
+    mean.reset();
+    median.reset();
+    ema.reset();
+    deadband.reset();
+  }
+
+  // How many samples the output lags a ramp by, before the deadband
+  float getDelaySamples() const {
+    switch (type) {
+      case SENSOR_FILTER_MEAN:
+        return (mean.getWindow() - 1) / 2.0f;
+      case SENSOR_FILTER_MEDIAN:
+        return (median.getWindow() - 1) / 2.0f;
+      case SENSOR_FILTER_EMA:
+        return (1 - ema.getAlpha()) / ema.getAlpha();
+      case SENSOR_FILTER_NONE:
+        break;
+    }
+    return 0;
+  }
+
+  float update(float value) {
+    switch (type) {
+      case SENSOR_FILTER_MEAN:
+        value = mean.update(value);
+        break;
+      case SENSOR_FILTER_EMA:
+        value = ema.update(value);
+        break;
+      case SENSOR_FILTER_MEDIAN:
+        value = median.update(value);
+        break;
+      case SENSOR_FILTER_NONE:
+        break;
+    }
+    return deadband.update(value);
+  }
+
+ private:
+  SensorFilterType type = SENSOR_FILTER_NONE;
+  MovingAverage<SENSOR_FILTER_MAX_WINDOW> mean;
+  RunningMedian<SENSOR_FILTER_MAX_WINDOW> median;
+  ExponentialFilter ema;
+  Deadband deadband;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Pre-rasterized glyphs for the characters that make up the numeric value
+// fields. The 1 bit-per-pixel GFXfont bitmaps are expanded once at boot into
+// byte masks, so drawing a number is a handful of row copies into an
+// off-screen RGB565 buffer instead of per-pixel font rendering on the LCD.
+//
+// Works on any Adafruit GFX style font (FreeSansBold9pt7b, or the bundled
+// FreeSans8pt7b in assets/Regular 400.h) and has no Arduino dependencies so
+// tools/bench can time it on the host.
+
+#define GLYPH_ATLAS_CHARSET "0123456789.-"
+#define GLYPH_ATLAS_SIZE 12
+#define GLYPH_ATLAS_MAX_PIXELS 4096
+
+class GlyphAtlas {
+ public:
+  GlyphAtlas() {
+    memset(lookup, -1, sizeof(lookup));
+  }
+
+  // Font is any struct laid out like GFXfont
+  template <typename Font>
+  bool build(const Font* font) {
+    const char* charset = GLYPH_ATLAS_CHARSET;
+    size_t used = 0;
+    memset(lookup, -1, sizeof(lookup));
+
+    for (int i = 0; i < GLYPH_ATLAS_SIZE; i++) {
+      uint8_t c = charset[i];
+      if (c < font->first || c > font->last) {
+        continue;
+      }
+      const auto& glyph = font->glyph[c - font->first];
+      size_t pixels = glyph.width * glyph.height;
+      if (used + pixels > GLYPH_ATLAS_MAX_PIXELS) {
+        return false;
+      }
+
+      Entry& entry = entries[i];
+      entry.offset = used;
+      entry.width = glyph.width;
+      entry.height = glyph.height;
+      entry.xAdvance = glyph.xAdvance;
+      entry.xOffset = glyph.xOffset;
+      entry.yOffset = glyph.yOffset;
+
+      // Glyph bitmaps are packed MSB first with no padding between rows
+      const uint8_t* bitmap = font->bitmap + glyph.bitmapOffset;
+      for (size_t bit = 0; bit < pixels; bit++) {
+        masks[used + bit] = (bitmap[bit >> 3] & (0x80 >> (bit & 7))) ? 1 : 0;
+      }
+      used += pixels;
+      lookup[c] = i;
+    }
+    // Anything outside the charset takes up the width of a digit
+    fallbackAdvance = lookup['0'] >= 0 ? entries[lookup['0']].xAdvance : 0;
+    return true;
+  }
+
+  // Draws text with its baseline at (x, y) into an RGB565 buffer that's
+  // already filled with the background. Returns the pixels written.
+  int draw(uint16_t* dst, int dstW, int dstH, int x, int y, const char* text, uint16_t color) const {
+    int written = 0;
+    for (const char* p = text; *p; p++) {
+      uint8_t c = *p;
+      int8_t index = c < 128 ? lookup[c] : -1;
+      if (index < 0) {
+        x += fallbackAdvance;
+        continue;
+      }
+      const Entry& entry = entries[index];
+      const uint8_t* mask = masks + entry.offset;
+      int left = x + entry.xOffset;
+      int top = y + entry.yOffset;
+
+      for (int row = 0; row < entry.height; row++) {
+        int dy = top + row;
+        if (dy < 0 || dy >= dstH) {
+          continue;
+        }
+        uint16_t* line = dst + dy * dstW;
+        const uint8_t* maskRow = mask + row * entry.width;
+        for (int col = 0; col < entry.width; col++) {
+          int dx = left + col;
+          if (maskRow[col] && dx >= 0 && dx < dstW) {
+            line[dx] = color;
+            written++;
+          }
+        }
+      }
+      x += entry.xAdvance;
+    }
+    return written;
+  }
+
+ private:
+  typedef struct {
+    uint16_t offset;
+    uint8_t width;
+    uint8_t height;
+    uint8_t xAdvance;
+    int8_t xOffset;
+    int8_t yOffset;
+  } Entry;
+
+  Entry entries[GLYPH_ATLAS_SIZE] = {};
+  int8_t lookup[128];
+  uint8_t masks[GLYPH_ATLAS_MAX_PIXELS];
+  uint8_t fallbackAdvance = 0;
+};
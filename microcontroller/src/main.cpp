@@ -9,22 +9,31 @@
 #include <TaskSchedulerDeclarations.h>
 #include <Wire.h>
 
+#include <new>
+
 #include "DFRobot_EC10.h"
 #include "config.h"
 #include "events.h"
+#include "print_format.h"
+#include "sensor_math_bench.h"
 #include "tasks/AngleSensor.cpp"
 #include "tasks/ConductSensor.cpp"
+#include "tasks/Diagnostics.cpp"
 #include "tasks/Eduroam.cpp"
 #include "tasks/Encoder.cpp"
 #include "tasks/FlowSensor.cpp"
 #include "tasks/HBridge.cpp"
 #include "tasks/HomeAssistant.cpp"
 #include "tasks/I2CHub.cpp"
+#include "tasks/Influx.cpp"
 #include "tasks/MQTT.cpp"
 #include "tasks/PortBHub.cpp"
 #include "tasks/Renderer.cpp"
 #include "tasks/SerialReciever.cpp"
+#include "tasks/SerialTelemetry.cpp"
 #include "tasks/Thermocouple.cpp"
+#include "tasks/UDPTelemetry.cpp"
+#include "tasks/WebServer.cpp"
 
 float ecVoltage, ecValue, temperature = 25;
 DFRobot_EC10 ec;
@@ -34,31 +43,57 @@ DFRobot_EC10 ec;
 Scheduler ts;
 TSEvents::EventBus e;
 
-hassSensor sensors[4] = {
-    {"cond_rate", "Water Conductivity", "temperature", "ms/cm", CONDUCT_SENSOR_DATA, 0, false},
-    {"water_temp", "Water Temperature", "temperature", "°C", THERMOCOUPLE_DATA, 0, false},
-    {"flow_rate", "Flow Rate", "water", "l/min", FLOW_SENSOR_1_DATA, 0, false},
-    //{"stirrer_rate", "Rotation Rate", "water", "rpm", ENCODER_1_DATA, 0, false}, //rpm
-    {"flow_rate2", "Flow Rate", "water", "l/min", ENCODER_1_DATA, 0, false},
+hassSensor sensors[] = {
+    {"cond_rate", "Water Conductivity", "temperature", "ms/cm", CONDUCT_SENSOR_DATA, false},
+    {"water_temp", "Water Temperature", "temperature", "°C", THERMOCOUPLE_DATA, false},
+    {"flow_rate", "Flow Rate", "water", "l/min", FLOW_SENSOR_1_DATA, false},
+    //{"stirrer_rate", "Rotation Rate", "water", "rpm", ENCODER_1_DATA, false}, //rpm
+    {"flow_rate2", "Flow Rate", "water", "l/min", ENCODER_1_DATA, false},
+    {"stirrer_latency", "Stirrer Speed Latency", "duration", "ms", ENCODER_1_LATENCY_DATA, true},
+    {"stirrer_noise", "Stirrer Speed Noise", NULL, "rpm", ENCODER_1_NOISE_DATA, true},
+    {"clock_offset", "Clock Offset", "duration", "ms", CLOCK_OFFSET_DATA, true},
+    {"clock_drift", "Clock Drift", NULL, "ppm", CLOCK_DRIFT_DATA, true},
+    {"heap_free", "Free Heap", "data_size", "KiB", HEAP_FREE_DATA, true},
+    {"heap_largest_block", "Largest Free Block", "data_size", "KiB", HEAP_LARGEST_BLOCK_DATA, true},
+    {"heap_min_free", "Minimum Free Heap", "data_size", "KiB", HEAP_MIN_FREE_DATA, true},
+    {"psram_used", "PSRAM Used", "data_size", "KiB", PSRAM_USED_DATA, true},
+    {"stack_loop_free", "Loop Stack Headroom", "data_size", "B", STACK_LOOP_FREE_DATA, true},
+    {"stack_min_free", "Lowest Stack Headroom", "data_size", "B", STACK_MIN_FREE_DATA, true},
+    {"cpu_core0", "CPU Core 0 Load", NULL, "%", CPU_LOAD_CORE0_DATA, true},
+    {"cpu_core1", "CPU Core 1 Load", NULL, "%", CPU_LOAD_CORE1_DATA, true},
 };
+const int sensorCount = sizeof(sensors) / sizeof(hassSensor);
+static_assert(sensorCount <= HASS_MAX_SENSORS, "Raise HASS_MAX_SENSORS for the discovery cache");
+
+// Tasks are constructed in setup() once the config is loaded, but into
+// static storage rather than on the heap, so the heap is left unfragmented
+#define STATIC_TASK(type, name) \
+  alignas(type) uint8_t name##Storage[sizeof(type)]; \
+  type* name = NULL
+
+STATIC_TASK(MQTTTask, mqttTask);
+STATIC_TASK(HomeAssistantTask, homeAssistantTask);
+STATIC_TASK(InfluxTask, influxTask);              // Optional direct telemetry sink
+STATIC_TASK(UDPTelemetryTask, udpTelemetryTask);  // Optional datagram telemetry
+STATIC_TASK(WebServerTask, webServerTask);        // Live data endpoint
+STATIC_TASK(EduroamTask, wifiTask);
 
-MQTTTask* mqttTask;
-HomeAssistantTask* homeAssistantTask;
-EduroamTask* wifiTask;
-
-RendererTask* renderer;
-I2CHubTask* i2cHubTask;
-EncoderTask* encoderTask1;        // Stirrer
-EncoderTask* encoderTask2;        // Pump - Not used
-HBridgeTask* HBridgeOutputTask1;  // Stirrer
-HBridgeTask* HBridgeOutputTask2;  // Pump
-PortBHubTask* portBHubTask;
-AngleSensorTask* angleSensor1;         // Stirrer
-AngleSensorTask* angleSensor2;         // Pump
-ConductSensorTask* conductSensorTask;  // Conductivity Sensor
-FlowSensorTask* flowSensor1Task;       // Inflow
-ThermocoupleTask* waterTempTask;
-SerialRecieverTask* serialRecieverTask;
+STATIC_TASK(RendererTask, renderer);
+STATIC_TASK(I2CHubTask, i2cHubTask);
+STATIC_TASK(EncoderTask, encoderTask1);        // Stirrer
+STATIC_TASK(HBridgeTask, HBridgeOutputTask1);  // Stirrer
+STATIC_TASK(HBridgeTask, HBridgeOutputTask2);  // Pump
+STATIC_TASK(PortBHubTask, portBHubTask);
+STATIC_TASK(AngleSensorTask, angleSensor1);         // Stirrer
+STATIC_TASK(AngleSensorTask, angleSensor2);         // Pump
+STATIC_TASK(ConductSensorTask, conductSensorTask);  // Conductivity Sensor
+STATIC_TASK(FlowSensorTask, flowSensor1Task);       // Inflow
+STATIC_TASK(ThermocoupleTask, waterTempTask);
+STATIC_TASK(SerialRecieverTask, serialRecieverTask);
+STATIC_TASK(SerialTelemetryTask, serialTelemetryTask);
+STATIC_TASK(DiagnosticsTask, diagnosticsTask);
+
+SampleBudget sampleBudget;  // Shared by the adaptive sensors, see adaptive_rate.h
 
 bool hasRunOnce = false;
 int initialDecision = 0;
@@ -81,13 +116,16 @@ class EventBridge : TSEvents::EventHandler {
         break;
       }
       case ANGLE_SENSOR_2_DATA: {
-        uint16_t _pumppwm = *(uint16_t*)e.data;
-        _pumppwm = _pumppwm * 255 / 4096;
-        HBridgeOutputTask2->setPWM(_pumppwm);
+        uint16_t angle = *(uint16_t*)e.data;
+        if (HBridgeOutputTask2->isFlowControl()) {
+          HBridgeOutputTask2->setFlow(angle * HBridgeOutputTask2->getMaxFlow() / 4096);
+        } else {
+          HBridgeOutputTask2->setPWM(angle * 255 / 4096);
+        }
         break;
       }
       case THERMOCOUPLE_DATA: {
-        float _temp = *(float*)e.data;
+        float _temp = ((SensorReading*)e.data)->value;
         conductSensorTask->setTemp(_temp);
         break;
       }
@@ -97,6 +135,683 @@ class EventBridge : TSEvents::EventHandler {
 
 EventBridge eventBridge(ts, e);
 
+//----------------------------------------------------
+// Live parameters
+//----------------------------------------------------
+
+// Config fields that take effect without a restart. setParam() checks the
+// value against the range in configFields, so an interval can't be set low
+// enough to starve the control loop, then applies it and saves it to NVS.
+
+typedef struct {
+  const char* key;
+  void (*apply)();
+} LiveParam;
+
+void applyStirrerFeedforward() {
+  FeedforwardMap feedforward;
+  buildStirrerFeedforward(config, &feedforward);
+  HBridgeOutputTask1->setFeedforward(feedforward);
+}
+
+void applyStirrerGains() {
+  HBridgeOutputTask1->setGains({config.rpmKp, config.rpmKi, config.rpmKd, config.rpmRamp, config.rpmTracking});
+  HBridgeOutputTask1->setMaxRPM(config.maxRpm);
+  applyStirrerFeedforward();
+}
+
+void applyPumpControl() {
+  FeedforwardMap feedforward;
+  feedforward.parse(config.flowFeedforward);  // Empty for none
+  HBridgeOutputTask2->setGains({config.flowKp, config.flowKi, config.flowKd, 0, 0});
+  HBridgeOutputTask2->setFeedforward(feedforward);
+  HBridgeOutputTask2->setMaxFlow(config.maxFlow);
+  HBridgeOutputTask2->setFlowControl(config.pumpFlowControl == 1);
+}
+
+void applyOutputs() {
+  HBridgeOutputTask1->setSlewRate(config.stirrerSlew);
+  HBridgeOutputTask1->setReverse(config.stirrerReverse == 1);
+  HBridgeOutputTask2->setSlewRate(config.pumpSlew);
+}
+
+// Fastest is the interval / sampleBoost but no less than the interval's own
+// minimum, slowest the interval * sampleBackoff. Both are the interval with
+// adaptive sampling off.
+void sampleRange(int interval, const char* intervalKey, uint32_t* fastMs, uint32_t* slowMs) {
+  if (config.adaptiveSampling != 1) {
+    *fastMs = interval;
+    *slowMs = interval;
+    return;
+  }
+  *fastMs = fmaxf(interval / config.sampleBoost, findConfigField(intervalKey)->minimum);
+  *slowMs = fminf(interval * config.sampleBackoff, 60000);
+}
+
+// With adaptive sampling off the sensors still report their reads to the
+// budget, so the stats show the whole bus load
+void applySampling() {
+  bool adaptive = config.adaptiveSampling == 1;
+  uint32_t fastMs, slowMs;
+  sampleBudget.setBudget(config.sampleBudget / 100);
+  encoderTask1->setBusBudget(&sampleBudget);
+  HBridgeOutputTask1->setBusBudget(&sampleBudget);
+  HBridgeOutputTask2->setBusBudget(&sampleBudget);
+  flowSensor1Task->setBusBudget(&sampleBudget);
+  sampleRange(config.angleInterval, "angleInterval", &fastMs, &slowMs);
+  angleSensor1->setAdaptive(adaptive, &sampleBudget, fastMs, slowMs, config.angleActivity);
+  angleSensor2->setAdaptive(adaptive, &sampleBudget, fastMs, slowMs, config.angleActivity);
+  sampleRange(config.conductInterval, "conductInterval", &fastMs, &slowMs);
+  conductSensorTask->setAdaptive(adaptive, &sampleBudget, fastMs, slowMs, config.conductActivity);
+  sampleRange(config.thermocoupleInterval, "thermocoupleInterval", &fastMs, &slowMs);
+  waterTempTask->setAdaptive(adaptive, &sampleBudget, fastMs, slowMs, config.thermocoupleActivity);
+  if (!adaptive) {  // Back to the fixed intervals
+    angleSensor1->setInterval(config.angleInterval * TASK_MILLISECOND);
+    angleSensor2->setInterval(config.angleInterval * TASK_MILLISECOND);
+    conductSensorTask->setInterval(config.conductInterval * TASK_MILLISECOND);
+    waterTempTask->setInterval(config.thermocoupleInterval * TASK_MILLISECOND);
+  }
+}
+
+void applyIntervals() {
+  encoderTask1->setInterval(config.encoderInterval * TASK_MILLISECOND);
+  HBridgeOutputTask1->setInterval(config.stirrerInterval * TASK_MILLISECOND);
+  HBridgeOutputTask2->setInterval(config.pumpInterval * TASK_MILLISECOND);
+  flowSensor1Task->setInterval(config.flowInterval * TASK_MILLISECOND);
+  homeAssistantTask->setInterval(config.hassInterval * TASK_MILLISECOND);
+  serialTelemetryTask->setOutputInterval(config.serialInterval);
+  renderer->setInterval(TASK_SECOND / config.renderFps);
+  if (influxTask) {
+    influxTask->setInterval(config.influxFlushInterval * TASK_MILLISECOND);
+  }
+  if (udpTelemetryTask) {
+    udpTelemetryTask->setInterval(config.udpFlushInterval * TASK_MILLISECOND);
+  }
+  applySampling();  // The angle, conductivity and thermocouple intervals
+}
+
+void applyStirrerModel() {
+  HBridgeOutputTask1->setModel({config.motorGain, config.motorOffset, config.motorTau}, config.observerNoise);
+  HBridgeOutputTask1->setFeedback(config.rpmFeedback == 1);
+  applyStirrerFeedforward();
+}
+
+void applyEncoderEstimator() {
+  encoderTask1->setEstimator(config.encoderMinCounts, config.encoderMaxWindow);
+}
+
+void applyFilters() {
+  // Already checked by setConfigField
+  encoderTask1->setFilter(config.encoderFilter);
+  angleSensor1->setFilter(config.angleFilter);
+  angleSensor2->setFilter(config.angleFilter);
+  flowSensor1Task->setFilter(config.flowFilter);
+  conductSensorTask->setFilter(config.conductFilter);
+}
+
+const LiveParam liveParams[] = {
+    {"rpmKp", applyStirrerGains},
+    {"rpmKi", applyStirrerGains},
+    {"rpmKd", applyStirrerGains},
+    {"rpmRamp", applyStirrerGains},
+    {"rpmTracking", applyStirrerGains},
+    {"rpmFeedforward", applyStirrerGains},
+    {"maxRpm", applyStirrerGains},
+    {"pumpFlowControl", applyPumpControl},
+    {"maxFlow", applyPumpControl},
+    {"flowKp", applyPumpControl},
+    {"flowKi", applyPumpControl},
+    {"flowKd", applyPumpControl},
+    {"flowFeedforward", applyPumpControl},
+    {"stirrerSlew", applyOutputs},
+    {"pumpSlew", applyOutputs},
+    {"stirrerReverse", applyOutputs},
+    {"encoderInterval", applyIntervals},
+    {"stirrerInterval", applyIntervals},
+    {"pumpInterval", applyIntervals},
+    {"angleInterval", applyIntervals},
+    {"conductInterval", applyIntervals},
+    {"thermocoupleInterval", applyIntervals},
+    {"flowInterval", applyIntervals},
+    {"hassInterval", applyIntervals},
+    {"serialInterval", applyIntervals},
+    {"renderFps", applyIntervals},
+    {"influxFlushInterval", applyIntervals},
+    {"udpFlushInterval", applyIntervals},
+    {"adaptiveSampling", applySampling},
+    {"sampleBudget", applySampling},
+    {"sampleBoost", applySampling},
+    {"sampleBackoff", applySampling},
+    {"angleActivity", applySampling},
+    {"conductActivity", applySampling},
+    {"thermocoupleActivity", applySampling},
+    {"rpmFeedback", applyStirrerModel},
+    {"motorGain", applyStirrerModel},
+    {"motorOffset", applyStirrerModel},
+    {"motorTau", applyStirrerModel},
+    {"observerNoise", applyStirrerModel},
+    {"encoderMinCounts", applyEncoderEstimator},
+    {"encoderMaxWindow", applyEncoderEstimator},
+    {"encoderFilter", applyFilters},
+    {"angleFilter", applyFilters},
+    {"flowFilter", applyFilters},
+    {"conductFilter", applyFilters},
+};
+
+bool isLiveParam(const char* key) {
+  for (const LiveParam& param : liveParams) {
+    if (strcmp(param.key, key) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Puts a new value of key into effect, false if that needs a restart
+bool applyLiveParam(const char* key) {
+  bool live = false;
+  for (const LiveParam& param : liveParams) {
+    if (strcmp(param.key, key) == 0) {
+      param.apply();
+      live = true;
+    }
+  }
+  return live;
+}
+
+// Returns an error message or NULL. live is set when the change has already
+// taken effect rather than waiting for a restart.
+const char* setParam(const char* key, const char* text, bool* live) {
+  const ConfigField* field = findConfigField(key);
+  if (field == NULL) {
+    snprintf(configError, sizeof(configError), "no config %s", key);
+    return configError;
+  }
+  const char* error = setConfigFieldText(*field, text);
+  if (error == NULL) {
+    error = saveConfig();
+  }
+  if (error != NULL) {
+    return error;
+  }
+  *live = applyLiveParam(key);
+  return NULL;
+}
+
+// mostr/<deviceId>/param/<key>/set with the new value as the payload sets
+// one of liveParams, and mostr/<deviceId>/param/get with a key as the
+// payload reads any config back. Either publishes the value now in effect,
+// or an error, to mostr/<deviceId>/param/<key>. The broker isn't
+// authenticated, so nothing else can be set this way and secrets read back
+// as ***.
+char paramTopic[64];
+char paramGetTopic[64];
+
+#define NUMBER_PARAMS_MAX 4
+
+typedef struct {
+  const char* key;
+  float value;
+} NumberParam;
+
+// setParam() for a set of values worked out on the device, all int or float
+// fields. They're all checked before the config is saved, and if any is
+// rejected the others are put back, so the config never holds half a set.
+const char* setNumberParams(const NumberParam* params, int count) {
+  if (count > NUMBER_PARAMS_MAX) {
+    return "too many params";
+  }
+  uint8_t previous[NUMBER_PARAMS_MAX][sizeof(float)];  // Each field as it was
+  const char* error = NULL;
+  int set = 0;
+  for (; set < count && error == NULL; set++) {
+    const ConfigField* field = findConfigField(params[set].key);
+    if (field == NULL || field->type == CONFIG_STRING) {
+      snprintf(configError, sizeof(configError), "no number config %s", params[set].key);
+      error = configError;
+      break;
+    }
+    memcpy(previous[set], (uint8_t*)&config + field->offset, sizeof(float));
+    char text[16];
+    snprintf(text, sizeof(text), "%.4g", params[set].value);
+    error = setConfigFieldText(*field, text);
+  }
+  if (error == NULL) {
+    error = saveConfig();
+  }
+  if (error != NULL) {
+    while (set-- > 0) {
+      memcpy((uint8_t*)&config + findConfigField(params[set].key)->offset, previous[set], sizeof(float));
+    }
+    return error;
+  }
+  for (int i = 0; i < count; i++) {
+    applyLiveParam(params[i].key);
+  }
+  return NULL;
+}
+
+// Reports the gains an autotune found, see autotune.h, through
+// SerialTelemetryTask like a command reply, so it can't land in the middle
+// of a telemetry line or a binary frame. They aren't applied until
+// autotune#apply: on autotune_bench the tuned pump settles slower than the
+// defaults and a heavy stirrer overshoots, so they want looking at first.
+void onAutotuned(HBridgeTask* task) {
+  Print& out = *serialTelemetryTask;
+  const char* name = task == HBridgeOutputTask1 ? "stirrer" : "pump";
+  const RelayAutotuner& tuner = task->getAutotuner();
+  if (tuner.getState() != AUTOTUNE_DONE) {
+    printFormat(out, "autotune#%s#failed#%s\n", name, tuner.getError());
+    return;
+  }
+  PidGains gains = {};
+  tuner.getGains(&gains);
+  printFormat(out, "autotune#%s#done#kp %.4g#ki %.4g#not applied\n", name, gains.kp, gains.ki);
+}
+
+// Applies and saves the gains from the last finished autotune on a loop
+const char* applyAutotune(HBridgeTask* task) {
+  const RelayAutotuner& tuner = task->getAutotuner();
+  if (tuner.getState() != AUTOTUNE_DONE) {
+    return "no finished autotune";
+  }
+  PidGains gains = {};
+  tuner.getGains(&gains);
+  bool stirrer = task == HBridgeOutputTask1;
+  const NumberParam params[] = {{stirrer ? "rpmKp" : "flowKp", gains.kp}, {stirrer ? "rpmKi" : "flowKi", gains.ki}};
+  return setNumberParams(params, 2);
+}
+
+void publishParam(const char* key, const char* error, bool live) {
+  char reply[CONFIG_TEXT_SIZE + 32];
+  char replyTopic[96];
+  const ConfigField* field = findConfigField(key);
+  if (error != NULL) {
+    snprintf(reply, sizeof(reply), "ERR %s", error);
+  } else if (field == NULL) {
+    snprintf(reply, sizeof(reply), "ERR no config %s", key);
+  } else {
+    formatConfigField(*field, reply, CONFIG_TEXT_SIZE);
+    if (!live) {
+      strlcat(reply, " (applies after restart)", sizeof(reply));
+    }
+  }
+  snprintf(replyTopic, sizeof(replyTopic), "mostr/%s/param/%s", config.deviceId, key);
+  mqttTask->sendMessage(replyTopic, reply);
+}
+
+void onParamMessage(const char* topic, const char* payload) {
+  char key[32];
+  const char* start = topic + strlen(paramTopic) - strlen("+/set");
+  const char* end = strchr(start, '/');
+  if (end == NULL || end - start >= (int)sizeof(key)) {
+    return;
+  }
+  strlcpy(key, start, end - start + 1);
+
+  if (!isLiveParam(key)) {
+    snprintf(configError, sizeof(configError), "%s can't be set over MQTT", key);
+    publishParam(key, configError, true);
+    return;
+  }
+  bool live;
+  const char* error = setParam(key, payload, &live);
+  publishParam(key, error, live);
+}
+
+void onParamGet(const char* topic, const char* payload) {
+  if (strlen(payload) < 32) {
+    publishParam(payload, NULL, true);
+  }
+}
+
+//----------------------------------------------------
+// Serial commands, see SerialRecieverTask
+//----------------------------------------------------
+
+Task* findTask(const char* name) {
+  if (strcmp(name, "encoder1") == 0) return encoderTask1;
+  if (strcmp(name, "hbridge1") == 0) return HBridgeOutputTask1;
+  if (strcmp(name, "hbridge2") == 0) return HBridgeOutputTask2;
+  if (strcmp(name, "angle1") == 0) return angleSensor1;
+  if (strcmp(name, "angle2") == 0) return angleSensor2;
+  if (strcmp(name, "conduct") == 0) return conductSensorTask;
+  if (strcmp(name, "thermocouple") == 0) return waterTempTask;
+  if (strcmp(name, "flow1") == 0) return flowSensor1Task;
+  if (strcmp(name, "homeassistant") == 0) return homeAssistantTask;
+  if (strcmp(name, "renderer") == 0) return renderer;
+  return NULL;
+}
+
+// The config behind a task's interval, so the interval command is range
+// checked and saved the same way as set
+const char* findIntervalKey(const char* name) {
+  if (strcmp(name, "encoder1") == 0) return "encoderInterval";
+  if (strcmp(name, "hbridge1") == 0) return "stirrerInterval";
+  if (strcmp(name, "hbridge2") == 0) return "pumpInterval";
+  if (strcmp(name, "angle1") == 0) return "angleInterval";
+  if (strcmp(name, "angle2") == 0) return "angleInterval";
+  if (strcmp(name, "conduct") == 0) return "conductInterval";
+  if (strcmp(name, "thermocouple") == 0) return "thermocoupleInterval";
+  if (strcmp(name, "flow1") == 0) return "flowInterval";
+  if (strcmp(name, "homeassistant") == 0) return "hassInterval";
+  return NULL;  // The renderer's is set in frames per second, as renderFps
+}
+
+// Splits off the next '#' separated argument, leaving args on the one after
+char* nextArg(char*& args) {
+  char* arg = args;
+  char* separator = strchr(args, '#');
+  if (separator != NULL) {
+    *separator = '\0';
+    args = separator + 1;
+  } else {
+    args += strlen(args);
+  }
+  return arg;
+}
+
+bool parseLong(const char* text, long minimum, long maximum, long* value) {
+  char* end;
+  long parsed = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || parsed < minimum || parsed > maximum) {
+    return false;
+  }
+  *value = parsed;
+  return true;
+}
+
+void pumpCommand(char* args, Print& out) {
+  long pwm;
+  if (*args != '\0') {
+    if (HBridgeOutputTask2->isFlowControl()) {
+      out.println("ERR pump is on flow control, use flow#<L/min>");
+      return;
+    }
+    if (!parseLong(args, 0, 255, &pwm)) {
+      out.println("ERR pump#<0-255>");
+      return;
+    }
+    HBridgeOutputTask2->setPWM(pwm);
+  }
+  printFormat(out, "pump#%u\n", HBridgeOutputTask2->getPWM());
+}
+
+void flowCommand(char* args, Print& out) {
+  if (*args != '\0') {
+    char* end;
+    float flow = strtof(args, &end);
+    if (!HBridgeOutputTask2->isFlowControl()) {
+      out.println("ERR pump is open loop, set pumpFlowControl#1 first");
+      return;
+    }
+    if (end == args || *end != '\0' || flow < 0 || flow > HBridgeOutputTask2->getMaxFlow()) {
+      printFormat(out, "ERR flow#<0-%.2f>\n", HBridgeOutputTask2->getMaxFlow());
+      return;
+    }
+    HBridgeOutputTask2->setFlow(flow);
+  }
+  printFormat(out, "flow#%.2f\n", HBridgeOutputTask2->getFlowSetpoint());
+}
+
+void setpointCommand(char* args, Print& out) {
+  long rpm;
+  if (*args != '\0') {
+    if (!parseLong(args, 0, HBridgeOutputTask1->getMaxRPM(), &rpm)) {
+      printFormat(out, "ERR setpoint#<0-%d>\n", HBridgeOutputTask1->getMaxRPM());
+      return;
+    }
+    HBridgeOutputTask1->setRPM(rpm);
+  }
+  printFormat(out, "setpoint#%d\n", HBridgeOutputTask1->getRPMSetpoint());
+}
+
+// stirrer#manual#<pwm> holds the stirrer at a PWM, stirrer#auto hands it
+// back to the speed loop without a jump
+void stirrerCommand(char* args, Print& out) {
+  const char* mode = nextArg(args);
+  long pwm;
+  if (strcmp(mode, "manual") == 0 && parseLong(args, 0, 255, &pwm)) {
+    HBridgeOutputTask1->setManual(pwm);
+  } else if (strcmp(mode, "auto") == 0 && *args == '\0') {
+    HBridgeOutputTask1->setAuto();
+  } else if (*mode != '\0') {
+    out.println("ERR stirrer#manual#<0-255>|auto");
+    return;
+  }
+  printFormat(out, "stirrer#%s#%d\n", HBridgeOutputTask1->isManual() ? "manual" : "auto", HBridgeOutputTask1->getDriverSpeed());
+}
+
+void intervalCommand(char* args, Print& out) {
+  const char* name = nextArg(args);
+  Task* task = findTask(name);
+  if (task == NULL) {
+    printFormat(out, "ERR no task %s\n", name);
+    return;
+  }
+  if (*args != '\0') {
+    const char* key = findIntervalKey(name);
+    if (key == NULL) {
+      printFormat(out, "ERR use set#renderFps#<fps> for %s\n", name);
+      return;
+    }
+    bool live;
+    const char* error = setParam(key, args, &live);
+    if (error != NULL) {
+      printFormat(out, "ERR %s\n", error);
+      return;
+    }
+  }
+  printFormat(out, "interval#%s#%lu\n", name, task->getInterval() / TASK_MILLISECOND);
+}
+
+void printSampling(const char* name, const AdaptiveRate& rate, Print& out) {
+  printFormat(out, "%s: every %u ms (%u-%u), %s, %.3g off trend, slope %.3g/s, spread %.3g, %.0f us a read\n", name, rate.getIntervalMs(),
+             rate.getFastMs(), rate.getSlowMs(), rate.isActive(micros()) ? "active" : "quiet", rate.getDeviation(), rate.getSlope(),
+             rate.getSpread(), rate.getCostUs());
+}
+
+void statsCommand(char* args, Print& out) {
+  printFormat(out, "uptime: %lu s\n", millis() / 1000);
+  diagnosticsTask->printStats(out);
+  encoderTask1->printStats(out);
+  HBridgeOutputTask1->printStats(out);
+  HBridgeOutputTask2->printStats(out);
+  serialTelemetryTask->printStats(out);
+  printFormat(out, "bus: %.1f%% used, %.1f%% by the control loops, budget %.1f%%\n", sampleBudget.getLoad() * 100,
+              sampleBudget.getLoad(true) * 100, sampleBudget.getBudget() * 100);
+  if (config.adaptiveSampling == 1) {
+    printSampling("angle1", angleSensor1->getRate(), out);
+    printSampling("angle2", angleSensor2->getRate(), out);
+    printSampling("conduct", conductSensorTask->getRate(), out);
+    printSampling("thermocouple", waterTempTask->getRate(), out);
+  }
+  if (influxTask) {
+    printFormat(out, "influx: %u lines written, %u dropped, %u failed posts\n",
+               influxTask->getLinesWritten(), influxTask->getLinesDropped(), influxTask->getFailedPosts());
+  }
+  if (udpTelemetryTask) {
+    printFormat(out, "udp: %u frames sent, %u errors\n", udpTelemetryTask->getFramesSent(), udpTelemetryTask->getSendErrors());
+  }
+}
+
+void calibrateCommand(char* args, Print& out) {
+  char command[8];
+  size_t i = 0;
+  for (; args[i] != '\0' && i < sizeof(command) - 1; i++) {
+    command[i] = toupper(args[i]);
+  }
+  command[i] = '\0';
+  if (args[i] != '\0' || (strcmp(command, "ENTEREC") != 0 && strcmp(command, "CALEC") != 0 && strcmp(command, "EXITEC") != 0)) {
+    out.println("ERR cal#enterec|calec|exitec");
+    return;
+  }
+  conductSensorTask->calibrate(command);
+  printFormat(out, "cal#%s#%.1f mV\n", command, conductSensorTask->getVoltage());
+}
+
+void getCommand(char* args, Print& out) {
+  const ConfigField* field = findConfigField(args);
+  if (field == NULL) {
+    printFormat(out, "ERR no config %s\n", args);
+    return;
+  }
+  printFormat(out, "get#%s#", args);
+  printConfigField(*field, out);
+  out.println();
+}
+
+void setCommand(char* args, Print& out) {
+  const char* key = nextArg(args);
+  bool live;
+  const char* error = setParam(key, args, &live);
+  if (error != NULL) {
+    printFormat(out, "ERR %s\n", error);
+    return;
+  }
+  printFormat(out, "set#%s#", key);
+  printConfigField(*findConfigField(key), out);
+  out.println(live ? "" : " (applies after restart)");
+}
+
+// stream#binary#1500000 for tools/serial-capture, stream#text#115200 to go back
+void streamCommand(char* args, Print& out) {
+  const char* mode = nextArg(args);
+  long baud = 0;
+  if ((strcmp(mode, "text") != 0 && strcmp(mode, "binary") != 0) || (*args != '\0' && !parseLong(args, 9600, 2000000, &baud))) {
+    out.println("ERR stream#text|binary#<baud>");
+    return;
+  }
+  printFormat(out, "stream#%s#%ld\n", mode, baud);
+  serialTelemetryTask->setStreamMode(strcmp(mode, "binary") == 0 ? SERIAL_STREAM_BINARY : SERIAL_STREAM_TEXT, baud);
+}
+
+void printAutotune(const char* name, HBridgeTask* task, Print& out) {
+  const RelayAutotuner& tuner = task->getAutotuner();
+  switch (tuner.getState()) {
+    case AUTOTUNE_IDLE:
+      printFormat(out, "autotune#%s#idle\n", name);
+      break;
+    case AUTOTUNE_RUNNING:
+      printFormat(out, "autotune#%s#running#%d cycles#%lu s\n", name, tuner.getCycles(), tuner.getElapsedUs(micros()) / 1000000);
+      break;
+    case AUTOTUNE_DONE: {
+      PidGains gains = {};
+      tuner.getGains(&gains);
+      printFormat(out, "autotune#%s#done#Ku %.4g#Tu %.3f s#kp %.4g#ki %.4g\n", name, tuner.getUltimateGain(), tuner.getUltimatePeriod(),
+                  gains.kp, gains.ki);
+      break;
+    }
+    case AUTOTUNE_FAILED:
+      printFormat(out, "autotune#%s#failed#%s\n", name, tuner.getError());
+      break;
+  }
+}
+
+// autotune#stirrer|pump[#<step>] runs a relay autotune on that loop about
+// its current setpoint, stepping the PWM either side, and reports the gains
+// it finds. autotune#apply#stirrer|pump applies and saves them.
+// autotune#cancel stops it, autotune shows progress.
+void autotuneCommand(char* args, Print& out) {
+  const char* name = nextArg(args);
+  long step = AUTOTUNE_STEP;
+  HBridgeTask* task = strcmp(name, "stirrer") == 0 ? HBridgeOutputTask1 : strcmp(name, "pump") == 0 ? HBridgeOutputTask2 : NULL;
+  if (strcmp(name, "apply") == 0) {
+    const char* loop = nextArg(args);
+    task = strcmp(loop, "stirrer") == 0 ? HBridgeOutputTask1 : strcmp(loop, "pump") == 0 ? HBridgeOutputTask2 : NULL;
+    if (task == NULL) {
+      out.println("ERR autotune#apply#stirrer|pump");
+      return;
+    }
+    const char* error = applyAutotune(task);
+    if (error != NULL) {
+      printFormat(out, "ERR %s\n", error);
+      return;
+    }
+    printFormat(out, "autotune#%s#applied\n", loop);
+    return;
+  }
+  if (task != NULL) {
+    if (*args != '\0' && !parseLong(args, 5, 127, &step)) {
+      out.println("ERR autotune#stirrer|pump#<5-127>");
+      return;
+    }
+    const char* error = task->startAutotune(step);
+    if (error != NULL) {
+      printFormat(out, "ERR %s\n", error);
+      return;
+    }
+  } else if (strcmp(name, "cancel") == 0) {
+    HBridgeOutputTask1->cancelAutotune();
+    HBridgeOutputTask2->cancelAutotune();
+  } else if (*name != '\0') {
+    out.println("ERR autotune#stirrer|pump|apply|cancel");
+    return;
+  }
+  printAutotune("stirrer", HBridgeOutputTask1, out);
+  printAutotune("pump", HBridgeOutputTask2, out);
+}
+
+// model prints the stirrer model fitted so far, model#apply puts it in the
+// config for the observer to use
+void modelCommand(char* args, Print& out) {
+  MotorModel fitted;
+  if (!HBridgeOutputTask1->getFittedModel(&fitted)) {
+    out.println("ERR no model fitted yet, move the setpoint around");
+    return;
+  }
+  if (strcmp(args, "apply") == 0) {
+    const NumberParam params[] = {{"motorGain", fitted.gain}, {"motorOffset", fitted.offset}, {"motorTau", fitted.tauMs}};
+    const char* error = setNumberParams(params, 3);
+    if (error != NULL) {
+      printFormat(out, "ERR %s\n", error);
+      return;
+    }
+  } else if (*args != '\0') {
+    out.println("ERR model[#apply]");
+    return;
+  }
+  printFormat(out, "model#%.3f#%.1f#%.0f\n", fitted.gain, fitted.offset, fitted.tauMs);
+}
+
+// Cycles per call for the sensor math in its old double and current float
+// form, same kernels as tools/bench/float_bench.cpp
+void benchCommand(char* args, Print& out) {
+  const uint32_t iterations = 10000;
+  static volatile float sink;
+  for (int b = 0; b < mathBenchCount; b++) {
+    const MathBench& bench = mathBenches[b];
+    uint32_t cycles[2];
+    for (int variant = 0; variant < 2; variant++) {
+      MathBenchKernel kernel = variant == 0 ? bench.reference : bench.current;
+      float total = 0;
+      uint32_t start = ESP.getCycleCount();
+      for (uint32_t i = 0; i < iterations; i++) {
+        total += kernel(i);
+      }
+      cycles[variant] = (ESP.getCycleCount() - start) / iterations;
+      sink = total;
+    }
+    printFormat(out, "bench#%s#double %u#float %u cycles\n", bench.name, cycles[0], cycles[1]);
+  }
+}
+
+void addSerialCommands(SerialRecieverTask* reciever) {
+  reciever->addCommand("pump", "<0-255>", pumpCommand);
+  reciever->addCommand("flow", "<L/min>", flowCommand);
+  reciever->addCommand("setpoint", "<rpm>", setpointCommand);
+  reciever->addCommand("stirrer", "manual#<pwm>|auto", stirrerCommand);
+  reciever->addCommand("interval", "<task>#<ms>", intervalCommand);
+  reciever->addCommand("stats", "", statsCommand);
+  reciever->addCommand("cal", "enterec|calec|exitec", calibrateCommand);
+  reciever->addCommand("stream", "text|binary#<baud>", streamCommand);
+  reciever->addCommand("get", "<key>", getCommand);
+  reciever->addCommand("set", "<key>#<value>", setCommand);
+  reciever->addCommand("model", "[apply]", modelCommand);
+  reciever->addCommand("autotune", "stirrer|pump#<step>|apply#stirrer|pump|cancel", autotuneCommand);
+  reciever->addCommand("bench", "", benchCommand);
+}
+
 void renderConfigError(const char* e) {
   M5.Lcd.print(e);
 }
@@ -106,21 +821,34 @@ void setup() {
   M5.Lcd.setRotation(1);
   EEPROM.begin(255);
   ec.begin();
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER_SIZE);  // Lets SerialTelemetryTask hand over more than the 128 byte FIFO
   Serial.begin(115200);
-  const char* configError = loadConfigFile();
+  const char* configError = loadConfig();
   if (configError != NULL) {
     Serial.println(configError);
     return;
   }
-  renderer = new RendererTask(ts, e, getConfigValue("deviceId"), VERSION);
+  Serial.updateBaudRate(config.serialBaud);
+  renderer = new (rendererStorage) RendererTask(ts, e, config.deviceId, VERSION, config.renderFps);
 
   //----------------------------------------------------
   // Setup In relation to network connections:
   //----------------------------------------------------
 
-  wifiTask = new EduroamTask(ts, e, getConfigValue("wifiUser"), getConfigValue("wifiPass"));
-  mqttTask = new MQTTTask(ts, e, getConfigValue("mqttServer"), getConfigIntValue("mqttPort"), getConfigValue("deviceId"));
-  homeAssistantTask = new HomeAssistantTask(ts, e, mqttTask, getConfigValue("deviceId"), sensors, 4, 2 * TASK_SECOND);  // this needs to optimised for not causing a data bottle neck
+  wifiTask = new (wifiTaskStorage) EduroamTask(ts, e, config.wifiUser, config.wifiPass, config.ntpServer);
+  mqttTask = new (mqttTaskStorage) MQTTTask(ts, e, config.mqttServer, config.mqttPort, config.deviceId);
+  snprintf(paramTopic, sizeof(paramTopic), "mostr/%s/param/+/set", config.deviceId);
+  mqttTask->subscribe(paramTopic, onParamMessage);
+  snprintf(paramGetTopic, sizeof(paramGetTopic), "mostr/%s/param/get", config.deviceId);
+  mqttTask->subscribe(paramGetTopic, onParamGet);
+  homeAssistantTask = new (homeAssistantTaskStorage) HomeAssistantTask(ts, e, mqttTask, config.deviceId, sensors, sensorCount, config.hassInterval * TASK_MILLISECOND);  // this needs to optimised for not causing a data bottle neck
+  if (config.influxUrl[0] != '\0') {
+    influxTask = new (influxTaskStorage) InfluxTask(ts, e, config.influxUrl, config.influxOrg, config.influxBucket, config.influxToken, config.deviceId, sensors, sensorCount,
+                                config.influxBatchSize, config.influxGzip, config.influxFlushInterval * TASK_MILLISECOND);
+  }
+  if (config.udpHost[0] != '\0') {
+    udpTelemetryTask = new (udpTelemetryTaskStorage) UDPTelemetryTask(ts, e, config.udpHost, config.udpPort, config.deviceId, config.udpFlushInterval * TASK_MILLISECOND);
+  }
 
   //----------------------------------------------------
   // Setup In relation to physical connections:
@@ -128,36 +856,67 @@ void setup() {
 
   // I2C Output to PaHub I2C Multiplexer
   Wire.begin(32, 33);  // declaration from the M5stack I2C pins...I think
-  serialRecieverTask = new SerialRecieverTask(ts, e, SERIAL_DATA, getConfigValue("deviceId"), 500 * TASK_MILLISECOND);
-  i2cHubTask = new I2CHubTask(ts, e, 0x70, Wire);
+  serialTelemetryTask = new (serialTelemetryTaskStorage) SerialTelemetryTask(ts, e, config.serialInterval);
+  serialRecieverTask = new (serialRecieverTaskStorage) SerialRecieverTask(ts, e, SERIAL_DATA, config.deviceId, 50 * TASK_MILLISECOND, *serialTelemetryTask);
+  if (configWarning[0] != '\0') {
+    printFormat(*serialTelemetryTask, "%s\n", configWarning);
+  }
+  addSerialCommands(serialRecieverTask);
+  i2cHubTask = new (i2cHubTaskStorage) I2CHubTask(ts, e, 0x70, Wire);
   // PaHub Connection 0 - 3 way Splitter 1 (stirrer)
   // Splitter 1 - Connection 2 - Ext-Encoder (Stirrer)
-  encoderTask1 = new EncoderTask(ts, e, i2cHubTask, 0, ENCODER_1_DATA, Wire, 25 * TASK_MILLISECOND);  // for encoder
+  encoderTask1 = new (encoderTask1Storage) EncoderTask(ts, e, i2cHubTask, 0, ENCODER_1_DATA, ENCODER_1_LATENCY_DATA, ENCODER_1_NOISE_DATA, Wire, config.encoderInterval * TASK_MILLISECOND);  // for encoder
+  applyEncoderEstimator();
   // Splitter 1 - Connection 1 - Hbridge (Stirrer)
-  HBridgeOutputTask1 = new HBridgeTask(ts, e, i2cHubTask, encoderTask1, 0, Wire, 0x20, 25 * TASK_MILLISECOND);
+  HBridgeOutputTask1 = new (HBridgeOutputTask1Storage) HBridgeTask(ts, e, i2cHubTask, encoderTask1, 0, Wire, 0x20, config.stirrerInterval * TASK_MILLISECOND);
+  applyStirrerGains();
+  applyStirrerModel();
   // Splitter 1 - Connection 3 - EMPTY
 
   // PaHub Connection 1 - Hbridge (Pump)
-  HBridgeOutputTask2 = new HBridgeTask(ts, e, i2cHubTask, encoderTask2, 1, Wire, 0x20, 100 * TASK_MILLISECOND);
+  HBridgeOutputTask2 = new (HBridgeOutputTask2Storage) HBridgeTask(ts, e, i2cHubTask, NULL, 1, Wire, 0x20, config.pumpInterval * TASK_MILLISECOND);
+  applyPumpControl();
+  applyOutputs();
+  HBridgeOutputTask1->setAutotuneHandler(onAutotuned);
+  HBridgeOutputTask2->setAutotuneHandler(onAutotuned);
 
   // PaHub Connection 2 - PbHub IN
-  portBHubTask = new PortBHubTask(ts, e, i2cHubTask, 2, 0x61, Wire);
+  portBHubTask = new (portBHubTaskStorage) PortBHubTask(ts, e, i2cHubTask, 2, 0x61, Wire);
   // PbHub Connection 0 - Angle Sensor 1
-  angleSensor1 = new AngleSensorTask(ts, e, portBHubTask, PORTB_CH0, ANGLE_SENSOR_1_DATA, 100 * TASK_MILLISECOND);
+  angleSensor1 = new (angleSensor1Storage) AngleSensorTask(ts, e, portBHubTask, PORTB_CH0, ANGLE_SENSOR_1_DATA, config.angleInterval * TASK_MILLISECOND);
   // PbHub Connection 1 - Angle Sensor 2
-  angleSensor2 = new AngleSensorTask(ts, e, portBHubTask, PORTB_CH1, ANGLE_SENSOR_2_DATA, 100 * TASK_MILLISECOND);
+  angleSensor2 = new (angleSensor2Storage) AngleSensorTask(ts, e, portBHubTask, PORTB_CH1, ANGLE_SENSOR_2_DATA, config.angleInterval * TASK_MILLISECOND);
   // PbHub Connection 2
-  conductSensorTask = new ConductSensorTask(ts, e, portBHubTask, PORTB_CH2, CONDUCT_SENSOR_DATA, 100 * TASK_MILLISECOND);
+  conductSensorTask = new (conductSensorTaskStorage) ConductSensorTask(ts, e, portBHubTask, PORTB_CH2, CONDUCT_SENSOR_DATA, config.conductInterval * TASK_MILLISECOND);
   // PbHub Connection 3-5 EMPTY
 
   // PaHub Connection 3 - Thermocouple
-  waterTempTask = new ThermocoupleTask(ts, e, i2cHubTask, 3, 0x66, Wire, 1000 * TASK_MILLISECOND);  // for thermocouple
+  waterTempTask = new (waterTempTaskStorage) ThermocoupleTask(ts, e, i2cHubTask, 3, 0x66, Wire, config.thermocoupleInterval * TASK_MILLISECOND);  // for thermocouple
 
   // PaHub Connection 4 - Ext-Encoder (Flowmeter 1) - INFLOW
-  flowSensor1Task = new FlowSensorTask(ts, e, i2cHubTask, 5, FLOW_SENSOR_1_DATA, getConfigFloatValue("flowK", 1.0), getConfigFloatValue("flowCorrectK", 1.0), Wire, 500 * TASK_MILLISECOND);
+  flowSensor1Task = new (flowSensor1TaskStorage) FlowSensorTask(ts, e, i2cHubTask, 5, FLOW_SENSOR_1_DATA, config.flowK, config.flowCorrectK, Wire, config.flowInterval * TASK_MILLISECOND);
+  applyFilters();
+  applySampling();
 
   // PaHub Connection 5 - Not used
 
+  if (config.httpPort != 0) {
+    webServerTask = new (webServerTaskStorage) WebServerTask(ts, e, config.deviceId, config.httpToken, config.httpPort, config.wsMaxClients);
+    webServerTask->addTask("encoder1", encoderTask1);
+    webServerTask->addTask("hbridge1", HBridgeOutputTask1);
+    webServerTask->addTask("hbridge2", HBridgeOutputTask2);
+    webServerTask->addTask("angle1", angleSensor1);
+    webServerTask->addTask("angle2", angleSensor2);
+    webServerTask->addTask("conduct", conductSensorTask);
+    webServerTask->addTask("thermocouple", waterTempTask);
+    webServerTask->addTask("flow1", flowSensor1Task);
+    webServerTask->addTask("homeassistant", homeAssistantTask);
+  }
+
+  diagnosticsTask = new (diagnosticsTaskStorage) DiagnosticsTask(ts, e);
+  renderer->setDiagnostics(diagnosticsTask);
+  renderer->setAutotune(HBridgeOutputTask1);
+
   //----------------------------------------------------
   // Task enabling setup
   //----------------------------------------------------
@@ -165,8 +924,19 @@ void setup() {
   renderer->enable();
   wifiTask->enable();
   serialRecieverTask->enable();
+  serialTelemetryTask->enable();
+  diagnosticsTask->enable();
   mqttTask->enable();
   homeAssistantTask->enable();
+  if (influxTask) {
+    influxTask->enable();
+  }
+  if (udpTelemetryTask) {
+    udpTelemetryTask->enable();
+  }
+  if (webServerTask) {
+    webServerTask->enable();
+  }
   i2cHubTask->enable();
   encoderTask1->enable();        // Stirrer
   HBridgeOutputTask1->enable();  // Stirrer
@@ -321,10 +1091,10 @@ void setup() {
       float temperatureRead;
       if (isISOThermocoupleSetup) {
         temperatureRead = (byte1 << 8) | byte0;
-        temperatureRead /= 100.0;
+        temperatureRead /= 100.0f;
       } else {
         temperatureRead = (byte0 << 8) | byte1;
-        temperatureRead /= 16.0;
+        temperatureRead /= 16.0f;
       }
       M5.Lcd.fillRect(238, 40, 50, 18, COL_BG);
       M5.Lcd.setCursor(240, 54);
@@ -337,7 +1107,7 @@ void setup() {
       if (millis() - timepoint > 1000U) {  // time interval: 1s
         float ecRaw = portBHubTask->analogRead(PORTB_CH2);
         timepoint = millis();
-        ecVoltage = (ecRaw / 4096.0 * 3300);  // read the voltage
+        ecVoltage = (ecRaw / 4096.0f * 3300);  // read the voltage
         float ecValue = ec.readEC(ecVoltage, temperatureRead);  // convert voltage to EC with temperature compensation
         M5.Lcd.fillRect(238, 58, 50, 18, COL_BG);
         M5.Lcd.setCursor(240, 74);
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// PID controller for the HBridge loops. Compared with a bare Kp*e + Ki*sum(e)
+// it:
+//
+// - integrates over the real time between updates, so gains don't change
+//   with the task interval (ki is per second, kd in seconds)
+// - adds a feedforward term from a FeedforwardMap, so the integral only has
+//   to make up the difference from the map rather than the whole output
+// - limits how fast the setpoint it works to can move (rampRate, units per
+//   second), with the feedforward carrying the output along the ramp. The
+//   integral holds until the ramp arrives: the measurement lags the ramp,
+//   and integrating that lag is what overshoots at the end of it.
+// - takes the derivative of the measurement rather than the error, low-pass
+//   filtered, so setpoint changes don't kick the output
+// - bleeds the integral back by the amount the output was clipped
+//   (back-calculation), so it can't wind up against the output limits
+// - tracks the output in manual mode, and on the first update back in
+//   automatic takes any jump in the P and feedforward terms into the
+//   integral, so the output picks up from where manual left it
+//
+// pid_bench and flow_bench step it on the plants in tools/common/plant.h,
+// and test/test_pid checks the bumpless transfer.
+
+#define FEEDFORWARD_MAX_POINTS 8
+#define FEEDFORWARD_SPEC_SIZE 96
+
+// Output needed to hold a setpoint, linear between points and flat beyond
+// the first and last. Set from a spec like "0:45 100:95 200:150 350:230"
+// (setpoint:output pairs in increasing setpoint order).
+class FeedforwardMap {
+ public:
+  void clear() { count = 0; }
+
+  bool add(float x, float y) {
+    if (count == FEEDFORWARD_MAX_POINTS || (count > 0 && x <= xs[count - 1])) {
+      return false;
+    }
+    xs[count] = x;
+    ys[count] = y;
+    count++;
+    return true;
+  }
+
+  // Returns an error message and leaves the map empty if spec is bad
+  const char* parse(const char* spec) {
+    clear();
+    const char* p = spec;
+    while (*p != '\0') {
+      char* end;
+      float x = strtof(p, &end);
+      if (end == p || *end != ':') {
+        clear();
+        return "use setpoint:output pairs";
+      }
+      p = end + 1;
+      float y = strtof(p, &end);
+      if (end == p || (*end != ' ' && *end != '\0')) {
+        clear();
+        return "use setpoint:output pairs";
+      }
+      if (!add(x, y)) {
+        clear();
+        return "at most 8 points, in increasing order";
+      }
+      for (p = end; *p == ' '; p++) {
+      }
+    }
+    return NULL;
+  }
+
+  float lookup(float x) const {
+    if (count == 0) {
+      return 0;
+    }
+    if (x <= xs[0]) {
+      return ys[0];
+    }
+    for (int i = 1; i < count; i++) {
+      if (x <= xs[i]) {
+        return ys[i - 1] + (ys[i] - ys[i - 1]) * (x - xs[i - 1]) / (xs[i] - xs[i - 1]);
+      }
+    }
+    return ys[count - 1];
+  }
+
+  int getCount() const { return count; }
+
+ private:
+  float xs[FEEDFORWARD_MAX_POINTS];
+  float ys[FEEDFORWARD_MAX_POINTS];
+  int count = 0;
+};
+
+typedef struct {
+  float kp;
+  float ki;            // Per second
+  float kd;            // Seconds
+  float rampRate;      // Setpoint units per second, 0 for no limit
+  float trackingTime;  // Back-calculation time constant in seconds, 0 for kp / ki
+} PidGains;
+
+class PidController {
+ public:
+  PidController(float _outMin = 0, float _outMax = 255) {
+    setGains({0.6f, 1, 0, 300, 0});
+    setOutputLimits(_outMin, _outMax);
+  }
+
+  void setGains(const PidGains& _gains) { gains = _gains; }
+
+  void setOutputLimits(float _outMin, float _outMax) {
+    outMin = _outMin;
+    outMax = _outMax;
+  }
+
+  // NULL for no feedforward
+  void setFeedforward(const FeedforwardMap* _feedforward) { feedforward = _feedforward; }
+
+  // Starts again from a standstill, e.g. when the stirrer is switched off:
+  // no integral, and the ramp starts from where the measurement is
+  void reset(float measurement) {
+    integral = 0;
+    ramped = measurement;
+    lastMeasurement = measurement;
+    derivative = 0;
+    primed = false;
+  }
+
+  // Same, but carrying on from an output that is already applied, e.g. when
+  // taking over from open loop, so the output doesn't jump
+  void reset(float measurement, float heldOutput) {
+    reset(measurement);
+    output = constrainOutput(heldOutput);
+    integral = output - (feedforward ? feedforward->lookup(measurement) : 0);
+  }
+
+  // Holds the output at value until setAuto(). The integral keeps tracking
+  // it so the switch back is bumpless.
+  void setManual(float value) {
+    manual = true;
+    output = constrainOutput(value);
+  }
+
+  void setAuto() {
+    if (manual) {
+      transfer = true;
+    }
+    manual = false;
+  }
+
+  bool isManual() const { return manual; }
+
+  float update(float setpoint, float measurement, uint32_t dtUs) {
+    float dt = dtUs * 1e-6f;
+    if (!primed) {
+      lastMeasurement = measurement;
+      primed = true;
+    }
+    if (dt <= 0) {
+      return output;
+    }
+
+    bool ramping = false;
+    if (manual) {
+      // So the ramp starts from the current speed when back in automatic
+      ramped = measurement;
+    } else if (gains.rampRate > 0 && fabsf(setpoint - ramped) > gains.rampRate * dt) {
+      ramped += copysignf(gains.rampRate * dt, setpoint - ramped);
+      ramping = true;
+    } else {
+      ramped = setpoint;
+    }
+
+    // Derivative of the measurement, low-passed at a tenth of kd
+    float slope = (measurement - lastMeasurement) / dt;
+    lastMeasurement = measurement;
+    float filterTime = gains.kp > 0 ? gains.kd / gains.kp / 10 : 0;
+    derivative += (slope - derivative) * dt / (filterTime + dt);
+
+    error = ramped - measurement;
+    p = gains.kp * error;
+    d = -gains.kd * derivative;
+    ff = feedforward ? feedforward->lookup(ramped) : 0;
+
+    if (manual || transfer) {
+      integral = output - p - d - ff;
+      transfer = false;
+    }
+    if (manual) {
+      return output;
+    }
+
+    float unlimited = ff + p + integral + d;
+    output = constrainOutput(unlimited);
+    float trackingTime = gains.trackingTime > 0 ? gains.trackingTime : (gains.ki > 0 ? gains.kp / gains.ki : 1);
+    if (trackingTime <= 0) {
+      trackingTime = 1;
+    }
+    if (!ramping) {
+      integral += gains.ki * error * dt;
+    }
+    integral += (output - unlimited) * dt / trackingTime;
+    return output;
+  }
+
+  float getOutput() const { return output; }
+  // Where the ramp has got to
+  float getSetpoint() const { return ramped; }
+  float getError() const { return error; }
+  // Terms of the latest output
+  float getP() const { return p; }
+  float getI() const { return integral; }
+  float getD() const { return d; }
+  float getFeedforward() const { return ff; }
+
+ private:
+  float constrainOutput(float value) const { return fminf(fmaxf(value, outMin), outMax); }
+
+  PidGains gains;
+  float outMin;
+  float outMax;
+  const FeedforwardMap* feedforward = NULL;
+
+  bool manual = false;
+  bool transfer = false;  // First update back in automatic
+  bool primed = false;
+  float ramped = 0;
+  float lastMeasurement = 0;
+  float derivative = 0;
+  float integral = 0;
+  float output = 0;
+  float error = 0;
+  float p = 0;
+  float d = 0;
+  float ff = 0;
+};
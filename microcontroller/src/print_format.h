@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+// Print::printf mallocs a buffer for anything over 64 characters, so serial
+// command replies and stats are formatted on the stack here instead. Output
+// past PRINT_FORMAT_SIZE is cut short.
+
+#define PRINT_FORMAT_SIZE 192
+
+inline size_t printFormat(Print& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+inline size_t printFormat(Print& out, const char* format, ...) {
+  char buffer[PRINT_FORMAT_SIZE];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (n < 0) {
+    return 0;
+  }
+  return out.write((const uint8_t*)buffer, n < PRINT_FORMAT_SIZE ? n : PRINT_FORMAT_SIZE - 1);
+}
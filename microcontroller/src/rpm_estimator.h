@@ -0,0 +1,111 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sensor_math.h"
+
+// Stirrer speed from a polled encoder count. The Ext-Encoder unit only gives
+// us a count over I2C, not edge times, so at low speed a single poll sees
+// one or two counts and the RPM from that poll jumps between a few
+// quantised values.
+//
+// This estimator keeps a window open from the last estimate until it has
+// seen at least minCounts counts, or maxWindowUs has passed. At speed that
+// is every poll (count-based, the old behaviour), and as the motor slows it
+// stretches over several polls, which is the average period between counts
+// (period-based). While a window is still open the previous estimate is
+// capped at what the counts seen so far allow, so a stopping motor decays
+// towards 0 rather than holding its last speed. Times are micros() and
+// counts the raw 32-bit counter, both subtracted wrap-safe.
+//
+// minCounts = 0 gives a fresh count-based estimate every poll.
+
+enum RpmEstimatorMode : uint8_t {
+  RPM_ESTIMATOR_COUNT,   // Enough counts in a single poll
+  RPM_ESTIMATOR_PERIOD,  // Window spanned more than one poll
+};
+
+class RpmEstimator {
+ public:
+  RpmEstimator(int _minCounts = 8, uint32_t _maxWindowUs = 250000) { configure(_minCounts, _maxWindowUs); }
+
+  void configure(int _minCounts, uint32_t _maxWindowUs) {
+    minCounts = _minCounts;
+    maxWindowUs = _maxWindowUs;
+  }
+
+  void reset(uint32_t count, uint32_t nowUs) {
+    anchorCount = count;
+    anchorUs = nowUs;
+    lastPollUs = nowUs;
+    rpm = 0;
+    windowUs = 0;
+    meanSquareStep = 0;
+    estimates = 0;
+    started = true;
+  }
+
+  // Returns true when the estimate changed
+  bool update(uint32_t count, uint32_t nowUs) {
+    if (!started) {
+      reset(count, nowUs);
+      return false;
+    }
+    int32_t counts = counterDelta(count, anchorCount);
+    uint32_t dt = nowUs - anchorUs;
+    bool singlePoll = anchorUs == lastPollUs;
+    lastPollUs = nowUs;
+
+    if (abs(counts) >= minCounts || dt >= maxWindowUs) {
+      float previous = rpm;
+      rpm = encoderRpmMicros(counts, dt);
+      mode = singlePoll ? RPM_ESTIMATOR_COUNT : RPM_ESTIMATOR_PERIOD;
+      windowUs = dt;
+      anchorCount = count;
+      anchorUs = nowUs;
+      estimates++;
+      // Successive estimates at a steady speed differ by noise only
+      if (estimates > 1) {
+        float step = rpm - previous;
+        meanSquareStep += 0.05f * (step * step - meanSquareStep);
+      }
+      return true;
+    }
+
+    // Fewer than |counts| + 1 counts arrived in dt, so the speed can't be
+    // above that
+    float bound = encoderRpmMicros(abs(counts) + 1, dt);
+    if (fabsf(rpm) > bound) {
+      rpm = rpm < 0 ? -bound : bound;
+      return true;
+    }
+    return false;
+  }
+
+  float getRPM() const { return rpm; }
+  RpmEstimatorMode getMode() const { return mode; }
+  // Span of the latest estimate. It is the average over that span, so it
+  // lags the real speed by about half of it.
+  uint32_t getWindowUs() const { return windowUs; }
+  // Smallest RPM step the latest window can resolve, one count over it
+  float getResolution() const { return encoderRpmMicros(1, windowUs); }
+  // RMS change between successive estimates, smoothed over about 20
+  float getNoise() const { return sqrtf(meanSquareStep); }
+  uint32_t getEstimates() const { return estimates; }
+
+ private:
+  int minCounts;
+  uint32_t maxWindowUs;
+
+  bool started = false;
+  uint32_t anchorCount = 0;
+  uint32_t anchorUs = 0;
+  uint32_t lastPollUs = 0;
+  float rpm = 0;
+  RpmEstimatorMode mode = RPM_ESTIMATOR_COUNT;
+  uint32_t windowUs = 0;
+  float meanSquareStep = 0;
+  uint32_t estimates = 0;
+};
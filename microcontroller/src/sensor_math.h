@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+// Conversions on the sensor and control paths, kept in single precision:
+// the ESP32's FPU has no double support, so every double operation is a
+// soft-float library call. Counters are unsigned and subtracted before
+// anything else, so a 32-bit counter or millis() wrapping between two
+// samples still gives the right delta. sensor_math_bench.h wraps them for
+// timing against the old double forms.
+
+#define ENCODER_COUNTS_PER_REV 420
+
+// Signed change between two readings of a free-running 32-bit counter
+inline int32_t counterDelta(uint32_t now, uint32_t last) {
+  return (int32_t)(now - last);
+}
+
+// Stirrer speed from encoder counts over dtMs
+inline float encoderRpm(int32_t counts, uint32_t dtMs) {
+  if (dtMs == 0) {
+    return 0;
+  }
+  return counts * (60000.0f / ENCODER_COUNTS_PER_REV) / dtMs;
+}
+
+// Same from a micros() interval
+inline float encoderRpmMicros(int32_t counts, uint32_t dtUs) {
+  if (dtUs == 0) {
+    return 0;
+  }
+  return counts * (60000000.0f / ENCODER_COUNTS_PER_REV) / dtUs;
+}
+
+// Flow in L/min from flowmeter pulses over dtMs, Q = f * 60 / k, divided by
+// the per-tank correction. scale is flowScale(k, correction), worked out
+// once rather than per sample.
+inline float flowScale(float kValue, float flowCorrectK) {
+  return 60000.0f / (kValue * flowCorrectK);
+}
+
+inline float flowRate(int32_t pulses, uint32_t dtMs, float scale) {
+  if (dtMs == 0) {
+    return 0;
+  }
+  return pulses * scale / dtMs;
+}
+
+// Rounds to the nearest int without going through double round()
+inline int roundToInt(float value) {
+  return (int)(value + (value < 0 ? -0.5f : 0.5f));
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "sensor_math.h"
+
+// One sample of the encoder, flow and stirrer PI computations, each in the
+// double precision form they had before sensor_math.h and in the current
+// float form. Timed by the bench serial command in cycles on the device and
+// by tools/bench/float_bench.cpp on the host, so both measure the same code.
+// Inputs are derived from the iteration number so nothing folds away.
+
+typedef float (*MathBenchKernel)(uint32_t i);
+
+typedef struct {
+  const char* name;
+  MathBenchKernel reference;  // double
+  MathBenchKernel current;    // float
+} MathBench;
+
+inline float encoderDoubleKernel(uint32_t i) {
+  static double lastT = 0;
+  static double lastCount = 0;
+  static double readings[5] = {};
+  double t = i * 25.0 + 25;
+  double count = i * 37.0;
+  double rpm = ((count - lastCount) / 420.00) / double(t - lastT) * 60000.00;
+  for (int j = 4; j > 0; j--) {
+    readings[j] = readings[j - 1];
+  }
+  readings[0] = rpm;
+  double total = 0;
+  for (int j = 0; j < 5; j++) {
+    total += readings[j];
+  }
+  lastT = t;
+  lastCount = count;
+  return (float)(total / 5);
+}
+
+inline float encoderFloatKernel(uint32_t i) {
+  static uint32_t lastT = 0;
+  static uint32_t lastCount = 0;
+  static float readings[5] = {};
+  uint32_t t = i * 25 + 25;
+  uint32_t count = i * 37;
+  float rpm = encoderRpm(counterDelta(count, lastCount), t - lastT);
+  for (int j = 4; j > 0; j--) {
+    readings[j] = readings[j - 1];
+  }
+  readings[0] = rpm;
+  float total = 0;
+  for (int j = 0; j < 5; j++) {
+    total += readings[j];
+  }
+  lastT = t;
+  lastCount = count;
+  return total / 5;
+}
+
+inline float flowDoubleKernel(uint32_t i) {
+  static float kValue = 1420;
+  static float flowCorrectK = 1.1f;
+  double dt = double(500 + (i & 7)) / 1000;
+  double freq = double(100 + (i & 15)) / dt;
+  return (float)((freq * (60 / kValue)) / flowCorrectK);
+}
+
+inline float flowFloatKernel(uint32_t i) {
+  static float scale = flowScale(1420, 1.1f);
+  return flowRate(100 + (i & 15), 500 + (i & 7), scale);
+}
+
+inline float piDoubleKernel(uint32_t i) {
+  static float cumError = 0;
+  float error = float(int(i & 63) - 32);
+  cumError += error;
+  cumError = cumError < -5000 ? -5000 : (cumError > 5000 ? 5000 : cumError);
+  return 127 + (int)round(0.6f * error + 0.05f * cumError);
+}
+
+inline float piFloatKernel(uint32_t i) {
+  static float cumError = 0;
+  float error = float(int(i & 63) - 32);
+  cumError += error;
+  cumError = cumError < -5000 ? -5000 : (cumError > 5000 ? 5000 : cumError);
+  return 127 + roundToInt(0.6f * error + 0.05f * cumError);
+}
+
+const MathBench mathBenches[] = {
+    {"encoder", encoderDoubleKernel, encoderFloatKernel},
+    {"flow", flowDoubleKernel, flowFloatKernel},
+    {"pi", piDoubleKernel, piFloatKernel},
+};
+const int mathBenchCount = sizeof(mathBenches) / sizeof(MathBench);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Framing for sending telemetry.h frames over the USB serial link. A frame
+// has a CRC-16/CCITT appended and is then COBS encoded, so 0x00 never
+// appears inside it and can end every frame. A receiver that joins mid-stream
+// or loses bytes resynchronises at the next 0x00. Shared with tools/ like
+// telemetry.h, so no Arduino dependencies here either.
+
+#define SERIAL_FRAME_MAX_RECORDS 48
+#define SERIAL_FRAME_MAX_DATA 512
+// COBS adds one byte per 254, plus the code byte, CRC and delimiter
+#define SERIAL_FRAME_MAX_ENCODED (SERIAL_FRAME_MAX_DATA + SERIAL_FRAME_MAX_DATA / 254 + 4)
+
+inline uint16_t serialFrameCrc(const uint8_t* data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Writes the encoded frame including its trailing 0x00 to dst, which must
+// hold SERIAL_FRAME_MAX_ENCODED bytes. Returns 0 if data is too long.
+inline size_t serialFrameEncode(const uint8_t* data, size_t length, uint8_t* dst) {
+  if (length + 2 > SERIAL_FRAME_MAX_DATA) {
+    return 0;
+  }
+  uint16_t crc = serialFrameCrc(data, length);
+  size_t code = 0;  // Where the current run's length goes
+  size_t out = 1;
+  uint8_t run = 1;
+  for (size_t i = 0; i < length + 2; i++) {
+    uint8_t byte = i < length ? data[i] : (i == length ? crc & 0xFF : crc >> 8);
+    if (byte != 0) {
+      dst[out++] = byte;
+      run++;
+    }
+    if (byte == 0 || run == 0xFF) {
+      dst[code] = run;
+      code = out++;
+      run = 1;
+    }
+  }
+  dst[code] = run;
+  dst[out++] = 0;
+  return out;
+}
+
+// Collects bytes up to each 0x00 and decodes them. push() returns true when
+// a frame with a good CRC is ready in data()/size().
+class SerialFrameDecoder {
+ public:
+  bool push(uint8_t byte) {
+    if (byte != 0) {
+      if (length < sizeof(encoded)) {
+        encoded[length] = byte;
+      }
+      length++;
+      return false;
+    }
+    size_t n = length;
+    length = 0;
+    if (n == 0) {
+      return false;
+    }
+    if (n > sizeof(encoded) || !decode(n)) {
+      errors++;
+      return false;
+    }
+    return true;
+  }
+
+  const uint8_t* data() { return decoded; }
+  size_t size() { return decodedLength; }
+
+  // Frames that were too long, badly encoded or failed the CRC
+  uint32_t getErrors() const { return errors; }
+
+ private:
+  bool decode(size_t n) {
+    size_t out = 0;
+    size_t i = 0;
+    while (i < n) {
+      uint8_t run = encoded[i++];
+      if (i + run - 1 > n) {
+        return false;
+      }
+      for (uint8_t j = 1; j < run; j++) {
+        decoded[out++] = encoded[i++];
+      }
+      if (run != 0xFF && i < n) {
+        decoded[out++] = 0;
+      }
+    }
+    if (out < 2) {
+      return false;
+    }
+    uint16_t crc = decoded[out - 2] | decoded[out - 1] << 8;
+    decodedLength = out - 2;
+    return serialFrameCrc(decoded, decodedLength) == crc;
+  }
+
+  uint8_t encoded[SERIAL_FRAME_MAX_ENCODED];
+  uint8_t decoded[SERIAL_FRAME_MAX_ENCODED];
+  size_t length = 0;
+  size_t decodedLength = 0;
+  uint32_t errors = 0;
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+// Stirrer speed from a model of the motor, corrected by the encoder. The
+// encoder's estimate is an average over its window and comes every 25 ms at
+// best. The PWM sent to the HBridge is known every tick, so a model of how
+// speed follows PWM can carry the estimate forward in between.
+//
+// The model is first order: the motor settles towards gain * (pwm - offset)
+// rpm with time constant tau, and sits at 0 below offset. SpeedObserver is a
+// scalar Kalman filter on it, and MotorModelIdentifier fits gain, offset and
+// tau from the PWM and encoder history so they can be read back off a
+// running tank and put in its config. observer_bench checks both against
+// the simulated motor in tools/common/plant.h.
+
+typedef struct {
+  float gain;    // rpm per PWM step
+  float offset;  // PWM below which the motor doesn't turn
+  float tauMs;   // Time constant
+} MotorModel;
+
+inline float motorSteadyRpm(const MotorModel& model, float pwm) {
+  return pwm > model.offset ? model.gain * (pwm - model.offset) : 0;
+}
+
+class SpeedObserver {
+ public:
+  SpeedObserver() { configure({1.8f, 40, 300}, 20000); }
+
+  // processNoise is how far the real speed wanders from the model, in
+  // rpm^2 per second
+  void configure(const MotorModel& _model, float _processNoise) {
+    model = _model;
+    processNoise = _processNoise;
+  }
+
+  void reset(float _rpm) {
+    rpm = _rpm;
+    variance = 1e4f;
+    meanSquareInnovation = 0;
+  }
+
+  // Carries the estimate forward by dtUs with pwm applied throughout
+  void predict(float pwm, uint32_t dtUs) {
+    float a = expf(-(dtUs / 1000.0f) / model.tauMs);
+    rpm = a * rpm + (1 - a) * motorSteadyRpm(model, pwm);
+    variance = a * a * variance + processNoise * dtUs * 1e-6f;
+  }
+
+  // measurementVariance in rpm^2
+  void correct(float measured, float measurementVariance) {
+    float innovation = measured - rpm;
+    gain = variance / (variance + measurementVariance);
+    rpm += gain * innovation;
+    variance *= 1 - gain;
+    meanSquareInnovation += 0.05f * (innovation * innovation - meanSquareInnovation);
+  }
+
+  float getRPM() const { return rpm; }
+  float getVariance() const { return variance; }
+  // Weight given to the latest encoder estimate, 0 trusts the model only
+  float getGain() const { return gain; }
+  // RMS difference between the encoder and the prediction, large when the
+  // model is wrong for this tank
+  float getInnovation() const { return sqrtf(meanSquareInnovation); }
+
+ private:
+  MotorModel model;
+  float processNoise;
+  float rpm = 0;
+  float variance = 1e4f;
+  float gain = 0;
+  float meanSquareInnovation = 0;
+};
+
+// Recursive least squares fit of
+//
+//   d(rpm)/dt = (gain * (pwm - offset) - rpm) / tau
+//             = theta0 * pwm + theta1 + theta2 * rpm
+//
+// from successive encoder estimates, forgetting old data over a few hundred
+// estimates. Only samples with the motor turning are used, as the model
+// doesn't hold at a standstill, and the fit only means something once the
+// setpoint has moved around a bit.
+//
+// At a steady speed every sample is the same, so forgetting would grow P
+// without limit until it overflows. Samples where neither PWM nor speed has
+// moved are skipped, and the trace of P is held to its starting value.
+#define IDENTIFIER_MIN_PWM_STEP 1.0f
+#define IDENTIFIER_MIN_RPM_STEP 2.0f
+#define IDENTIFIER_MAX_TRACE 3e4f
+
+class MotorModelIdentifier {
+ public:
+  MotorModelIdentifier(float _forgetting = 0.995f) {
+    forgetting = _forgetting;
+    reset();
+  }
+
+  void reset() {
+    for (int i = 0; i < 3; i++) {
+      theta[i] = 0;
+      for (int j = 0; j < 3; j++) {
+        P[i][j] = i == j ? 1e4f : 0;
+      }
+    }
+    samples = 0;
+    lastPwm = NAN;
+  }
+
+  // rpm0 and rpm1 are successive encoder estimates dtUs apart, pwm the mean
+  // PWM between them
+  void update(float rpm0, float rpm1, float pwm, uint32_t dtUs) {
+    if (dtUs == 0 || rpm0 <= 0 || rpm1 <= 0 || !isfinite(pwm)) {
+      return;
+    }
+    bool excited = !(fabsf(pwm - lastPwm) < IDENTIFIER_MIN_PWM_STEP) || fabsf(rpm1 - rpm0) >= IDENTIFIER_MIN_RPM_STEP;
+    lastPwm = pwm;
+    if (!excited) {
+      return;
+    }
+    float x[3] = {pwm, 1, (rpm0 + rpm1) / 2};
+    float y = (rpm1 - rpm0) / (dtUs * 1e-6f);
+
+    float Px[3];
+    float xPx = 0;
+    for (int i = 0; i < 3; i++) {
+      Px[i] = P[i][0] * x[0] + P[i][1] * x[1] + P[i][2] * x[2];
+      xPx += x[i] * Px[i];
+    }
+    float denominator = forgetting + xPx;
+    float error = y - (theta[0] * x[0] + theta[1] * x[1] + theta[2] * x[2]);
+    for (int i = 0; i < 3; i++) {
+      theta[i] += Px[i] / denominator * error;
+    }
+    float trace = 0;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        P[i][j] = (P[i][j] - Px[i] * Px[j] / denominator) / forgetting;
+      }
+      trace += P[i][i];
+    }
+    if (!isfinite(trace) || !isfinite(theta[0]) || !isfinite(theta[1]) || !isfinite(theta[2])) {
+      reset();
+      return;
+    }
+    if (trace > IDENTIFIER_MAX_TRACE) {
+      float scale = IDENTIFIER_MAX_TRACE / trace;
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          P[i][j] *= scale;
+        }
+      }
+    }
+    samples++;
+  }
+
+  // False until the fit describes a stable motor that speeds up with PWM
+  bool getModel(MotorModel* model) const {
+    // Written so that NaN fails every test
+    if (samples < 50 || !(theta[0] > 0) || !(theta[2] < 0)) {
+      return false;
+    }
+    float tau = -1 / theta[2];
+    MotorModel fitted = {theta[0] * tau, -theta[1] / theta[0], tau * 1000};
+    if (!isfinite(fitted.gain) || !isfinite(fitted.offset) || !isfinite(fitted.tauMs)) {
+      return false;
+    }
+    *model = fitted;
+    return true;
+  }
+
+  uint32_t getSamples() const { return samples; }
+
+ private:
+  float forgetting;
+  float theta[3];
+  float P[3][3];
+  uint32_t samples;
+  float lastPwm;
+};
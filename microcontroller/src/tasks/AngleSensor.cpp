@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <M5Tough.h>
 #define _TASK_OO_CALLBACKS
@@ -8,7 +10,10 @@
 #include <tasks/I2CHub.cpp>
 #include <tasks/PortBHub.cpp>
 
+#include "adaptive_rate.h"
 #include "events.h"
+#include "filters.h"
+#include "sensor_math.h"
 
 // https://github.com/m5stack/M5Stack/blob/master/examples/Unit/ANGLE/ANGLE.ino
 
@@ -31,10 +36,16 @@ class AngleSensorTask : public Task, public TSEvents::EventEmitter {
   }
 
   bool Callback() {
-    uint16_t value = portBHub->analogRead(port);
-    if (abs(value - lastSensorValue) > 10) {  // debounce
-      lastSensorValue = value;
-      value = 4096 - value;  // Invert the value
+    uint32_t start = micros();
+    int raw = portBHub->analogRead(port);
+    uint32_t intervalMs = rate.update(raw, start, micros() - start);
+    if (adaptive) {
+      setInterval(intervalMs * TASK_MILLISECOND);
+    }
+    int filtered = roundToInt(filter.update(raw));
+    if (filtered != lastSensorValue) {  // Only send changes, the filter's deadband debounces
+      lastSensorValue = filtered;
+      uint16_t value = 4096 - filtered;  // Invert the value
       if (value < 280) {     // Compensate for dead zone on potentiometer
         value = 0;
       }
@@ -43,9 +54,27 @@ class AngleSensorTask : public Task, public TSEvents::EventEmitter {
     return true;
   }
 
+  // See filters.h, returns an error message or NULL
+  const char* setFilter(const char* spec) {
+    return filter.configure(spec);
+  }
+
+  // Samples between fastMs and slowMs depending on how much the knob
+  // moves, see adaptive_rate.h. threshold in raw counts.
+  void setAdaptive(bool _adaptive, SampleBudget* budget, uint32_t fastMs, uint32_t slowMs, float threshold) {
+    adaptive = _adaptive;
+    rate.configure(fastMs, slowMs, threshold);
+    rate.setBudget(budget);
+  }
+
+  const AdaptiveRate& getRate() const { return rate; }
+
  private:
   PortBHubTask* portBHub;
   PortBChannel port;
-  uint16_t lastSensorValue = 0;
+  int lastSensorValue = -1;
   EventType event;
+  SensorFilter filter;
+  bool adaptive = false;
+  AdaptiveRate rate;
 };
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <M5Tough.h>
 #define _TASK_OO_CALLBACKS
@@ -8,7 +10,10 @@
 #include <tasks/I2CHub.cpp>
 #include <tasks/PortBHub.cpp>
 
+#include "adaptive_rate.h"
 #include "events.h"
+#include "filters.h"
+#include "timesync.h"
 
 #include <EEPROM.h>
 
@@ -36,14 +41,21 @@ class ConductSensorTask : public Task, public TSEvents::EventEmitter {
   }
 
   bool Callback() {
+    uint32_t start = micros();
     float ecRaw = portBHub->analogRead(port);
+    int64_t timestamp = timestampMicros();
     Wire.beginTransmission(0x70);
     Wire.write(1 << 3);
     Wire.endTransmission();
     lastSensorValue = ecRaw;
-    ecVoltage = (ecRaw / 4096.0 * 3300);  // read the voltage - old K=1 sensor
+    ecVoltage = (ecRaw / 4096.0f * 3300);  // read the voltage - old K=1 sensor
     float ecValue = ec.readEC(ecVoltage, temperature);  // convert voltage to EC with temperature compensation
-    dispatch(CONDUCT_SENSOR_DATA, &ecValue, sizeof(float));
+    uint32_t intervalMs = rate.update(ecValue, start, micros() - start);
+    if (adaptive) {
+      setInterval(intervalMs * TASK_MILLISECOND);
+    }
+    SensorReading reading = {filter.update(ecValue), timestamp};
+    dispatch(CONDUCT_SENSOR_DATA, &reading, sizeof(SensorReading));
     //}
     return true;
   }
@@ -52,6 +64,34 @@ class ConductSensorTask : public Task, public TSEvents::EventEmitter {
     temperature = _temp;
   }
 
+  // ENTEREC, CALEC or EXITEC, same as the buttons on the calibration screen
+  void calibrate(const char* command) {
+    char cmd[20];
+    strncpy(cmd, command, sizeof(cmd) - 1);
+    cmd[sizeof(cmd) - 1] = '\0';
+    ec.calibration(ecVoltage, temperature, cmd);
+  }
+
+  float getVoltage() {
+    return ecVoltage;
+  }
+
+  // See filters.h, returns an error message or NULL. Only the published
+  // value is filtered, calibration sees the raw voltage.
+  const char* setFilter(const char* spec) {
+    return filter.configure(spec);
+  }
+
+  // Samples between fastMs and slowMs depending on how much the
+  // conductivity moves, see adaptive_rate.h. threshold in ms/cm.
+  void setAdaptive(bool _adaptive, SampleBudget* budget, uint32_t fastMs, uint32_t slowMs, float threshold) {
+    adaptive = _adaptive;
+    rate.configure(fastMs, slowMs, threshold);
+    rate.setBudget(budget);
+  }
+
+  const AdaptiveRate& getRate() const { return rate; }
+
  private:
   PortBHubTask* portBHub;
   PortBChannel port;
@@ -59,4 +99,7 @@ class ConductSensorTask : public Task, public TSEvents::EventEmitter {
   EventType event;
   float ecVoltage, ecValue, temperature = 0.0;
   DFRobot_EC10 ec;
+  SensorFilter filter;
+  bool adaptive = false;
+  AdaptiveRate rate;
 };
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <Arduino.h>
+#define _TASK_OO_CALLBACKS
+#define _TASK_STATUS_REQUEST
+#include <EventHandler.h>
+#include <TaskSchedulerDeclarations.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "events.h"
+#include "print_format.h"
+#include "timesync.h"
+
+// Reports the state of the internal heap and PSRAM as sensor readings, so a
+// week-long run shows whether free memory or the largest free block creep
+// down. Everything should be allocated by the end of setup(), after which
+// these are expected to stay flat.
+//
+// Also samples every FreeRTOS task (loopTask, which runs the scheduler, the
+// WiFi and LwIP tasks, async_tcp, ...) for its stack high-water mark and
+// share of CPU time since the previous sample, and the load on each core
+// from its idle task. The per-task table is kept for the stats serial
+// command and the renderer's diagnostics page. CPU figures need FreeRTOS
+// run-time stats, which the Arduino core builds with.
+//
+// The tables are sized from uxTaskGetNumberOfTasks() with some to spare,
+// and grow if more tasks turn up (showing as a step in the heap figures);
+// uxTaskGetSystemState() fills in nothing at all when they're too small.
+
+#define DIAGNOSTICS_SPARE_TASKS 8
+
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+  int8_t core;         // -1 when not pinned
+  uint32_t stackFree;  // bytes never used, the high-water mark
+  float cpu;           // % of one core since the previous sample, -1 if unknown
+} DiagnosticsTaskInfo;
+
+class DiagnosticsTask : public Task, public TSEvents::EventEmitter {
+ public:
+  DiagnosticsTask(Scheduler& s, TSEvents::EventBus& e, unsigned long _interval = 10 * TASK_SECOND)
+      : Task(_interval, TASK_FOREVER, &s, false),
+        TSEvents::EventEmitter(&e) {
+  }
+
+  bool Callback() {
+    int64_t timestamp = timestampMicros();
+    report(HEAP_FREE_DATA, heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024.0f, timestamp);
+    report(HEAP_LARGEST_BLOCK_DATA, heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL) / 1024.0f, timestamp);
+    report(HEAP_MIN_FREE_DATA, heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL) / 1024.0f, timestamp);
+    if (psramFound()) {
+      report(PSRAM_USED_DATA, (ESP.getPsramSize() - ESP.getFreePsram()) / 1024.0f, timestamp);
+    }
+
+    sampleTasks();
+    report(STACK_LOOP_FREE_DATA, uxTaskGetStackHighWaterMark(NULL), timestamp);
+    if (taskCount > 0) {
+      uint32_t minimum = UINT32_MAX;
+      for (int i = 0; i < taskCount; i++) {
+        minimum = min(minimum, tasks[i].stackFree);
+      }
+      report(STACK_MIN_FREE_DATA, minimum, timestamp);
+    }
+    if (coreLoad[0] >= 0) {
+      report(CPU_LOAD_CORE0_DATA, coreLoad[0], timestamp);
+      report(CPU_LOAD_CORE1_DATA, coreLoad[1], timestamp);
+    }
+    samples++;
+    return true;
+  }
+
+  void printStats(Print& out) {
+    printFormat(out, "heap: %u free, %u largest block, %u min free, psram: %u of %u used\n",
+               heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+               heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), ESP.getPsramSize() - ESP.getFreePsram(), ESP.getPsramSize());
+    printFormat(out, "cpu: core 0 %.1f%%, core 1 %.1f%%\n", coreLoad[0], coreLoad[1]);
+    for (int i = 0; i < taskCount; i++) {
+      printFormat(out, "task %s: core %d, %u bytes stack free, %.1f%% cpu\n", tasks[i].name, tasks[i].core, tasks[i].stackFree, tasks[i].cpu);
+    }
+  }
+
+  int getTaskCount() { return taskCount; }
+  const DiagnosticsTaskInfo& getTask(int i) { return tasks[i]; }
+  float getCoreLoad(int core) { return coreLoad[core]; }
+  // Changes whenever a new sample has been taken
+  uint32_t getSamples() { return samples; }
+
+ private:
+  void report(EventType event, float value, int64_t timestamp) {
+    SensorReading reading = {value, timestamp};
+    dispatch(event, &reading, sizeof(SensorReading));
+  }
+
+  void sampleTasks() {
+#if configUSE_TRACE_FACILITY
+    uint32_t totalRunTime;
+    int n = 0;
+    for (int attempt = 0; attempt < 2 && n == 0; attempt++) {
+      if (!reserve(uxTaskGetNumberOfTasks())) {
+        return;
+      }
+      n = uxTaskGetSystemState(status, capacity, &totalRunTime);
+    }
+    taskCount = 0;
+    coreLoad[0] = coreLoad[1] = -1;
+#if configGENERATE_RUN_TIME_STATS
+    // The run time counter is in us on every core, so elapsed is the time
+    // one core had available
+    uint32_t elapsed = totalRunTime - lastTotalRunTime;
+    bool haveElapsed = lastTotalRunTime != 0 && elapsed > 0;
+    lastTotalRunTime = totalRunTime;
+#endif
+
+    for (int i = 0; i < n; i++) {
+      const TaskStatus_t& task = status[i];
+      DiagnosticsTaskInfo& info = tasks[taskCount++];
+      strlcpy(info.name, task.pcTaskName, sizeof(info.name));
+#if configTASKLIST_INCLUDE_COREID
+      info.core = task.xCoreID == tskNO_AFFINITY ? -1 : task.xCoreID;
+#else
+      info.core = -1;
+#endif
+      info.stackFree = task.usStackHighWaterMark * sizeof(StackType_t);
+      info.cpu = -1;
+
+#if configGENERATE_RUN_TIME_STATS
+      // Tasks come and go, so previous counters are matched by task number
+      uint32_t previous = 0;
+      bool seen = false;
+      for (int j = 0; j < lastCount; j++) {
+        if (lastNumbers[j] == task.xTaskNumber) {
+          previous = lastRunTimes[j];
+          seen = true;
+          break;
+        }
+      }
+      if (haveElapsed && seen) {
+        info.cpu = 100.0f * (task.ulRunTimeCounter - previous) / elapsed;
+        for (int core = 0; core < 2; core++) {
+          if (task.xHandle == xTaskGetIdleTaskHandleForCPU(core)) {
+            coreLoad[core] = constrain(100.0f - info.cpu, 0.0f, 100.0f);
+          }
+        }
+      }
+#endif
+    }
+
+#if configGENERATE_RUN_TIME_STATS
+    lastCount = n;
+    for (int i = 0; i < n; i++) {
+      lastNumbers[i] = status[i].xTaskNumber;
+      lastRunTimes[i] = status[i].ulRunTimeCounter;
+    }
+#endif
+#endif
+  }
+
+  // Room for at least count tasks, false if the memory isn't there
+  bool reserve(int count) {
+    if (count <= capacity) {
+      return true;
+    }
+    int grown = count + DIAGNOSTICS_SPARE_TASKS;
+    TaskStatus_t* newStatus = (TaskStatus_t*)realloc(status, grown * sizeof(TaskStatus_t));
+    if (newStatus != NULL) {
+      status = newStatus;
+    }
+    DiagnosticsTaskInfo* newTasks = (DiagnosticsTaskInfo*)realloc(tasks, grown * sizeof(DiagnosticsTaskInfo));
+    if (newTasks != NULL) {
+      tasks = newTasks;
+    }
+    UBaseType_t* newNumbers = (UBaseType_t*)realloc(lastNumbers, grown * sizeof(UBaseType_t));
+    if (newNumbers != NULL) {
+      lastNumbers = newNumbers;
+    }
+    uint32_t* newRunTimes = (uint32_t*)realloc(lastRunTimes, grown * sizeof(uint32_t));
+    if (newRunTimes != NULL) {
+      lastRunTimes = newRunTimes;
+    }
+    if (newStatus == NULL || newTasks == NULL || newNumbers == NULL || newRunTimes == NULL) {
+      return false;
+    }
+    capacity = grown;
+    return true;
+  }
+
+  int capacity = 0;
+  TaskStatus_t* status = NULL;
+  DiagnosticsTaskInfo* tasks = NULL;
+  int taskCount = 0;
+  float coreLoad[2] = {-1, -1};
+  uint32_t samples = 0;
+
+  UBaseType_t* lastNumbers = NULL;
+  uint32_t* lastRunTimes = NULL;
+  int lastCount = 0;
+  uint32_t lastTotalRunTime = 0;
+};
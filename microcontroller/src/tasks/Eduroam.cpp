@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <WiFi.h>
 #include <esp_wpa2.h>
@@ -7,14 +9,16 @@
 #include <TaskSchedulerDeclarations.h>
 
 #include "events.h"
+#include "timesync.h"
 
 class EduroamTask : public Task, public TSEvents::EventHandler {
  public:
-  EduroamTask(Scheduler& s, TSEvents::EventBus& e, const char* _user, const char* _pass)
+  EduroamTask(Scheduler& s, TSEvents::EventBus& e, const char* _user, const char* _pass, const char* _ntpServer = NULL)
       : Task(1000 * TASK_MILLISECOND, TASK_FOREVER, &s, false),
         TSEvents::EventHandler(&s, &e) {
     user = _user;
     pass = _pass;
+    ntpServer = _ntpServer;
   }
 
   bool OnEnable() {
@@ -35,6 +39,7 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
             dispatch(WIFI_CONNECTED);
             state = CONNECTED;
             setInterval(1 * TASK_SECOND);
+            startTimeSync(ntpServer);
             break;
           case WL_NO_SSID_AVAIL:
             // Connecting failed
@@ -66,6 +71,7 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
           connect();
           break;
         }
+        reportTimeSync();
         break;
       case DISCONNECTED:
         connect();
@@ -77,6 +83,7 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
   bool connect() {
     int apIndex = findAPIndex("eduroam");
     if (apIndex == -1) {
+      WiFi.scanDelete();
       dispatch(WIFI_CONNECT_FAILED, "SSID not detectable");
       return false;
     }
@@ -84,6 +91,7 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
     uint8_t* bssid = WiFi.BSSID(apIndex);
 
     WiFi.begin("eduroam", WPA2_AUTH_PEAP, user, user, pass, NULL, NULL, NULL, channel, bssid, true);
+    WiFi.scanDelete();  // The scan results are on the heap until they're freed
     state = CONNECTING;
     connectTime = millis();
     setInterval(100 * TASK_MILLISECOND);
@@ -104,13 +112,27 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
   }
 
  private:
-  int findAPIndex(String ssid) {
+  void reportTimeSync() {
+    float offset, drift;
+    if (!takeTimeSyncResult(&offset, &drift)) {
+      return;
+    }
+    int64_t now = timestampMicros();
+    SensorReading reading = {offset, now};
+    dispatch(CLOCK_OFFSET_DATA, &reading, sizeof(SensorReading));
+    reading = {drift, now};
+    dispatch(CLOCK_DRIFT_DATA, &reading, sizeof(SensorReading));
+  }
+
+  // Compares the raw scan records, WiFi.SSID() would make a String per network
+  int findAPIndex(const char* ssid) {
     int index = -1;
     int32_t rssi = 0;
     int n = WiFi.scanNetworks();
     for (int i = 0; i < n; i++) {
-      if (WiFi.SSID(i) == ssid) {
-        int32_t newRSSI = WiFi.RSSI(i);
+      wifi_ap_record_t* record = (wifi_ap_record_t*)WiFi.getScanInfoByIndex(i);
+      if (record != NULL && strcmp((const char*)record->ssid, ssid) == 0) {
+        int32_t newRSSI = record->rssi;
         if (index == -1 || newRSSI > rssi) {
           index = i;
           rssi = newRSSI;
@@ -130,4 +152,5 @@ class EduroamTask : public Task, public TSEvents::EventHandler {
   State state;
   const char* user;
   const char* pass;
+  const char* ntpServer;
 };
\ No newline at end of file
@@ -12,23 +12,27 @@
 #include <tasks/PortBHub.cpp>
 
 #include "UNIT_EXT_ENCODER.h"
+#include "adaptive_rate.h"
 #include "events.h"
+#include "filters.h"
+#include "print_format.h"
+#include "rpm_estimator.h"
+#include "timesync.h"
+
+// Estimator latency and noise are reported this often
+#define ENCODER_STATS_INTERVAL_MS 1000
 
 class EncoderTask : public Task, public TSEvents::EventEmitter {
  public:
-  EncoderTask(Scheduler& s, TSEvents::EventBus& e, I2CHubTask* _i2cHub, int _channel, EventType _event, TwoWire& _wire = Wire, unsigned long _interval = 1000 * TASK_MILLISECOND)
+  EncoderTask(Scheduler& s, TSEvents::EventBus& e, I2CHubTask* _i2cHub, int _channel, EventType _event, EventType _latencyEvent, EventType _noiseEvent, TwoWire& _wire = Wire, unsigned long _interval = 1000 * TASK_MILLISECOND)
       : Task(_interval, TASK_FOREVER, &s, false),
         TSEvents::EventEmitter(&e) {
     i2cHub = _i2cHub;
     channel = _channel;
     wire = &_wire;
     event = _event;
-
-    numReadings = 5;
-    rpmReadings = new double[numReadings];
-    for (int i = 0; i < numReadings; i++) {
-      rpmReadings[i] = 0;
-    }
+    latencyEvent = _latencyEvent;
+    noiseEvent = _noiseEvent;
   }
 
   bool OnEnable() {
@@ -38,62 +42,84 @@ class EncoderTask : public Task, public TSEvents::EventEmitter {
     }
     encoder.begin(&Wire, UNIT_EXT_ENCODER_ADDR, 32, 33, 100000UL);
     encoder.setZeroPulseValue(0);
-    lastAvg = millis();
-    lastAvgCount = 0.00000;
+    estimator.reset(encoder.getEncoderValue(), micros());
+    lastStats = millis();
     return true;
   }
 
   bool Callback() {
-    String encodername = "";
-    double t = millis();
+    uint32_t start = micros();
     bool ok = i2cHub->setChannel(channel);
     if (!ok) {
       return true;
     }
-    uint32_t rawcount = encoder.getEncoderValue();
-    double count = rawcount;
-    double dt = double(t - lastAvg);
-    double rpm = (double(count - lastAvgCount) / 420.00) / dt;
-    rpm = rpm * 60000.00;
-    updateRollingAverage(rpm);
-    dispatch(event, &averageRPM, sizeof(double));
-    lastAvg = t;
-    lastAvgCount = count;
-    latestRPM = averageRPM;
+    uint32_t count = encoder.getEncoderValue();
+    uint32_t t = micros();
+    busLoad.update(t - start, getInterval() / TASK_MILLISECOND);
+    int64_t timestamp = timestampMicros();
+    if (estimator.update(count, t)) {
+      latestRPM = filter.update(estimator.getRPM());
+    }
+    SensorReading reading = {latestRPM, timestamp};
+    dispatch(event, &reading, sizeof(SensorReading));
+
+    if (millis() - lastStats >= ENCODER_STATS_INTERVAL_MS) {
+      lastStats = millis();
+      reading.value = getLatencyUs() / 1000.0f;
+      dispatch(latencyEvent, &reading, sizeof(SensorReading));
+      reading.value = estimator.getNoise();
+      dispatch(noiseEvent, &reading, sizeof(SensorReading));
+    }
     return true;
   }
 
-  double latestRPM;
+  // minCounts 0 estimates from every poll, see rpm_estimator.h
+  void setEstimator(int minCounts, uint32_t maxWindowMs) {
+    estimator.configure(minCounts, maxWindowMs * 1000);
+  }
+
+  // How far latestRPM lags the shaft: half the estimator's window, plus the
+  // filter's delay in estimates of that window each
+  uint32_t getLatencyUs() {
+    return estimator.getWindowUs() * (0.5f + filter.getDelaySamples());
+  }
+
+  // The latest unfiltered estimate, see rpm_estimator.h. getEstimates()
+  // changes when a new one is in.
+  float getRawRPM() { return estimator.getRPM(); }
+  uint32_t getEstimates() { return estimator.getEstimates(); }
+  uint32_t getWindowUs() { return estimator.getWindowUs(); }
+  float getResolution() { return estimator.getResolution(); }
+
+  void printStats(Print& out) {
+    printFormat(out, "encoder: %.1f rpm, %s mode, %.1f ms window, %.1f ms latency, %.2f rpm resolution, %.2f rpm noise\n",
+               latestRPM, estimator.getMode() == RPM_ESTIMATOR_COUNT ? "count" : "period", estimator.getWindowUs() / 1000.0f,
+               getLatencyUs() / 1000.0f, estimator.getResolution(), estimator.getNoise());
+  }
+
+  // See filters.h, returns an error message or NULL
+  const char* setFilter(const char* spec) {
+    return filter.configure(spec);
+  }
+
+  // Counts the encoder's reads against the bus budget, see adaptive_rate.h
+  void setBusBudget(SampleBudget* budget) {
+    busLoad.setBudget(budget);
+  }
+
+  float latestRPM = 0;
 
  private:
-  double lastAvg;
-  double lastAvgCount;
+  uint32_t lastStats;
   int channel;
   bool connected = false;
   UNIT_EXT_ENCODER encoder;
   I2CHubTask* i2cHub;
   TwoWire* wire;
   EventType event;
-
-  int numReadings;      // Number of readings to average
-  double* rpmReadings;  // Array to store RPM readings for rolling average
-  double averageRPM;    // Running average of RPM
-
-  void updateRollingAverage(double newRPM) {
-    // Shift existing readings
-    for (int i = numReadings - 1; i > 0; i--) {
-      rpmReadings[i] = rpmReadings[i - 1];
-    }
-    // Add new reading
-    rpmReadings[0] = newRPM;
-
-    // Calculate running total
-    double total = 0;
-    for (int i = 0; i < numReadings; i++) {
-      total += rpmReadings[i];
-    }
-
-    // Calculate running average
-    averageRPM = total / numReadings;
-  }
+  EventType latencyEvent;
+  EventType noiseEvent;
+  RpmEstimator estimator;
+  SensorFilter filter;
+  FixedRate busLoad;
 };
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <FunctionalInterrupt.h>
 #include <M5Tough.h>
@@ -10,7 +12,11 @@
 #include <tasks/PortBHub.cpp>
 
 #include "UNIT_EXT_ENCODER.h"
+#include "adaptive_rate.h"
 #include "events.h"
+#include "filters.h"
+#include "sensor_math.h"
+#include "timesync.h"
 
 class FlowSensorTask : public Task, public TSEvents::EventEmitter {
  public:
@@ -22,8 +28,7 @@ class FlowSensorTask : public Task, public TSEvents::EventEmitter {
     channel = _channel;
     wire = &_wire;
     event = _event;
-    kValue = _kValue;
-    flowCorrectK = _flowCorrectK;
+    scale = flowScale(_kValue, _flowCorrectK);
   }
 
   bool OnEnable() {
@@ -39,25 +44,37 @@ class FlowSensorTask : public Task, public TSEvents::EventEmitter {
   }
 
   bool Callback() {
-    unsigned long t = millis();
+    uint32_t t = millis();
+    uint32_t start = micros();
     bool ok = i2cHub->setChannel(channel);
     if (!ok) {
       return true;
     }
     uint32_t count = encoder.getZeroPulseValue();
-    float dt = float(t - lastAvg) / 1000;
-    float freq = float(count - lastAvgCount) / dt;
+    busLoad.update(micros() - start, getInterval() / TASK_MILLISECOND);
+    int64_t timestamp = timestampMicros();
     // kValue from data sheet, this should give a value of L/min, Q=f*60/k : e.g k= 1420 for no jet, RS 508-2704 flowmeter
     // kValue & flowCorrect are from the unique .json, flowCorrect is a custom calibration factor to adjust if data sheet k is not accurate
-    float flow = (freq * (60 / kValue)) / flowCorrectK;  
-    dispatch(event, &flow, sizeof(float));
+    float flow = filter.update(flowRate(counterDelta(count, lastAvgCount), t - lastAvg, scale));
+    SensorReading reading = {flow, timestamp};
+    dispatch(event, &reading, sizeof(SensorReading));
     lastAvg = t;
     lastAvgCount = count;
     return true;
   }
 
+  // See filters.h, returns an error message or NULL
+  const char* setFilter(const char* spec) {
+    return filter.configure(spec);
+  }
+
+  // Counts the flowmeter's reads against the bus budget, see adaptive_rate.h
+  void setBusBudget(SampleBudget* budget) {
+    busLoad.setBudget(budget);
+  }
+
  private:
-  int lastAvg;
+  uint32_t lastAvg;
   uint32_t lastAvgCount;
   int channel;
   bool connected = false;
@@ -65,6 +82,7 @@ class FlowSensorTask : public Task, public TSEvents::EventEmitter {
   I2CHubTask* i2cHub;
   TwoWire* wire;
   EventType event;
-  float kValue;
-  float flowCorrectK;
+  float scale;  // flowScale(kValue, flowCorrectK)
+  SensorFilter filter;
+  FixedRate busLoad;
 };
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <FunctionalInterrupt.h>
 #include <M5Tough.h>
@@ -10,7 +12,38 @@
 #include <tasks/I2CHub.cpp>
 
 #include "M5UnitHbridge.h"
+#include "actuator.h"
+#include "adaptive_rate.h"
+#include "autotune.h"
 #include "events.h"
+#include "pid.h"
+#include "print_format.h"
+#include "sensor_math.h"
+#include "speed_observer.h"
+
+// The pump stops if flow control is on and no flow reading has come in for
+// this long, rather than run on a stale one
+#define FLOW_TIMEOUT_US 2000000
+
+// Relay autotune, see autotune.h. Hysteresis is a little over the reading
+// noise on each loop.
+#define AUTOTUNE_TIMEOUT_US 55000000
+#define AUTOTUNE_STEP 40  // PWM either side, unless asked for another
+#define AUTOTUNE_RPM_HYSTERESIS 3
+#define AUTOTUNE_FLOW_HYSTERESIS 0.03f
+
+// Spread of the encoder's estimate beyond its count resolution, mostly poll
+// timing jitter, in rpm^2 (about 2 rpm RMS at speed in tools/bench/rpm_bench)
+#define OBSERVER_JITTER_VARIANCE 4
+
+// When reversing, the stirrer coasts down to this before driving the other
+// way, rather than braking against itself
+#define REVERSE_STOP_RPM 10
+
+class HBridgeTask;
+
+// Called from the HBridgeTask tick when an autotune finishes or fails
+typedef void (*AutotuneHandler)(HBridgeTask* task);
 
 class HBridgeTask : public Task, public TSEvents::EventHandler {
  public:
@@ -22,10 +55,19 @@ class HBridgeTask : public Task, public TSEvents::EventHandler {
     channel = _channel;
     wire = &_wire;
     address = _address;
+    controller.setFeedforward(&feedforward);
   }
 
   void HandleEvent(TSEvents::Event event) {
     switch ((EventType)event.id) {
+      case FLOW_SENSOR_1_DATA:
+        if (channel == 1) {
+          flow = ((SensorReading*)event.data)->value;
+          flowReadings++;
+        }
+        break;
+      default:
+        break;
     }
   }
 
@@ -35,48 +77,58 @@ class HBridgeTask : public Task, public TSEvents::EventHandler {
       return true;
     }
     driver.begin(&Wire, address);
-    driver.setDriverDirection(HBRIDGE_FORWARD);
-    lastAvg = millis();
-    lastAvgCount = 0;
+    output.invalidate();
+    lastTickUs = micros();
+    observer.reset(0);
+    controller.reset(0);
     return true;
   }
 
   bool Callback() {
-    bool ok = i2cHub->setChannel(channel);
-    if (!ok) {
-      Serial.printf("HBridgeTask unable to set channel %d\n", channel);
-      return true;
-    }
+    uint32_t now = micros();
+    uint32_t dt = now - lastTickUs;
+    lastTickUs = now;
 
     if (channel == 0) {  // Stirrer
-
-      rpm = encoder->latestRPM;
-      if (rpm < 0 || rpm > 2000) {
-        return true;
-      }
-      if (rpmSetpoint == 0) {
-        driver.setDriverSpeed8Bits(0);
+      updateObserver(dt);
+      // Speeds are in the direction being driven, the encoder counts down
+      // when reversed
+      rpm = useObserver ? observer.getRPM() : encoder->latestRPM * directionSign();
+      if (reverse != reversed) {
+        cancelAutotune();
         driverspeed = 0;
-        rpmCumError = 0;
+        if (fabsf(encoder->latestRPM) < REVERSE_STOP_RPM && output.getSpeed() == 0) {
+          reversed = reverse;
+          observer.reset(0);
+          controller.reset(0);
+        }
+      } else if (rpm < -REVERSE_STOP_RPM || rpm > 2000) {
+        return true;
       } else {
-        rpmSetpoint = constrain(rpmSetpoint, 0, maxRpm);
-        rpmError = rpmSetpoint - rpm;
-        rpmCumError += rpmError;
-
-        // *** SAFETY ADDITION ***
-        // Prevent "Windup": Don't let the memory get too huge.
-        // +/- 5000 is enough to reach full power, but prevents "runaway" behavior.
-        rpmCumError = constrain(rpmCumError, -5000, 5000);
-
-        driverspeed = midPWM + round(rpmKp * rpmError + rpmKi * rpmCumError);
-        driverspeed = constrain(driverspeed, 0, maxPWM);
-        driver.setDriverSpeed8Bits(driverspeed);
+        rpm = fmaxf(rpm, 0);  // Still turning the old way, just after reversing
+        if (rpmSetpoint == 0) {
+          cancelAutotune();
+        }
+        if (autotuner.isRunning()) {
+          driverspeed = runAutotune(rpm, now);
+        } else if (rpmSetpoint == 0 && !controller.isManual()) {
+          driverspeed = 0;
+          controller.reset(rpm);
+        } else {
+          rpmSetpoint = constrain(rpmSetpoint, 0, maxRpm);
+          int pwm = roundToInt(updateController(rpmSetpoint, rpm, dt));
+          driverspeed = constrain(pwm, 0, maxPWM);
+        }
       }
+      writeOutput(driverspeed * directionSign(), dt, now);
       return true;
     }
 
     if (channel == 1) {  // pump
-      driver.setDriverSpeed8Bits(pumppwm);
+      if (flowControl) {
+        updateFlowLoop();
+      }
+      writeOutput(pumppwm, dt, now);
       return true;
     }
 
@@ -87,18 +139,311 @@ class HBridgeTask : public Task, public TSEvents::EventHandler {
     rpmSetpoint = constrain(_rpm, 0, maxRpm);
   }
 
+  // Open loop pump PWM, ignored under flow control
   void setPWM(uint16_t _pumppwm) {
-    pumppwm = constrain(_pumppwm, 0, maxPWM);
+    if (!flowControl) {
+      pumppwm = constrain(_pumppwm, 0, maxPWM);
+    }
+  }
+
+  // Pump flow setpoint in L/min, used under flow control
+  void setFlow(float _flow) {
+    flowSetpoint = constrain(_flow, 0, maxFlow);
+  }
+
+  // Switches the pump between open loop PWM and regulating to the flow
+  // setpoint. Either way round the PWM carries on from where it was.
+  void setFlowControl(bool on) {
+    if (on && !flowControl) {
+      flowSetpoint = constrain(flow, 0, maxFlow);
+      controller.reset(flow, pumppwm);
+      lastFlowReadings = flowReadings;
+      lastFlowUs = micros();
+    }
+    if (!on) {
+      cancelAutotune();
+    }
+    flowControl = on;
+  }
+
+  bool isFlowControl() {
+    return flowControl;
+  }
+
+  void setMaxFlow(float _maxFlow) {
+    maxFlow = _maxFlow;
+    flowSetpoint = constrain(flowSetpoint, 0, maxFlow);
+  }
+
+  float getMaxFlow() {
+    return maxFlow;
+  }
+
+  float getFlowSetpoint() {
+    return flowSetpoint;
+  }
+
+  void setGains(const PidGains& gains) {
+    controller.setGains(gains);
+  }
+
+  // PWM needed to hold each speed or flow, see pid.h
+  void setFeedforward(const FeedforwardMap& _feedforward) {
+    feedforward = _feedforward;
+  }
+
+  // PWM per second the output may move, 0 for no limit, see actuator.h
+  void setSlewRate(float slewRate) {
+    output.setSlewRate(slewRate);
+  }
+
+  // Counts the writes against the bus budget, see adaptive_rate.h
+  void setBusBudget(SampleBudget* budget) {
+    busLoad.setBudget(budget);
+  }
+
+  // Runs the stirrer backward. It coasts to a stop first, then the speed
+  // loop starts again from standstill the other way.
+  void setReverse(bool _reverse) {
+    reverse = _reverse;
+  }
+
+  bool isReverse() {
+    return reverse;
+  }
+
+  // Holds the stirrer at a fixed PWM, even with the setpoint at 0, until
+  // setAuto(). The controller tracks it so the switch back doesn't jump.
+  void setManual(uint16_t pwm) {
+    cancelAutotune();
+    controller.setManual(constrain(pwm, 0, maxPWM));
+  }
+
+  void setAuto() {
+    controller.setAuto();
+  }
+
+  bool isManual() {
+    return controller.isManual();
+  }
+
+  // Starts a relay autotune about the current setpoint, swinging the PWM
+  // step either side of where it is. Returns an error message or NULL.
+  // Runs over the next minute at most, then calls the handler.
+  const char* startAutotune(float step) {
+    if (autotuner.isRunning()) {
+      return "autotune already running";
+    }
+    if (channel == 0) {
+      if (rpmSetpoint == 0 || controller.isManual()) {
+        return "set a stirrer speed to tune at first";
+      }
+      autotuner.configure(step, AUTOTUNE_RPM_HYSTERESIS, 0, maxPWM, AUTOTUNE_TIMEOUT_US);
+      autotuner.start(rpmSetpoint, driverspeed, rpm, micros());
+    } else {
+      if (!flowControl || flowSetpoint == 0) {
+        return "set a flow to tune at first, with pumpFlowControl on";
+      }
+      autotuner.configure(step, AUTOTUNE_FLOW_HYSTERESIS, 0, maxPWM, AUTOTUNE_TIMEOUT_US);
+      autotuner.start(flowSetpoint, pumppwm, flow, micros());
+    }
+    return NULL;
+  }
+
+  void cancelAutotune() {
+    if (autotuner.isRunning()) {
+      autotuner.cancel();
+      finishAutotune(channel == 0 ? rpm : flow, channel == 0 ? driverspeed : pumppwm);
+    }
+  }
+
+  const RelayAutotuner& getAutotuner() {
+    return autotuner;
+  }
+
+  void setAutotuneHandler(AutotuneHandler _autotuneHandler) {
+    autotuneHandler = _autotuneHandler;
+  }
+
+  void setMaxRPM(int _maxRpm) {
+    maxRpm = _maxRpm;
+    rpmSetpoint = constrain(rpmSetpoint, 0, maxRpm);
+  }
+
+  int getMaxRPM() {
+    return maxRpm;
+  }
+
+  int getRPMSetpoint() {
+    return rpmSetpoint;
+  }
+
+  uint16_t getPWM() {
+    return pumppwm;
+  }
+
+  int getDriverSpeed() {
+    return driverspeed;
+  }
+
+  void setModel(const MotorModel& model, float processNoise) {
+    observer.configure(model, processNoise);
+  }
+
+  // Feed the PI loop from the observer rather than the filtered encoder
+  void setFeedback(bool _useObserver) {
+    useObserver = _useObserver;
+  }
+
+  // The model fitted to this motor so far, false until there is one
+  bool getFittedModel(MotorModel* model) {
+    return identifier.getModel(model);
+  }
+
+  void printStats(Print& out) {
+    printFormat(out, "%s output: pwm %d %s, slew %.0f pwm/s, %u writes, %u ticks needed none, %u PaHub failures\n", channel == 0 ? "stirrer" : "pump",
+               output.getSpeed(), output.getDirection() == ACTUATOR_BACKWARD ? "backward" : "forward", output.getSlewRate(),
+               output.getWrites(), output.getSkipped(), channelFailures);
+    if (channel == 1) {
+      printFormat(out, "pump: %s, %.2f L/min setpoint, %.2f L/min measured, pwm %d = ff %.1f + p %.1f + i %.1f + d %.1f\n",
+                 flowControl ? "flow control" : "open loop", flowSetpoint, flow, pumppwm, controller.getFeedforward(),
+                 controller.getP(), controller.getI(), controller.getD());
+      return;
+    }
+    MotorModel fitted;
+    printFormat(out, "stirrer: %d rpm setpoint (ramp at %.0f), pwm %d = ff %.1f + p %.1f + i %.1f + d %.1f%s\n", rpmSetpoint,
+               controller.getSetpoint(), driverspeed, controller.getFeedforward(), controller.getP(), controller.getI(),
+               controller.getD(), controller.isManual() ? " (manual)" : "");
+    printFormat(out, "stirrer observer: %.1f rpm (encoder weight %.2f, innovation %.1f rpm), feedback %s\n",
+               observer.getRPM(), observer.getGain(), observer.getInnovation(), useObserver ? "observer" : "encoder");
+    if (identifier.getModel(&fitted)) {
+      printFormat(out, "stirrer model fit: gain %.3f rpm/pwm, offset %.1f pwm, tau %.0f ms from %u estimates\n",
+                 fitted.gain, fitted.offset, fitted.tauMs, identifier.getSamples());
+    }
   }
 
  private:
+  // The flow reading only changes every flowInterval, so the loop runs once
+  // per reading rather than every tick
+  void updateFlowLoop() {
+    uint32_t now = micros();
+    if (flowReadings == lastFlowReadings) {
+      if (now - lastFlowUs > FLOW_TIMEOUT_US) {
+        cancelAutotune();
+        pumppwm = 0;
+        controller.reset(flow);
+        lastFlowUs = now;
+      }
+      return;
+    }
+    lastFlowReadings = flowReadings;
+    uint32_t dt = now - lastFlowUs;
+    lastFlowUs = now;
+    if (flowSetpoint == 0) {
+      cancelAutotune();
+    }
+    if (autotuner.isRunning()) {
+      pumppwm = runAutotune(flow, now);
+    } else if (flowSetpoint == 0) {
+      pumppwm = 0;
+      controller.reset(flow);
+    } else {
+      int pwm = roundToInt(updateController(flowSetpoint, flow, dt));
+      pumppwm = constrain(pwm, 0, maxPWM);
+    }
+  }
+
+  // Keeps the controller to what the slew limit lets the output reach by
+  // the next tick, so its anti-windup sees the limit. constrain() is a
+  // macro, so callers take the result into a variable before it.
+  float updateController(float setpoint, float measurement, uint32_t dt) {
+    float reach = output.getSlewStep(dt);
+    float applied = output.getOutput() * directionSign();
+    controller.setOutputLimits(fmaxf(applied - reach, 0), fminf(applied + reach, maxPWM));
+    float result = controller.update(setpoint, measurement, dt);
+    controller.setOutputLimits(0, maxPWM);
+    return result;
+  }
+
+  // Sends the signed PWM through the output stage, selecting the unit on
+  // the PaHub only when there is something to write
+  void writeOutput(int pwm, uint32_t dt, uint32_t now) {
+    output.setTarget(pwm);
+    ActuatorWrites writes = output.update(dt, now);
+    uint32_t start = micros();
+    if (writes.direction || writes.speed) {
+      sendWrites(writes, now);
+    }
+    busLoad.update(micros() - start, getInterval() / TASK_MILLISECOND);
+  }
+
+  void sendWrites(ActuatorWrites writes, uint32_t now) {
+    // Counted for the stats command rather than printed, this runs every
+    // tick and the port may be carrying binary frames
+    if (!i2cHub->setChannel(channel)) {
+      channelFailures++;
+      return;
+    }
+    if (writes.direction) {
+      driver.setDriverDirection((hbridge_direction_t)output.getDirection());
+    }
+    if (writes.speed) {
+      driver.setDriverSpeed8Bits(output.getSpeed());
+    }
+    output.written(writes, now);
+  }
+
+  int directionSign() {
+    return reversed ? -1 : 1;
+  }
+
+  // The relay in place of the controller while an autotune runs
+  int runAutotune(float measurement, uint32_t now) {
+    int pwm = roundToInt(autotuner.update(measurement, now));
+    pwm = constrain(pwm, 0, maxPWM);
+    if (!autotuner.isRunning()) {
+      finishAutotune(measurement, pwm);
+    }
+    return pwm;
+  }
+
+  // Hands back to the controller from the relay's output, then reports
+  void finishAutotune(float measurement, int pwm) {
+    controller.reset(measurement, pwm);
+    if (autotuneHandler != NULL) {
+      autotuneHandler(this);
+    }
+  }
+
+  // Runs every stirrer tick whichever feedback is in use, so the observer
+  // and model fit can be checked before switching over
+  void updateObserver(uint32_t dt) {
+    // What the output stage applied since the last tick
+    float applied = output.getOutput() * directionSign();
+    observer.predict(applied, dt);
+    pwmSum += applied * dt;
+    pwmUs += dt;
+
+    if (encoder->getEstimates() == lastEstimates) {
+      return;
+    }
+    lastEstimates = encoder->getEstimates();
+    float measured = encoder->getRawRPM() * directionSign();
+    float resolution = encoder->getResolution();
+    observer.correct(measured, resolution * resolution / 12 + OBSERVER_JITTER_VARIANCE);
+    if (pwmUs > 0) {
+      identifier.update(lastEstimateRpm, measured, pwmSum / pwmUs, encoder->getWindowUs());
+    }
+    lastEstimateRpm = measured;
+    pwmSum = 0;
+    pwmUs = 0;
+  }
+
   uint16_t potvalue = 0;
   uint16_t pumppwm = 0;
   uint16_t stirrerRpm = 0;
   M5UnitHbridge driver;
   int address;
-  int lastAvg;
-  uint32_t lastAvgCount;
   int channel;
   bool connected = false;
   I2CHubTask* i2cHub;
@@ -106,18 +451,40 @@ class HBridgeTask : public Task, public TSEvents::EventHandler {
   TwoWire* wire;
 
   // Motor variables
-  int driverspeed;
+  int driverspeed = 0;
   float rpm = 0.0;
 
   int maxPWM = 255;
-  int midPWM = 127;
 
   int maxRpm = 380;
   int rpmSetpoint = 350;
 
-  float rpmError = 0.0;
-  float rpmCumError = 0.0;
+  // Pump flow control, L/min
+  bool flowControl = false;
+  float flowSetpoint = 0;
+  float maxFlow = 2;
+  float flow = 0;
+  uint32_t flowReadings = 0;
+  uint32_t lastFlowReadings = 0;
+  uint32_t lastFlowUs = 0;
+
+  ActuatorOutput output;
+  uint32_t channelFailures = 0;  // Writes lost to the PaHub not selecting the channel
+  FixedRate busLoad;
+  bool reverse = false;   // Direction asked for
+  bool reversed = false;  // Direction being driven, differs while stopping to reverse
+
+  PidController controller = PidController(0, 255);  // Speed or flow loop, by channel
+  FeedforwardMap feedforward;
+  RelayAutotuner autotuner;
+  AutotuneHandler autotuneHandler = NULL;
 
-  float rpmKp = 0.6;
-  float rpmKi = 0.05;
+  SpeedObserver observer;
+  MotorModelIdentifier identifier;
+  bool useObserver = false;
+  uint32_t lastTickUs = 0;
+  uint32_t lastEstimates = 0;
+  float lastEstimateRpm = 0;
+  float pwmSum = 0;  // PWM integrated over time since the last estimate
+  uint32_t pwmUs = 0;
 };
\ No newline at end of file
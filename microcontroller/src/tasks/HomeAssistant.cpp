@@ -1,9 +1,12 @@
+#pragma once
+
 #include <Arduino.h>
 #include <WiFi.h>
 #define _TASK_OO_CALLBACKS
 #define _TASK_STATUS_REQUEST
 #include <ArduinoJson.h>
 #include <EventHandler.h>
+#include <Preferences.h>
 #include <TaskSchedulerDeclarations.h>
 
 #include "events.h"
@@ -16,19 +19,30 @@ typedef struct {
   const char* deviceClass;
   const char* unit;
   EventType eventId;
+  bool diagnostic;  // Listed under the device's diagnostics in Home Assistant
   float value;
   uint16_t valueCount;
+  int64_t firstTimestamp;  // Acquisition times spanned by the averaged value
+  int64_t lastTimestamp;
 } hassSensor;
 
+// Upper bound on sensors whose discovery payload is cached
+#define HASS_MAX_SENSORS 24
+#define HASS_DISCOVERY_SIZE 640
+
 class HomeAssistantTask : public Task, public TSEvents::EventHandler {
  public:
   HomeAssistantTask(Scheduler& s, TSEvents::EventBus& e, MQTTTask* _mqtt, const char* _deviceName, hassSensor* _sensors, int _sensorCount, unsigned long interval = 5 * TASK_SECOND)
       : Task(interval, TASK_FOREVER, &s, false),
-        TSEvents::EventHandler(&s, &e) {
+        TSEvents::EventHandler(&s, &e),
+        payload(payloadCapacity(_sensors, _sensorCount)) {
     mqtt = _mqtt;
     deviceName = _deviceName;
     sensors = _sensors;
     sensorCount = _sensorCount;
+    messageSize = messageCapacity(_sensors, _sensorCount);
+    message = (char*)malloc(messageSize);
+    mqtt->reservePayload(messageSize);
   }
 
   bool OnEnable() {
@@ -36,11 +50,10 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
   }
 
   bool Callback() {
-    if (!discoveryMessageSent) {
-      discoveryMessageSent = sendDiscoveryMessage();
-      if (!discoveryMessageSent) {
-        return true;
-      }
+    if (nextDiscovery < sensorCount) {
+      // At most one discovery document per tick so a fleet reconnecting
+      // together doesn't flood the broker and Home Assistant
+      sendDiscoveryMessage();
     }
     sendDataMessage();
     return true;
@@ -49,6 +62,7 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
   void HandleEvent(TSEvents::Event event) {
     switch (event.id) {
       case MQTT_SERVER_CONNECTED:
+        nextDiscovery = 0;
         enable();
         break;
       case MQTT_SERVER_DISCONNECTED:
@@ -58,24 +72,23 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
         for (int i = 0; i < sensorCount; i++) {
           hassSensor sensor = sensors[i];
           if (sensor.eventId == event.id) {
-            if (event.id == ENCODER_1_DATA) {
-              float value = *(double*)event.data;
-              setValue(sensor.id, *(double*)event.data);
-            } else {
-              float value = *(float*)event.data;
-              setValue(sensor.id, *(float*)event.data);
-            }
+            SensorReading* reading = (SensorReading*)event.data;
+            setValue(sensor.id, reading->value, reading->timestamp);
           }
         }
       }
     }
   }
 
-  bool setValue(const char* id, float value) {
+  bool setValue(const char* id, float value, int64_t timestamp = 0) {
     for (int i = 0; i < sensorCount; i++) {
       if (strcmp(sensors[i].id, id) == 0) {
         // Maintain a running average of the passed values
         sensors[i].value = ((float)sensors[i].valueCount * sensors[i].value + value) / (sensors[i].valueCount + 1);
+        if (sensors[i].valueCount == 0) {
+          sensors[i].firstTimestamp = timestamp;
+        }
+        sensors[i].lastTimestamp = timestamp;
         sensors[i].valueCount++;
         return true;
       }
@@ -83,15 +96,89 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
     return false;
   }
 
+  // Publishes the next discovery document whose content differs from the
+  // last one the broker accepted. Documents are retained, so unchanged ones
+  // are skipped entirely, even across reboots.
   bool sendDiscoveryMessage() {
+    if (!discoveryCached) {
+      buildDiscoveryCache();
+    }
+
+    char discoveryTopic[64];
+    char key[8];
+    while (nextDiscovery < sensorCount) {
+      int i = nextDiscovery;
+      sprintf(key, "disc%d", i);
+      if (preferences.getUInt(key, 0) == discoveryHashes[i]) {
+        nextDiscovery++;
+        continue;
+      }
+
+      getDiscoveryTopic(discoveryTopic, sensors[i].id);
+      bool ok = mqtt->sendMessage(discoveryTopic, discoveryCache[i], true);
+      if (!ok) {
+        return false;
+      }
+      preferences.putUInt(key, discoveryHashes[i]);
+      nextDiscovery++;
+      return true;
+    }
+    return true;
+  }
+
+  bool sendDataMessage() {
+    char statusTopic[64];
+    getStatusTopic(statusTopic);
+
+    char tsKey[32];
+    payload.clear();
+    bool anyUpdate = false;
+    for (int i = 0; i < sensorCount; i++) {
+      hassSensor sensor = sensors[i];
+      if (sensor.valueCount > 0) {
+        payload[sensor.id] = sensor.value;
+        if (sensor.firstTimestamp != 0) {
+          // Midpoint of the averaging window, in ms since the epoch
+          sprintf(tsKey, "%s_ts", sensor.id);
+          payload[tsKey] = (sensor.firstTimestamp / 2 + sensor.lastTimestamp / 2) / 1000;
+        }
+        anyUpdate = true;
+      }
+    }
+
+    if (!anyUpdate) {
+      return true;
+    }
+
+    // Both buffers are sized for every sensor, so this only trips if that
+    // sizing is wrong; better to skip an update than publish cut-off JSON
+    if (message == NULL || payload.overflowed() || measureJson(payload) >= messageSize) {
+      return false;
+    }
+    serializeJson(payload, message, messageSize);
+    bool ok = mqtt->sendMessage(statusTopic, message);
+    if (ok) {
+      for (int i = 0; i < sensorCount; i++) {
+        hassSensor sensor = sensors[i];
+        sensor.valueCount = 0;
+        sensors[i] = sensor;
+      }
+    }
+    return ok;
+  }
+
+ private:
+  // Serializes every discovery document once and fingerprints it with
+  // its topic, so a renamed device or changed sensor is re-announced
+  void buildDiscoveryCache() {
     char statusTopic[64];
     char discoveryTopic[64];
     char valTpl[64];
-    char device_id[16];
+    char attrTpl[96];
     char id[64];
     char name[64];
     getStatusTopic(statusTopic);
-    getUniqueId(device_id);
+    preferences.begin("hass", false);
 
     for (int i = 0; i < sensorCount; i++) {
       hassSensor sensor = sensors[i];
@@ -99,15 +186,25 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
       sprintf(id, "%s_%s", deviceName, sensor.id);
       sprintf(name, "%s %s", deviceName, sensor.name);
       sprintf(valTpl, "{{ value_json.%s | is_defined }}", sensor.id);
+      sprintf(attrTpl, "{{ {'acquired_ms': value_json.%s_ts | default(0)} | tojson }}", sensor.id);
 
       payload.clear();
       payload["name"] = name;
       payload["uniq_id"] = id;
       payload["stat_t"] = statusTopic;
-      payload["dev_cla"] = sensor.deviceClass;
+      if (sensor.deviceClass != NULL) {
+        payload["dev_cla"] = sensor.deviceClass;
+      }
       payload["val_tpl"] = valTpl;
       payload["unit_of_meas"] = sensor.unit;
       payload["force_update"] = true;
+      if (sensor.diagnostic) {
+        payload["ent_cat"] = "diagnostic";
+      }
+      // Acquisition time rides along as an attribute, which the influxdb
+      // integration stores as a field next to the value
+      payload["json_attr_t"] = statusTopic;
+      payload["json_attr_tpl"] = attrTpl;
 
       JsonObject device = payload.createNestedObject("device");
       device["name"] = deviceName;
@@ -119,46 +216,42 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
       JsonArray identifiers = device.createNestedArray("identifiers");
       identifiers.add(deviceName);
 
-      serializeJson(payload, message);
-      bool ok = mqtt->sendMessage(discoveryTopic, message);
-      if (!ok) {
-        return false;
-      }
+      serializeJson(payload, discoveryCache[i], HASS_DISCOVERY_SIZE);
+      discoveryHashes[i] = hash(discoveryCache[i], hash(discoveryTopic));
     }
-    return true;
+    discoveryCached = true;
   }
 
-  bool sendDataMessage() {
-    char statusTopic[64];
-    getStatusTopic(statusTopic);
-
-    payload.clear();
-    bool anyUpdate = false;
-    for (int i = 0; i < sensorCount; i++) {
-      hassSensor sensor = sensors[i];
-      if (sensor.valueCount > 0) {
-        payload[sensor.id] = sensor.value;
-        anyUpdate = true;
-      }
+  // FNV-1a, chained through the seed
+  static uint32_t hash(const char* str, uint32_t seed = 2166136261UL) {
+    uint32_t h = seed;
+    while (*str) {
+      h ^= (uint8_t)*str++;
+      h *= 16777619UL;
     }
+    // 0 is what an empty preferences slot reads as
+    return h == 0 ? 1 : h;
+  }
 
-    if (!anyUpdate) {
-      return true;
+  // Each sensor adds its value and its copied <id>_ts key
+  static size_t payloadCapacity(const hassSensor* sensors, int count) {
+    size_t size = JSON_OBJECT_SIZE(2 * count);
+    for (int i = 0; i < count; i++) {
+      size += JSON_STRING_SIZE(strlen(sensors[i].id) + 3);
     }
+    return size;
+  }
 
-    serializeJson(payload, message);
-    bool ok = mqtt->sendMessage(statusTopic, message);
-    if (ok) {
-      for (int i = 0; i < sensorCount; i++) {
-        hassSensor sensor = sensors[i];
-        sensor.valueCount = 0;
-        sensors[i] = sensor;
-      }
+  // "<id>":<float>,"<id>_ts":<int64>, with room for the longest float and
+  // int64 ArduinoJson prints
+  static size_t messageCapacity(const hassSensor* sensors, int count) {
+    size_t size = 3;  // Braces and terminator
+    for (int i = 0; i < count; i++) {
+      size += 2 * strlen(sensors[i].id) + 11 + 24 + 20;
     }
-    return ok;
+    return size;
   }
 
- private:
   void getDiscoveryTopic(char* topic, const char* sensorId) {
     sprintf(topic, "homeassistant/sensor/%s/%s/config", deviceName, sensorId);
   }
@@ -177,7 +270,13 @@ class HomeAssistantTask : public Task, public TSEvents::EventHandler {
   const char* deviceName;
   hassSensor* sensors;
   int sensorCount;
-  StaticJsonDocument<512> payload;
-  char message[512];
-  bool discoveryMessageSent = false;
+  DynamicJsonDocument payload;
+  char* message;
+  size_t messageSize;
+
+  char discoveryCache[HASS_MAX_SENSORS][HASS_DISCOVERY_SIZE];
+  uint32_t discoveryHashes[HASS_MAX_SENSORS];
+  bool discoveryCached = false;
+  int nextDiscovery = 0;
+  Preferences preferences;
 };
\ No newline at end of file
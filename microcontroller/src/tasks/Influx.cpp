@@ -0,0 +1,343 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#define _TASK_OO_CALLBACKS
+#define _TASK_STATUS_REQUEST
+#include <EventHandler.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include "esp32/rom/crc.h"
+#include "esp32/rom/miniz.h"
+#include "events.h"
+#include "tasks/HomeAssistant.cpp"
+
+// Writes every raw sample straight to the InfluxDB v2 write API as line
+// protocol, bypassing the broker and Home Assistant. Enabled by setting
+// influxUrl (e.g. http://<host>:8086 for the infrastructure/ compose stack)
+// along with influxOrg, influxBucket and influxToken in config.json.
+// https://docs.influxdata.com/influxdb/v2/reference/syntax/line-protocol/
+//
+// A POST can block for seconds on a slow or unreachable server, so it runs
+// in its own FreeRTOS task on core 0, away from the control loops on the
+// scheduler core. Lines collect in one buffer while the other is sent, and
+// the scheduler side picks up the result on its next tick.
+//
+// The request is written by hand on one kept-alive WiFiClient, with
+// everything but Content-Length formatted once in OnEnable, so a flush
+// allocates nothing unless the connection has to be made again. Only
+// plain http:// URLs are supported.
+
+#define INFLUX_BUFFER_SIZE 8192
+#define INFLUX_MAX_LINE 96
+#define INFLUX_MAX_RETRIES 4
+#define INFLUX_UPLOAD_STACK 8192
+#define INFLUX_UPLOAD_CORE 0
+#define INFLUX_TIMEOUT_MS 1000  // To connect, and for the response
+
+class InfluxTask : public Task, public TSEvents::EventHandler {
+ public:
+  InfluxTask(Scheduler& s, TSEvents::EventBus& e, const char* _url, const char* _org, const char* _bucket, const char* _token, const char* _deviceName, hassSensor* _sensors, int _sensorCount, int _batchSize = 100, bool _gzip = true, unsigned long _interval = 1 * TASK_SECOND)
+      : Task(_interval, TASK_FOREVER, &s, false),
+        TSEvents::EventHandler(&s, &e) {
+    url = _url;
+    org = _org;
+    bucket = _bucket;
+    token = _token;
+    deviceName = _deviceName;
+    sensors = _sensors;
+    sensorCount = _sensorCount;
+    batchSize = _batchSize;
+    gzip = _gzip;
+  }
+
+  bool OnEnable() {
+    // http://host[:port][/path]
+    const char* start = strncmp(url, "http://", 7) == 0 ? url + 7 : url;
+    const char* path = strchr(start, '/');
+    size_t hostLength = path != NULL ? path - start : strlen(start);
+    strlcpy(host, start, min(hostLength + 1, sizeof(host)));
+    char* colon = strchr(host, ':');
+    port = 80;
+    if (colon != NULL) {
+      *colon = '\0';
+      port = atoi(colon + 1);
+    }
+    snprintf(requestHead, sizeof(requestHead),
+             "POST %s/api/v2/write?org=%s&bucket=%s&precision=ns HTTP/1.1\r\n"
+             "Host: %s:%u\r\n"
+             "Authorization: Token %s\r\n"
+             "Content-Type: text/plain; charset=utf-8\r\n"
+             "Connection: keep-alive\r\n",
+             path != NULL ? path : "", org, bucket, host, port, token);
+    snprintf(linePrefix, sizeof(linePrefix), "mostr,device=%s ", deviceName);
+
+    if (gzip && compressor == NULL) {
+      // The deflate state is ~300kB, so it lives in PSRAM or not at all
+      compressor = (tdefl_compressor*)ps_malloc(sizeof(tdefl_compressor));
+      gzip = compressor != NULL;
+    }
+    if (uploader == NULL) {
+      results = xQueueCreate(1, sizeof(int));
+      xTaskCreatePinnedToCore(uploadLoop, "influx", INFLUX_UPLOAD_STACK, this, 1, &uploader, INFLUX_UPLOAD_CORE);
+    }
+    return true;
+  }
+
+  bool Callback() {
+    int code;
+    if (sending && xQueueReceive(results, &code, 0) == pdTRUE) {
+      sending = false;
+      finished(code);
+    }
+    if (sending || WiFi.status() != WL_CONNECTED) {
+      return true;
+    }
+    if (backoff > 0) {
+      backoff--;
+      return true;
+    }
+    // Flush on every tick; batchSize only forces an early one from HandleEvent.
+    // A batch that failed is retried before the next one goes.
+    if (sendLineCount == 0) {
+      if (lineCount == 0) {
+        return true;
+      }
+      swap();
+    }
+    sending = true;
+    xTaskNotifyGive(uploader);
+    return true;
+  }
+
+  void HandleEvent(TSEvents::Event event) {
+    for (int i = 0; i < sensorCount; i++) {
+      if (sensors[i].eventId == event.id) {
+        append(sensors[i].id, (SensorReading*)event.data);
+      }
+    }
+    if (lineCount >= batchSize && backoff == 0) {
+      forceNextIteration();
+    }
+  }
+
+  uint32_t getLinesWritten() { return linesWritten; }
+  uint32_t getLinesDropped() { return linesDropped; }
+  uint32_t getFailedPosts() { return failedPosts; }
+
+ private:
+  void append(const char* field, SensorReading* reading) {
+    char* buffer = buffers[filling];
+    if (length + INFLUX_MAX_LINE > INFLUX_BUFFER_SIZE) {
+      linesDropped++;
+      return;
+    }
+    int n;
+    if (reading->timestamp != 0) {
+      n = snprintf(buffer + length, INFLUX_MAX_LINE, "%s%s=%g %lld000\n", linePrefix, field, reading->value, reading->timestamp);
+    } else {
+      // Unsynchronised clock, let the server stamp it
+      n = snprintf(buffer + length, INFLUX_MAX_LINE, "%s%s=%g\n", linePrefix, field, reading->value);
+    }
+    if (n <= 0 || n >= INFLUX_MAX_LINE) {
+      linesDropped++;
+      return;
+    }
+    length += n;
+    lineCount++;
+  }
+
+  static void uploadLoop(void* self) {
+    InfluxTask* task = (InfluxTask*)self;
+    while (true) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      int code = task->post();
+      xQueueOverwrite(task->results, &code);
+    }
+  }
+
+  // Hands the lines collected so far over for sending
+  void swap() {
+    filling = 1 - filling;
+    sendLength = length;
+    sendLineCount = lineCount;
+    length = 0;
+    lineCount = 0;
+  }
+
+  // On the upload task, only touches the buffer not being filled
+  int post() {
+    const uint8_t* body = (const uint8_t*)buffers[1 - filling];
+    size_t bodyLength = sendLength;
+    bool compressed = gzip && compress(body, &bodyLength);
+    if (compressed) {
+      body = gzipBuffer;
+    }
+
+    if (!client.connected() && !client.connect(host, port, INFLUX_TIMEOUT_MS)) {
+      return -1;
+    }
+    char headTail[80];
+    int n = snprintf(headTail, sizeof(headTail), "%sContent-Length: %u\r\n\r\n", compressed ? "Content-Encoding: gzip\r\n" : "", (unsigned)bodyLength);
+    client.write((const uint8_t*)requestHead, strlen(requestHead));
+    client.write((const uint8_t*)headTail, n);
+    client.write(body, bodyLength);
+
+    int code = readResponse();
+    if (code < 0) {
+      client.stop();  // Lost track of the stream, start the next one afresh
+    }
+    return code;
+  }
+
+  // Returns the status code, or -1 if the response didn't come in time or
+  // couldn't be followed. Reads the body too, so the connection can be
+  // used again.
+  int readResponse() {
+    uint32_t deadline = millis() + INFLUX_TIMEOUT_MS;
+    char line[128];
+    if (!readLine(line, sizeof(line), deadline) || strncmp(line, "HTTP/1.", 7) != 0) {
+      return -1;
+    }
+    int code = atoi(line + 9);
+    long contentLength = 0;
+    bool close = false;
+    while (true) {
+      if (!readLine(line, sizeof(line), deadline)) {
+        return -1;
+      }
+      if (line[0] == '\0') {
+        break;
+      }
+      if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        contentLength = atol(line + 15);
+      } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+        return -1;  // Chunked, not worth following for an error body
+      } else if (strncasecmp(line, "Connection: close", 17) == 0) {
+        close = true;
+      }
+    }
+    while (contentLength > 0) {
+      if (client.available() > 0) {
+        client.read();
+        contentLength--;
+      } else if ((int32_t)(millis() - deadline) > 0 || !client.connected()) {
+        return -1;
+      } else {
+        vTaskDelay(1);
+      }
+    }
+    if (close) {
+      client.stop();
+    }
+    return code;
+  }
+
+  // One line without its CRLF, cut to size
+  bool readLine(char* line, size_t size, uint32_t deadline) {
+    size_t n = 0;
+    while (true) {
+      if (client.available() > 0) {
+        char c = client.read();
+        if (c == '\n') {
+          line[n] = '\0';
+          return true;
+        }
+        if (c != '\r' && n < size - 1) {
+          line[n++] = c;
+        }
+      } else if ((int32_t)(millis() - deadline) > 0 || !client.connected()) {
+        return false;
+      } else {
+        vTaskDelay(1);
+      }
+    }
+  }
+
+  void finished(int code) {
+    if (code == 204) {
+      linesWritten += sendLineCount;
+      clear();
+      return;
+    }
+
+    failedPosts++;
+    if (code >= 400 && code < 500 && code != 429) {
+      // The server will never accept this batch, don't retry it
+      retries = INFLUX_MAX_RETRIES;
+    }
+    if (++retries > INFLUX_MAX_RETRIES) {
+      linesDropped += sendLineCount;
+      clear();
+      return;
+    }
+    backoff = 1 << retries;
+  }
+
+  // Wraps outLength bytes of lines as a gzip member: header, raw deflate,
+  // CRC32 and size
+  bool compress(const uint8_t* lines, size_t* outLength) {
+    size_t linesLength = *outLength;
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    memcpy(gzipBuffer, header, sizeof(header));
+
+    tdefl_init(compressor, NULL, NULL, 128 | TDEFL_GREEDY_PARSING_FLAG);
+    size_t inLength = linesLength;
+    size_t deflated = INFLUX_BUFFER_SIZE - sizeof(header) - 8;
+    tdefl_status status = tdefl_compress(compressor, lines, &inLength, gzipBuffer + sizeof(header), &deflated, TDEFL_FINISH);
+    if (status != TDEFL_STATUS_DONE || inLength != linesLength) {
+      return false;
+    }
+
+    uint8_t* trailer = gzipBuffer + sizeof(header) + deflated;
+    uint32_t crc = crc32_le(0, lines, linesLength);
+    for (int i = 0; i < 4; i++) {
+      trailer[i] = crc >> (8 * i);
+      trailer[4 + i] = linesLength >> (8 * i);
+    }
+    *outLength = sizeof(header) + deflated + 8;
+    return true;
+  }
+
+  void clear() {
+    sendLineCount = 0;
+    retries = 0;
+    backoff = 0;
+  }
+
+  const char* url;
+  const char* org;
+  const char* bucket;
+  const char* token;
+  const char* deviceName;
+  hassSensor* sensors;
+  int sensorCount;
+  int batchSize;
+  bool gzip;
+
+  char host[64];
+  uint16_t port;
+  char requestHead[384];
+  char linePrefix[48];
+
+  char buffers[2][INFLUX_BUFFER_SIZE];
+  int filling = 0;
+  size_t length = 0;  // Of the buffer being filled
+  int lineCount = 0;
+  size_t sendLength = 0;  // Of the other one
+  int sendLineCount = 0;
+  uint8_t gzipBuffer[INFLUX_BUFFER_SIZE];
+  int retries = 0;
+  int backoff = 0;
+
+  uint32_t linesWritten = 0;
+  uint32_t linesDropped = 0;
+  uint32_t failedPosts = 0;
+
+  TaskHandle_t uploader = NULL;
+  QueueHandle_t results = NULL;
+  bool sending = false;  // A batch is with the upload task
+
+  tdefl_compressor* compressor = NULL;
+  WiFiClient client;  // Only used by the upload task
+};
@@ -7,21 +7,25 @@
 #include <EventHandler.h>
 #include <PubSubClient.h>
 #include <TaskSchedulerDeclarations.h>
-#include <WiFiUdp.h>
 
 #include "events.h"
 
+#define MQTT_MAX_SUBSCRIPTIONS 4
+
+// topic and payload are only valid for the duration of the call
+typedef void (*MQTTMessageHandler)(const char* topic, const char* payload);
+
 class MQTTTask : public Task, public TSEvents::EventHandler {
  public:
   MQTTTask(Scheduler& s, TSEvents::EventBus& e, const char* domain, const int port, const char* _id)
       : Task(1 * TASK_SECOND, TASK_FOREVER, &s, false),
         TSEvents::EventHandler(&s, &e) {
-    wifiClient = new WiFiClient();
-    client = new PubSubClient(*wifiClient);
-    client->setServer(domain, port);
-    client->setBufferSize(1024);
+    client.setClient(wifiClient);
+    client.setServer(domain, port);
+    client.setBufferSize(1024);
     id = _id;
     state = DISCONNECTED;
+    client.setCallback([this](char* topic, uint8_t* payload, unsigned int length) { onMessage(topic, payload, length); });
   }
 
   bool OnEnable() {
@@ -31,8 +35,8 @@ class MQTTTask : public Task, public TSEvents::EventHandler {
   bool Callback() {
     switch (state) {
       case CONNECTED:
-        if (client->connected()) {
-          client->loop();
+        if (client.connected()) {
+          client.loop();
         } else {
           // connection lost
           state = DISCONNECTED;
@@ -68,21 +72,45 @@ class MQTTTask : public Task, public TSEvents::EventHandler {
 
   bool connect() {
     enableIfNot();
-    bool ok = client->connect(id);
+    bool ok = client.connect(id);
     if (!ok) {
       dispatch(MQTT_SERVER_CONNECT_FAILED);
       return false;
     }
     state = CONNECTED;
+    for (int i = 0; i < subscriptionCount; i++) {
+      client.subscribe(subscriptions[i].topic);
+    }
     dispatch(MQTT_SERVER_CONNECTED);
     return true;
   }
 
-  bool sendMessage(const char* topic, const char* payload) {
+  // Kept across reconnects. Wildcards are allowed, topic must outlive the task.
+  bool subscribe(const char* topic, MQTTMessageHandler handler) {
+    if (subscriptionCount >= MQTT_MAX_SUBSCRIPTIONS) {
+      return false;
+    }
+    subscriptions[subscriptionCount++] = {topic, handler};
+    if (state == CONNECTED) {
+      client.subscribe(topic);
+    }
+    return true;
+  }
+
+  bool sendMessage(const char* topic, const char* payload, bool retained = false) {
     if (state != CONNECTED) {
       return false;
     }
-    return client->publish(topic, payload);
+    return client.publish(topic, payload, retained);
+  }
+
+  // Grows the publish buffer to fit a payload of this size, on a topic of up
+  // to 64 characters plus the MQTT header
+  void reservePayload(size_t size) {
+    size_t needed = size + 64 + 8;
+    if (needed > client.getBufferSize()) {
+      client.setBufferSize(needed);
+    }
   }
 
   bool isConnected() {
@@ -90,12 +118,57 @@ class MQTTTask : public Task, public TSEvents::EventHandler {
   }
 
  private:
+  typedef struct {
+    const char* topic;
+    MQTTMessageHandler handler;
+  } Subscription;
+
+  // Called from client.loop(), i.e. on the scheduler
+  void onMessage(char* topic, uint8_t* payload, unsigned int length) {
+    char text[128];
+    if (length >= sizeof(text)) {
+      return;
+    }
+    memcpy(text, payload, length);
+    text[length] = '\0';
+    for (int i = 0; i < subscriptionCount; i++) {
+      if (topicMatches(subscriptions[i].topic, topic)) {
+        subscriptions[i].handler(topic, text);
+      }
+    }
+  }
+
+  // Supports a trailing '#' and single level '+' wildcards
+  static bool topicMatches(const char* filter, const char* topic) {
+    while (*filter) {
+      if (*filter == '#') {
+        return true;
+      }
+      if (*filter == '+') {
+        while (*topic && *topic != '/') {
+          topic++;
+        }
+        filter++;
+        continue;
+      }
+      if (*filter != *topic) {
+        return false;
+      }
+      filter++;
+      topic++;
+    }
+    return *topic == '\0';
+  }
+
+  Subscription subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+  int subscriptionCount = 0;
+
   enum State {
     CONNECTED,
     DISCONNECTED,
   };
-  WiFiClient* wifiClient;
-  PubSubClient* client;
+  WiFiClient wifiClient;
+  PubSubClient client;
   const char* id;
   State state;
 };
\ No newline at end of file
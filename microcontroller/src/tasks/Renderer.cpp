@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #define _TASK_OO_CALLBACKS
 #define _TASK_STATUS_REQUEST
@@ -8,6 +10,11 @@
 #include <assets/Regular 400.h>
 #include <events.h>
 
+#include "glyph_atlas.h"
+#include "tasks/Diagnostics.cpp"
+#include "tasks/HBridge.cpp"
+#include "trend_history.h"
+
 enum class IndicatorState : unsigned char {
   OFF = 0,
   WARN,
@@ -22,7 +29,7 @@ enum class IndicatorType : unsigned char {
 
 typedef struct RenderState {
   float FlowSensor1Data;
-  double Encoder1Data;
+  float Encoder1Data;
   uint16_t AngleSensor1Data;
   uint16_t AngleSensor2Data;
   float waterTemp;
@@ -36,66 +43,143 @@ typedef struct RenderState {
 
 static const RenderState defaultRenderState = {};
 
+enum class View : unsigned char {
+  VALUES = 0,
+  TREND,
+  DIAGNOSTICS,  // Hidden, hold the header
+};
+
+typedef struct {
+  const char* name;
+  EventType event;
+  float min;  // Initial plot range, widened when the data leaves it
+  float max;
+} TrendSeries;
+
+static const TrendSeries trendSeries[] = {
+    {"T/C Temp (C)", THERMOCOUPLE_DATA, 15, 30},
+    {"Cond-Sens (ms/cm)", CONDUCT_SENSOR_DATA, 0, 5},
+    {"Tap Inflow (L/min)", FLOW_SENSOR_1_DATA, 0, 2},
+    {"Stirrer Act (rpm)", ENCODER_1_DATA, 0, 400},
+};
+#define TREND_SERIES_COUNT (int)(sizeof(trendSeries) / sizeof(TrendSeries))
+
 class RendererTask : public Task, public TSEvents::EventHandler {
  public:
-  RendererTask(Scheduler& s, TSEvents::EventBus& e, const char* _deviceId, const char* _version)
-      : Task(100 * TASK_MILLISECOND, TASK_FOREVER, &s, false),
-        TSEvents::EventHandler(&s, &e) {
+  // Events only update the pending state; the screen is redrawn from it at
+  // a fixed frame rate, however fast the sensors report
+  RendererTask(Scheduler& s, TSEvents::EventBus& e, const char* _deviceId, const char* _version, int _fps = 10)
+      : Task(TASK_SECOND / constrain(_fps, 1, 50), TASK_FOREVER, &s, false),
+        TSEvents::EventHandler(&s, &e),
+        viewBtn(0, 0, 320, 25),
+        seriesBtn(CHART_X, CHART_Y, CHART_W, CHART_H),
+        autotuneBtn(0, AUTOTUNE_BAR_Y, 320, 240 - AUTOTUNE_BAR_Y),
+        chart(&M5.Lcd) {
     lastRenderState = defaultRenderState;
+    renderState = defaultRenderState;
   }
 
   bool OnEnable() {
     M5.Lcd.begin();
+    atlas.build(&FreeSansBold9pt7b);
+
+    // Trend history and the plot itself are too big for internal RAM
+    if (trendStorage == NULL) {
+      trendStorage = (TrendColumn*)ps_malloc(TREND_SERIES_COUNT * CHART_W * sizeof(TrendColumn));
+      for (int i = 0; i < TREND_SERIES_COUNT; i++) {
+        trends[i].begin(trendStorage == NULL ? NULL : trendStorage + i * CHART_W, CHART_W, TREND_COLUMN_MS);
+      }
+      chartReady = trendStorage != NULL && chart.createSprite(CHART_W, CHART_H) != NULL;
+    }
     initialRender();
     return true;
   }
 
   bool Callback() {
     M5.update();
+    if (diagnostics != NULL && view != View::DIAGNOSTICS && viewBtn.pressedFor(DIAGNOSTICS_HOLD_MS)) {
+      view = View::DIAGNOSTICS;
+      startDiagnostics();
+      return true;
+    }
+    if (viewBtn.wasPressed() && (chartReady || view != View::VALUES)) {  // Tap the header to switch views
+      if (view == View::VALUES) {
+        view = View::TREND;
+        startTrend();
+      } else {
+        view = View::VALUES;
+        initialRender();
+      }
+      return true;
+    }
+    if (view == View::TREND) {
+      if (seriesBtn.wasPressed()) {  // Tap the plot for the next sensor
+        selectedSeries = (selectedSeries + 1) % TREND_SERIES_COUNT;
+        startTrend();
+      }
+      renderTrend();
+    } else if (view == View::DIAGNOSTICS) {
+      if (stirrer != NULL && autotuneBtn.wasPressed()) {  // Tap the bottom bar to tune the stirrer
+        const char* error = stirrer->startAutotune(AUTOTUNE_STEP);
+        snprintf(autotuneText, sizeof(autotuneText), "%s", error != NULL ? error : "");
+      }
+      renderDiagnostics();
+      renderAutotune();
+    } else {
+      render(renderState);
+    }
     return true;
   }
 
   void HandleEvent(TSEvents::Event event) {
-    RenderState renderState = lastRenderState;
     switch ((EventType)event.id) {
       case SERIAL_DATA:
         renderState.AngleSensor1Data = *(uint16_t*)event.data;
-        render(renderState);
         break;
 
       case ANGLE_SENSOR_1_DATA:
         renderState.AngleSensor1Data = *(uint16_t*)event.data * 380 / 4096; // 380 is the rpm limit
-        render(renderState);
         break;
       case ANGLE_SENSOR_2_DATA:
         renderState.AngleSensor2Data = *(uint16_t*)event.data;
-        render(renderState);
         break;
       case FLOW_SENSOR_1_DATA:  // Inflow
-        renderState.FlowSensor1Data = *(float*)event.data;
-        render(renderState);
+        renderState.FlowSensor1Data = ((SensorReading*)event.data)->value;
         break;
       case THERMOCOUPLE_DATA:
-        renderState.waterTemp = *(float*)event.data;
-        render(renderState);
+        renderState.waterTemp = ((SensorReading*)event.data)->value;
         break;
       case CONDUCT_SENSOR_DATA:
-        renderState.conductTemp = *(float*)event.data;
-        render(renderState);
+        renderState.conductTemp = ((SensorReading*)event.data)->value;
         break;
       case ENCODER_1_DATA:  // Stirrer
-        renderState.Encoder1Data = *(double*)event.data;
-        render(renderState);
+        renderState.Encoder1Data = ((SensorReading*)event.data)->value;
         break;
       case I2C_HUB_CONNECTED:
         renderState.setIndicator(IndicatorType::I2C, IndicatorState::OK);
-        render(renderState);
         break;
       case I2C_HUB_ERROR:
         renderState.setIndicator(IndicatorType::I2C, IndicatorState::ERROR);
-        render(renderState);
         break;
     }
+
+    for (int i = 0; i < TREND_SERIES_COUNT; i++) {
+      if (trendSeries[i].event == event.id) {
+        bool closed = trends[i].add(((SensorReading*)event.data)->value, millis());
+        if (closed && view == View::TREND && i == selectedSeries) {
+          trendColumnPending = true;
+        }
+      }
+    }
+  }
+
+  void setDiagnostics(DiagnosticsTask* _diagnostics) {
+    diagnostics = _diagnostics;
+  }
+
+  // Stirrer to autotune from the diagnostics view
+  void setAutotune(HBridgeTask* _stirrer) {
+    stirrer = _stirrer;
   }
 
   void initialRender() {  // screen size is 320 x 240 pixels
@@ -165,6 +249,9 @@ class RendererTask : public Task, public TSEvents::EventHandler {
     M5.Lcd.println("00.00");
     M5.Lcd.setCursor(232, 211);  // Conductivity Sensor
     M5.Lcd.println("00.00");
+
+    // Everything on screen is the placeholder now, redraw any real values
+    lastRenderState = defaultRenderState;
   }
 
   void render(RenderState newState) {
@@ -186,9 +273,6 @@ class RendererTask : public Task, public TSEvents::EventHandler {
     if (newState.Encoder1Data != lastRenderState.Encoder1Data) {  // Stirrer
       renderEncoder1Data(newState.Encoder1Data);
     }
-    if (newState.waterTemp != lastRenderState.waterTemp) {  // Thermocouple
-      renderWaterTemp(newState.waterTemp);
-    }
     lastRenderState = newState;
   }
 
@@ -196,61 +280,238 @@ class RendererTask : public Task, public TSEvents::EventHandler {
   static const uint16_t COL_BG = TFT_BLACK;
   static const uint16_t COL_FG = TFT_WHITE;
 
+  // Value fields are the 70x25 boxes at x=220, text baseline 18px down
+  static const int FIELD_X = 220;
+  static const int FIELD_W = 70;
+  static const int FIELD_H = 25;
+
+  // Composes the whole field off-screen from cached glyphs and pushes it in
+  // one go, so the display never shows the cleared box
+  void renderField(int y, uint16_t color, const char* text) {
+    for (int i = 0; i < FIELD_W * FIELD_H; i++) {
+      field[i] = COL_BG;
+    }
+    atlas.draw(field, FIELD_W, FIELD_H, 12, 18, text, color);
+    M5.Lcd.setSwapBytes(true);
+    M5.Lcd.pushImage(FIELD_X, y, FIELD_W, FIELD_H, field);
+  }
+
+  // Trend view: a 300x200 plot of one sensor, one column per TREND_COLUMN_MS
+  static const int CHART_X = 10;
+  static const int CHART_Y = 30;
+  static const int CHART_W = 300;
+  static const int CHART_H = 200;
+  static const uint32_t TREND_COLUMN_MS = 2000;
+  static const int REBUILD_COLUMNS_PER_FRAME = 50;
+  static const uint16_t COL_GRID = 0x4208;
+
+  // Diagnostics view: one row per FreeRTOS task, redrawn when
+  // DiagnosticsTask takes a new sample
+  static const uint32_t DIAGNOSTICS_HOLD_MS = 2000;
+  static const int DIAGNOSTICS_ROWS = 16;
+  static const int AUTOTUNE_BAR_Y = 218;
+
+  void startDiagnostics() {
+    M5.Lcd.fillRect(0, 0, 320, 240, COL_BG);
+    M5.Lcd.fillRect(0, 0, 320, 25, YELLOW);
+    M5.Lcd.setFont(&FreeSansBold9pt7b);
+    M5.Lcd.setTextColor(BLACK);
+    M5.Lcd.setCursor(10, 18);
+    M5.Lcd.print("Diagnostics");
+    diagnosticsSample = diagnostics->getSamples() - 1;
+    autotuneText[0] = '\0';
+    autotuneShown[0] = '\1';  // Differs from any text, so the bar is drawn
+  }
+
+  void renderDiagnostics() {
+    if (diagnostics->getSamples() == diagnosticsSample) {
+      return;
+    }
+    diagnosticsSample = diagnostics->getSamples();
+
+    // The built-in 6x8 font draws its own background, so rows overwrite
+    // the previous sample without clearing
+    M5.Lcd.setTextFont(1);
+    M5.Lcd.setTextColor(COL_FG, COL_BG);
+    M5.Lcd.setCursor(4, 30);
+    M5.Lcd.printf("heap %6u free %6u block  cpu %5.1f%% %5.1f%%", heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                  heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL), diagnostics->getCoreLoad(0), diagnostics->getCoreLoad(1));
+    M5.Lcd.setCursor(4, 44);
+    M5.Lcd.printf("%-16s %4s %10s %8s", "task", "core", "stack free", "cpu %");
+    int count = diagnostics->getTaskCount();
+    for (int row = 0; row < DIAGNOSTICS_ROWS; row++) {
+      M5.Lcd.setCursor(4, 56 + row * 10);
+      if (row >= count) {
+        M5.Lcd.printf("%-51s", "");
+        continue;
+      }
+      if (row == DIAGNOSTICS_ROWS - 1 && count > DIAGNOSTICS_ROWS) {
+        // The rest are in the stats serial command
+        M5.Lcd.printf("%-51s", "");
+        M5.Lcd.setCursor(4, 56 + row * 10);
+        M5.Lcd.printf("+ %d more tasks, see stats", count - row);
+        continue;
+      }
+      const DiagnosticsTaskInfo& task = diagnostics->getTask(row);
+      M5.Lcd.printf("%-16s %4d %10u %8.1f", task.name, task.core, task.stackFree, task.cpu);
+    }
+  }
+
+  // The bottom bar of the diagnostics view: how the stirrer autotune is
+  // going, or an invitation to start one. A failure to start stays up until
+  // the next tap.
+  void renderAutotune() {
+    if (stirrer == NULL) {
+      return;
+    }
+    const RelayAutotuner& tuner = stirrer->getAutotuner();
+    char text[sizeof(autotuneText)];
+    if (tuner.isRunning()) {
+      snprintf(text, sizeof(text), "autotune: cycle %d, %lu s", tuner.getCycles(), tuner.getElapsedUs(micros()) / 1000000);
+    } else if (autotuneText[0] != '\0') {
+      snprintf(text, sizeof(text), "%s", autotuneText);
+    } else if (tuner.getState() == AUTOTUNE_DONE) {
+      snprintf(text, sizeof(text), "autotune done: Ku %.2f, Tu %.2f s", tuner.getUltimateGain(), tuner.getUltimatePeriod());
+    } else if (tuner.getState() == AUTOTUNE_FAILED) {
+      snprintf(text, sizeof(text), "autotune failed: %s", tuner.getError());
+    } else {
+      snprintf(text, sizeof(text), "tap here to autotune the stirrer");
+    }
+    if (strcmp(text, autotuneShown) == 0) {
+      return;
+    }
+    strlcpy(autotuneShown, text, sizeof(autotuneShown));
+    M5.Lcd.fillRect(0, AUTOTUNE_BAR_Y, 320, 240 - AUTOTUNE_BAR_Y, COL_GRID);
+    M5.Lcd.setTextFont(1);
+    M5.Lcd.setTextColor(COL_FG, COL_GRID);
+    M5.Lcd.setCursor(4, AUTOTUNE_BAR_Y + 7);
+    M5.Lcd.print(text);
+  }
+
+  // Clears the plot and starts redrawing it from history. The redraw is
+  // spread over several frames by renderTrend() so a view switch never
+  // holds up the scheduler.
+  void startTrend() {
+    const TrendSeries& series = trendSeries[selectedSeries];
+    const TrendHistory& history = trends[selectedSeries];
+    trendMin = series.min;
+    trendMax = series.max;
+    for (int i = 0; i < history.size(); i++) {
+      trendMin = min(trendMin, history.at(i).min);
+      trendMax = max(trendMax, history.at(i).max);
+    }
+    float margin = (trendMax - trendMin) * 0.05;
+    if (trendMin < series.min) {
+      trendMin -= margin;
+    }
+    if (trendMax > series.max) {
+      trendMax += margin;
+    }
+
+    M5.Lcd.fillRect(0, 0, 320, 240, COL_BG);
+    M5.Lcd.fillRect(0, 0, 320, 25, YELLOW);
+    M5.Lcd.setFont(&FreeSansBold9pt7b);
+    M5.Lcd.setTextColor(BLACK);
+    M5.Lcd.setCursor(10, 18);
+    M5.Lcd.print(series.name);
+    M5.Lcd.setFont(&FreeSans8pt7b);
+    M5.Lcd.setTextColor(WHITE);
+    M5.Lcd.setCursor(CHART_X, CHART_Y + CHART_H + 8);
+    M5.Lcd.printf("%.2f - %.2f, %d min", trendMin, trendMax, (int)(CHART_W * TREND_COLUMN_MS / 60000));
+
+    chart.fillSprite(COL_BG);
+    for (int i = 1; i < 4; i++) {
+      chart.drawFastHLine(0, CHART_H * i / 4, CHART_W, COL_GRID);
+    }
+    rebuildColumn = 0;
+    rebuildCount = history.size();
+    trendColumnPending = false;
+  }
+
+  void renderTrend() {
+    const TrendHistory& history = trends[selectedSeries];
+    if (rebuildColumn >= 0) {
+      for (int n = 0; n < REBUILD_COLUMNS_PER_FRAME && rebuildColumn < rebuildCount; n++, rebuildColumn++) {
+        drawTrendColumn(CHART_W - rebuildCount + rebuildColumn, history.at(rebuildColumn));
+      }
+      if (rebuildColumn >= rebuildCount) {
+        rebuildColumn = -1;
+        chart.pushSprite(CHART_X, CHART_Y);
+      }
+      return;
+    }
+    if (!trendColumnPending) {
+      return;
+    }
+    trendColumnPending = false;
+
+    const TrendColumn& column = history.latest();
+    if (column.min < trendMin || column.max > trendMax) {
+      startTrend();  // Out of range, rescale
+      return;
+    }
+    // Only the newest column is drawn, the rest of the plot just moves left
+    chart.scroll(-1, 0);
+    drawTrendColumn(CHART_W - 1, column);
+    chart.pushSprite(CHART_X, CHART_Y);
+  }
+
+  void drawTrendColumn(int x, const TrendColumn& column) {
+    chart.drawFastVLine(x, 0, CHART_H, COL_BG);
+    for (int i = 1; i < 4; i++) {
+      chart.drawPixel(x, CHART_H * i / 4, COL_GRID);
+    }
+    int top = trendY(column.max);
+    int bottom = trendY(column.min);
+    chart.drawFastVLine(x, top, bottom - top + 1, GREEN);
+  }
+
+  int trendY(float value) {
+    float y = (CHART_H - 1) * (trendMax - value) / (trendMax - trendMin);
+    return constrain((int)y, 0, CHART_H - 1);
+  }
+
   // Thermocouple loop render
   void renderWaterTemp(float waterTemp) {
-    M5.Lcd.fillRect(220, 48, 70, 25, COL_BG);
-    M5.Lcd.setTextColor(RED);
-    M5.Lcd.setCursor(232, 66);  // Temperature
-    M5.Lcd.println(waterTemp, 2);
-    Serial.print("1#");  // hook for the PPEMD for All - https://ppemd4all.uk/
-    Serial.println(waterTemp);
+    char text[16];
+    snprintf(text, sizeof(text), "%.2f", waterTemp);
+    renderField(48, RED, text);  // Temperature
   }
 
   // Flow Sensor 1 loop render - Inflow
   void renderFlowRate1(float FlowSensor1Data) {
-    M5.Lcd.fillRect(220, 77, 70, 25, COL_BG);
-    M5.Lcd.setTextColor(RED);
-    M5.Lcd.setCursor(232, 95);  // Flowrate
-    M5.Lcd.println(FlowSensor1Data);
-    Serial.print("2#");  // hook for the PPEMD for All - https://ppemd4all.uk/
-    Serial.println(FlowSensor1Data);
+    char text[16];
+    snprintf(text, sizeof(text), "%.2f", FlowSensor1Data);
+    renderField(77, RED, text);  // Flowrate
   }
 
   // Angle Sensor 2 loop render - Input Pump Power Set Point
   void renderAngleSensor2Temp(float AngleSensor2Data) {
-    M5.Lcd.fillRect(220, 106, 70, 25, COL_BG);
-    M5.Lcd.setTextColor(WHITE);
-    M5.Lcd.setCursor(232, 124);  // Pump Power
+    char text[16];
     AngleSensor2Data = (AngleSensor2Data / 40.96);
-    M5.Lcd.println(int(AngleSensor2Data));
+    snprintf(text, sizeof(text), "%d", int(AngleSensor2Data));
+    renderField(106, WHITE, text);  // Pump Power
   }
 
   // Angle Sensor 1 loop render - Stirrer set point rpm
   void renderAngleSensor1Temp(float AngleSensor1Data) {
-    M5.Lcd.fillRect(220, 135, 70, 25, COL_BG);
-    M5.Lcd.setTextColor(WHITE);
-    M5.Lcd.setCursor(232, 153);  // Stirrer Set Point
-    M5.Lcd.println(int(AngleSensor1Data));
+    char text[16];
+    snprintf(text, sizeof(text), "%d", int(AngleSensor1Data));
+    renderField(135, WHITE, text);  // Stirrer Set Point
   }
 
   // Encoder 1 loop render - Stirrer
-  void renderEncoder1Data(double Encoder1Data) {
-    M5.Lcd.fillRect(220, 164, 70, 25, COL_BG);  // Stirrer Actual
-    M5.Lcd.setTextColor(RED);
-    M5.Lcd.setCursor(232, 182);  // Stirrer Actual
-    Serial.print("3#");  // hook for the PPEMD for All - https://ppemd4all.uk/
-    Serial.println(int(Encoder1Data));
-    M5.Lcd.println(int(Encoder1Data));
+  void renderEncoder1Data(float Encoder1Data) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", int(Encoder1Data));
+    renderField(164, RED, text);  // Stirrer Actual
   }
 
   // Conducitvity Sensor loop render
   void renderConductTemp(float conductTemp) {
-    M5.Lcd.fillRect(220, 193, 70, 25, COL_BG);  // Conductivity Sensor
-    M5.Lcd.setTextColor(RED);
-    M5.Lcd.setCursor(232, 211);  // Conductivity Sensor
-    M5.Lcd.println(conductTemp, 2);
-    Serial.print("4#");  // hook for the PPEMD for All - https://ppemd4all.uk/
-    Serial.println(conductTemp, 2);
+    char text[16];
+    snprintf(text, sizeof(text), "%.2f", conductTemp);
+    renderField(193, RED, text);  // Conductivity Sensor
   }
 
   void printWithSpacing(const char* str, float spacing) {
@@ -272,4 +533,27 @@ class RendererTask : public Task, public TSEvents::EventHandler {
     printWithSpacing(buffer, spacing);
   }
   RenderState lastRenderState;
+  RenderState renderState;
+  GlyphAtlas atlas;
+  uint16_t field[FIELD_W * FIELD_H];  // Off-screen buffer for one value field
+
+  View view = View::VALUES;
+  DiagnosticsTask* diagnostics = NULL;
+  uint32_t diagnosticsSample = 0;
+  Button viewBtn;
+  Button seriesBtn;
+  Button autotuneBtn;
+  HBridgeTask* stirrer = NULL;
+  char autotuneText[54] = "";  // Set when a tap couldn't start a tune
+  char autotuneShown[54] = "";
+  TFT_eSprite chart;
+  bool chartReady = false;
+  TrendColumn* trendStorage = NULL;
+  TrendHistory trends[TREND_SERIES_COUNT];
+  int selectedSeries = 0;
+  float trendMin;
+  float trendMax;
+  int rebuildColumn = -1;  // Next column to redraw, -1 when the plot is current
+  int rebuildCount = 0;
+  bool trendColumnPending = false;
 };
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #include <FunctionalInterrupt.h>
 #include <M5Tough.h>
@@ -7,68 +9,127 @@
 #include <TaskSchedulerDeclarations.h>
 
 #include "events.h"
+#include "print_format.h"
 
 // command receiver for the PPEMD for All - https://ppemd4all.uk/
+//
+// Lines look like <name>#<args>, e.g. `0#` (identify) or `3#120` (stirrer
+// rpm). They are assembled in a fixed buffer as bytes arrive and matched
+// against a command table, so nothing here touches the heap. Lines longer than
+// the buffer are discarded up to the next newline.
+
+#define SERIAL_LINE_SIZE 96
+#define SERIAL_MAX_COMMANDS 24
+
+// args is everything after the first '#', "" if there is none. It points into
+// the line buffer, so handlers may split it in place.
+typedef void (*SerialCommandHandler)(char* args, Print& out);
+
+typedef struct {
+  const char* name;
+  const char* usage;
+  SerialCommandHandler handler;
+} SerialCommand;
 
 class SerialRecieverTask : public Task, public TSEvents::EventEmitter {
  public:
-  SerialRecieverTask(Scheduler& s, TSEvents::EventBus& e, EventType _event, const char* _deviceName, unsigned long _interval = 1000 * TASK_MILLISECOND)
+  SerialRecieverTask(Scheduler& s, TSEvents::EventBus& e, EventType _event, const char* _deviceName, unsigned long _interval = 1000 * TASK_MILLISECOND, Print& _out = Serial)
       : Task(_interval, TASK_FOREVER, &s, false),
         TSEvents::EventEmitter(&e) {
     deviceName = _deviceName;
     event = _event;
+    out = &_out;
   }
 
   bool OnEnable() {
-    serialBuffer.reserve(256);  // Reserve enough space to avoid frequent reallocations
+    length = 0;
+    overflow = false;
     return true;
   }
 
   bool Callback() {
-    // Read incoming serial data until newline character
     while (Serial.available() > 0) {
       char incomingChar = Serial.read();
-      serialBuffer += incomingChar;
-
       if (incomingChar == '\n') {
-        processBuffer(serialBuffer);
-        serialBuffer = "";
+        if (overflow) {
+          out->println("ERR line too long");
+        } else {
+          line[length] = '\0';
+          processLine(line);
+        }
+        length = 0;
+        overflow = false;
+      } else if (incomingChar == '\r') {
+        continue;
+      } else if (length < SERIAL_LINE_SIZE - 1) {
+        line[length++] = incomingChar;
+      } else {
+        overflow = true;
       }
     }
     return true;
   }
 
+  bool addCommand(const char* name, const char* usage, SerialCommandHandler handler) {
+    if (commandCount >= SERIAL_MAX_COMMANDS) {
+      return false;
+    }
+    commands[commandCount++] = {name, usage, handler};
+    return true;
+  }
+
  private:
   EventType event;
   const char* deviceName;
-  String serialBuffer;
-
-  void processBuffer(const String& buffer) {
-    // Placeholder for processing logic
-    // For example, parsing a command or checking for a specific message
-    // Emit an event if a certain condition is met
-    // if buffer =
-    // dispatch(event, &buffer, sizeof(float));
-    // Emit(event);
-
-    // message will look like <index>#<value>
-    // find the index and value
-    int index = buffer.substring(0, buffer.indexOf("#")).toInt();
-    float value = buffer.substring(buffer.indexOf("#") + 1).toFloat();
-
-    switch (index) {
-      case 0:
-        Serial.print("0#");  // these need to be on for the serial PPMD to work!
-        Serial.println(deviceName);
-        break;
-      case 3:
-        if (value >= 0 && value <= 65535) {
-          uint16_t convertedValue = static_cast<uint16_t>(value);
-          dispatch(event, &convertedValue, sizeof(uint16_t));
-        }
-        break;
-      default:
-        break;
+  Print* out;
+
+  char line[SERIAL_LINE_SIZE];
+  size_t length = 0;
+  bool overflow = false;
+
+  SerialCommand commands[SERIAL_MAX_COMMANDS];
+  int commandCount = 0;
+
+  void processLine(char* buffer) {
+    if (buffer[0] == '\0') {
+      return;
+    }
+    char* args = strchr(buffer, '#');
+    if (args != NULL) {
+      *args++ = '\0';
+    } else {
+      args = buffer + strlen(buffer);
+    }
+
+    // Built in, the PPEMD depends on these
+    if (strcmp(buffer, "0") == 0) {
+      out->print("0#");  // these need to be on for the serial PPMD to work!
+      out->println(deviceName);
+      return;
+    }
+    if (strcmp(buffer, "3") == 0) {
+      char* end;
+      float value = strtof(args, &end);
+      if (end != args && value >= 0 && value <= 65535) {
+        uint16_t convertedValue = static_cast<uint16_t>(value);
+        dispatch(event, &convertedValue, sizeof(uint16_t));
+      }
+      return;
+    }
+    if (strcmp(buffer, "help") == 0) {
+      out->println("0#  3#<rpm>  help");
+      for (int i = 0; i < commandCount; i++) {
+        printFormat(*out, "%s#%s\n", commands[i].name, commands[i].usage);
+      }
+      return;
+    }
+
+    for (int i = 0; i < commandCount; i++) {
+      if (strcmp(buffer, commands[i].name) == 0) {
+        commands[i].handler(args, *out);
+        return;
+      }
     }
+    printFormat(*out, "ERR unknown command %s\n", buffer);
   }
-};
\ No newline at end of file
+};
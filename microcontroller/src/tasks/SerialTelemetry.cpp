@@ -0,0 +1,271 @@
+#pragma once
+
+#include <Arduino.h>
+#define _TASK_OO_CALLBACKS
+#define _TASK_STATUS_REQUEST
+#include <EventHandler.h>
+#include <TaskSchedulerDeclarations.h>
+#include <esp_timer.h>
+
+#include "events.h"
+#include "print_format.h"
+#include "serial_frame.h"
+#include "telemetry.h"
+#include "timesync.h"
+
+// Serial output for the PPEMD for All - https://ppemd4all.uk/
+// Emits `1#<water temp>`, `2#<inflow>`, `3#<stirrer rpm>` and `4#<conductivity>`
+// lines with the latest sensor values every outputInterval. Lines are queued
+// in a ring buffer and only handed to the UART as fast as it has room, so a
+// slow link drops lines instead of stalling the scheduler.
+//
+// The task is also a Print, so command replies can be printed into the same
+// queue without interleaving with the telemetry lines.
+//
+// For bench work the stream can be switched to binary: every sample is sent
+// with its channel and a microsecond timestamp in telemetry.h frames, framed
+// by serial_frame.h, and replies go out as TELEMETRY_TEXT frames. Timestamps
+// are time since boot so they work without WiFi. tools/serial-capture decodes
+// the stream.
+
+#define SERIAL_TX_BUFFER_SIZE 1024
+#define SERIAL_REPLY_SIZE 160
+
+enum SerialStreamMode : uint8_t {
+  SERIAL_STREAM_TEXT,
+  SERIAL_STREAM_BINARY,
+};
+
+class SerialTelemetryTask : public Task, public TSEvents::EventHandler, public Print {
+ public:
+  SerialTelemetryTask(Scheduler& s, TSEvents::EventBus& e, unsigned long _outputInterval = 500, unsigned long _interval = 10 * TASK_MILLISECOND)
+      : Task(_interval, TASK_FOREVER, &s, false),
+        TSEvents::EventHandler(&s, &e) {
+    outputInterval = _outputInterval;
+  }
+
+  bool OnEnable() {
+    lastOutput = millis();
+    return true;
+  }
+
+  bool Callback() {
+    unsigned long start = micros();
+    if (pendingBaud != 0) {
+      changeBaud();
+    } else if (mode == SERIAL_STREAM_BINARY) {
+      sendFrame();
+    } else if (millis() - lastOutput >= outputInterval) {
+      lastOutput = millis();
+      emit();
+    }
+    drain();
+    unsigned long elapsed = micros() - start;
+    busyMicros += elapsed;
+    maxCallbackMicros = max(maxCallbackMicros, elapsed);
+    return true;
+  }
+
+  void HandleEvent(TSEvents::Event event) {
+    switch (event.id) {
+      case THERMOCOUPLE_DATA:
+        waterTemp = ((SensorReading*)event.data)->value;
+        fresh |= FRESH_WATER_TEMP;
+        addSample(TELEMETRY_WATER_TEMP, (SensorReading*)event.data);
+        break;
+      case FLOW_SENSOR_1_DATA:
+        flowRate = ((SensorReading*)event.data)->value;
+        fresh |= FRESH_FLOW_RATE;
+        addSample(TELEMETRY_FLOW_RATE, (SensorReading*)event.data);
+        break;
+      case ENCODER_1_DATA:
+        stirrerRpm = ((SensorReading*)event.data)->value;
+        fresh |= FRESH_STIRRER_RPM;
+        addSample(TELEMETRY_STIRRER_RPM, (SensorReading*)event.data);
+        break;
+      case CONDUCT_SENSOR_DATA:
+        conductivity = ((SensorReading*)event.data)->value;
+        fresh |= FRESH_CONDUCTIVITY;
+        addSample(TELEMETRY_COND_RATE, (SensorReading*)event.data);
+        break;
+    }
+  }
+
+  // Printed text is held until the end of the line and then queued whole
+  size_t write(uint8_t c) {
+    reply[replyLength++] = c;
+    if (c == '\n' || replyLength == SERIAL_REPLY_SIZE - 1) {
+      if (mode == SERIAL_STREAM_BINARY) {
+        reply[replyLength] = '\0';
+        sendFrame();
+        frame.reset(sequence, TELEMETRY_TEXT);
+        frame.setPayload(reply);
+        sendFrame(true);
+      } else {
+        enqueue(reply, replyLength);
+      }
+      replyLength = 0;
+    }
+    return 1;
+  }
+
+  void setOutputInterval(unsigned long _outputInterval) {
+    outputInterval = _outputInterval;
+  }
+
+  // A new baud rate is applied once everything queued has gone out at the
+  // old one, nothing is sampled until then
+  void setStreamMode(SerialStreamMode _mode, unsigned long baud = 0) {
+    sendFrame();
+    mode = _mode;
+    pendingBaud = baud;
+    fresh = 0;
+  }
+
+  SerialStreamMode getStreamMode() {
+    return mode;
+  }
+
+  void printStats(Print& out) {
+    printFormat(out, "serial: %s, %lu bytes sent, %lu dropped, %lu frames, %lu us busy, %lu us max callback, %u queued\n",
+               mode == SERIAL_STREAM_BINARY ? "binary" : "text", bytesSent, bytesDropped, (unsigned long)sequence,
+               busyMicros, maxCallbackMicros, (unsigned)queued());
+  }
+
+ private:
+  enum Fresh : uint8_t {
+    FRESH_WATER_TEMP = 1,
+    FRESH_FLOW_RATE = 2,
+    FRESH_STIRRER_RPM = 4,
+    FRESH_CONDUCTIVITY = 8,
+  };
+
+  // Only values that arrived since the last output are sent again
+  void emit() {
+    char line[24];
+    if (fresh & FRESH_WATER_TEMP) {
+      enqueue(line, snprintf(line, sizeof(line), "1#%.2f\r\n", waterTemp));
+    }
+    if (fresh & FRESH_FLOW_RATE) {
+      enqueue(line, snprintf(line, sizeof(line), "2#%.2f\r\n", flowRate));
+    }
+    if (fresh & FRESH_STIRRER_RPM) {
+      enqueue(line, snprintf(line, sizeof(line), "3#%d\r\n", int(stirrerRpm)));
+    }
+    if (fresh & FRESH_CONDUCTIVITY) {
+      enqueue(line, snprintf(line, sizeof(line), "4#%.2f\r\n", conductivity));
+    }
+    fresh = 0;
+  }
+
+  // Stamped with the time since boot at acquisition, backdated from the
+  // reading's wall clock age when it has one
+  void addSample(uint8_t channel, SensorReading* reading) {
+    if (mode != SERIAL_STREAM_BINARY || pendingBaud != 0) {
+      return;
+    }
+    int64_t uptime = esp_timer_get_time();
+    if (reading->timestamp != 0) {
+      int64_t now = timestampMicros();
+      if (now > reading->timestamp) {
+        uptime -= now - reading->timestamp;
+      }
+    }
+    if (frameRecords == 0) {
+      frame.reset(sequence, TELEMETRY_UPTIME_SAMPLES);
+    }
+    if (!frame.add(channel, uptime, reading->value)) {
+      // Older than the frame's first sample, start a new one
+      sendFrame();
+      frame.reset(sequence, TELEMETRY_UPTIME_SAMPLES);
+      frame.add(channel, uptime, reading->value);
+    }
+    if (++frameRecords == SERIAL_FRAME_MAX_RECORDS) {
+      sendFrame();
+    }
+  }
+
+  // A dropped frame still uses up its sequence number, that's how the
+  // capture tool counts drops
+  void sendFrame(bool text = false) {
+    if (frameRecords == 0 && !text) {
+      return;
+    }
+    size_t n = serialFrameEncode(frame.data(), frame.size(), encoded);
+    if (n > 0) {
+      enqueue((const char*)encoded, n);
+    }
+    sequence++;
+    frameRecords = 0;
+  }
+
+  void changeBaud() {
+    if (queued() > 0) {
+      return;
+    }
+    Serial.flush();
+    Serial.updateBaudRate(pendingBaud);
+    pendingBaud = 0;
+  }
+
+  // Whole lines or nothing, a partial line would corrupt the protocol
+  bool enqueue(const char* data, size_t length) {
+    if (length > SERIAL_TX_BUFFER_SIZE - 1 - queued()) {
+      bytesDropped += length;
+      return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+      txBuffer[head] = data[i];
+      head = (head + 1) % SERIAL_TX_BUFFER_SIZE;
+    }
+    return true;
+  }
+
+  void drain() {
+    while (head != tail) {
+      size_t room = Serial.availableForWrite();
+      if (room == 0) {
+        return;
+      }
+      size_t contiguous = head > tail ? head - tail : SERIAL_TX_BUFFER_SIZE - tail;
+      size_t n = Serial.write((const uint8_t*)txBuffer + tail, min(room, contiguous));
+      tail = (tail + n) % SERIAL_TX_BUFFER_SIZE;
+      bytesSent += n;
+      if (n == 0) {
+        return;
+      }
+    }
+  }
+
+  size_t queued() {
+    return (head - tail + SERIAL_TX_BUFFER_SIZE) % SERIAL_TX_BUFFER_SIZE;
+  }
+
+  unsigned long outputInterval;
+  unsigned long lastOutput = 0;
+
+  float waterTemp = 0;
+  float flowRate = 0;
+  float stirrerRpm = 0;
+  float conductivity = 0;
+  uint8_t fresh = 0;
+
+  char txBuffer[SERIAL_TX_BUFFER_SIZE];
+  size_t head = 0;
+  size_t tail = 0;
+
+  char reply[SERIAL_REPLY_SIZE];
+  size_t replyLength = 0;
+
+  SerialStreamMode mode = SERIAL_STREAM_TEXT;
+  unsigned long pendingBaud = 0;
+  TelemetryFrameBuilder frame;
+  int frameRecords = 0;
+  uint32_t sequence = 0;
+  uint8_t encoded[SERIAL_FRAME_MAX_ENCODED];
+
+  unsigned long bytesSent = 0;
+  unsigned long bytesDropped = 0;
+  unsigned long busyMicros = 0;
+  unsigned long maxCallbackMicros = 0;
+};
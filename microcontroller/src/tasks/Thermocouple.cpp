@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Arduino.h>
 #define _TASK_OO_CALLBACKS
 #define _TASK_STATUS_REQUEST
@@ -7,7 +9,9 @@
 
 #include <tasks/I2CHub.cpp>
 
+#include "adaptive_rate.h"
 #include "events.h"
+#include "timesync.h"
 
 class ThermocoupleTask : public Task, public TSEvents::EventEmitter {
  public:
@@ -31,10 +35,16 @@ class ThermocoupleTask : public Task, public TSEvents::EventEmitter {
   }
 
   bool Callback() {
+    uint32_t start = micros();
     float temperature;
     bool ok = getSensorTemperature(&temperature);
     if (ok) {
-      dispatch(THERMOCOUPLE_DATA, &temperature, sizeof(float));
+      uint32_t intervalMs = rate.update(temperature, start, micros() - start);
+      if (adaptive) {
+        setInterval(intervalMs * TASK_MILLISECOND);
+      }
+      SensorReading reading = {temperature, timestampMicros()};
+      dispatch(THERMOCOUPLE_DATA, &reading, sizeof(SensorReading));
     }
     return true;
   }
@@ -71,10 +81,10 @@ class ThermocoupleTask : public Task, public TSEvents::EventEmitter {
     float temp;
     if (isISO) {
       temp = (byte1 << 8) | byte0;
-      temp /= 100.0;
+      temp /= 100.0f;
     } else {
       temp = (byte0 << 8) | byte1;
-      temp /= 16.0;
+      temp /= 16.0f;
     }
     if (!connected) {
       dispatch(THERMOCOUPLE_CONNECTED);
@@ -87,6 +97,16 @@ class ThermocoupleTask : public Task, public TSEvents::EventEmitter {
     return true;
   }
 
+  // Samples between fastMs and slowMs depending on how much the temperature
+  // moves, see adaptive_rate.h. threshold in C.
+  void setAdaptive(bool _adaptive, SampleBudget* budget, uint32_t fastMs, uint32_t slowMs, float threshold) {
+    adaptive = _adaptive;
+    rate.configure(fastMs, slowMs, threshold);
+    rate.setBudget(budget);
+  }
+
+  const AdaptiveRate& getRate() const { return rate; }
+
  private:
   int address;
   int channel;
@@ -94,4 +114,6 @@ class ThermocoupleTask : public Task, public TSEvents::EventEmitter {
   bool isISO = false;  // Is the sesnsor the vanilla thermcouple or the ISO one?
   I2CHubTask* i2cHub;
   TwoWire* wire;
+  bool adaptive = false;
+  AdaptiveRate rate;
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#define _TASK_OO_CALLBACKS
+#define _TASK_STATUS_REQUEST
+#include <EventHandler.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include "events.h"
+#include "telemetry.h"
+
+// Fire-and-forget telemetry over UDP. Samples are packed into sequence
+// numbered frames (see telemetry.h) so the receiver in tools/udp-receiver can
+// report loss, and a lost datagram never stalls the device the way a TCP
+// retransmit does.
+
+// Telemetry channel carrying a sensor event, 0 if it isn't streamed
+inline uint8_t telemetryChannelFor(uint16_t eventId) {
+  switch (eventId) {
+    case ENCODER_1_DATA:
+      return TELEMETRY_STIRRER_RPM;
+    case FLOW_SENSOR_1_DATA:
+      return TELEMETRY_FLOW_RATE;
+    case THERMOCOUPLE_DATA:
+      return TELEMETRY_WATER_TEMP;
+    case CONDUCT_SENSOR_DATA:
+      return TELEMETRY_COND_RATE;
+    default:
+      return 0;
+  }
+}
+
+class UDPTelemetryTask : public Task, public TSEvents::EventHandler {
+ public:
+  UDPTelemetryTask(Scheduler& s, TSEvents::EventBus& e, const char* _host, int _port, const char* _deviceName, unsigned long _interval = 100 * TASK_MILLISECOND)
+      : Task(_interval, TASK_FOREVER, &s, false),
+        TSEvents::EventHandler(&s, &e) {
+    host = _host;
+    port = _port;
+    deviceName = _deviceName;
+  }
+
+  bool OnEnable() {
+    udp.begin(port);
+    frame.reset(sequence);
+    return true;
+  }
+
+  bool Callback() {
+    if (WiFi.status() != WL_CONNECTED) {
+      return true;
+    }
+    // Let the receiver learn which device owns this source address
+    if (millis() - lastAnnounce > 10000 || lastAnnounce == 0) {
+      announce.reset(0, TELEMETRY_ANNOUNCE);
+      announce.setPayload(deviceName);
+      send(announce);
+      lastAnnounce = millis();
+    }
+    if (!frame.isEmpty()) {
+      send(frame);
+      frame.reset(++sequence);
+    }
+    return true;
+  }
+
+  void HandleEvent(TSEvents::Event event) {
+    uint8_t channel = telemetryChannelFor(event.id);
+    if (channel == 0) {
+      return;
+    }
+    SensorReading* reading = (SensorReading*)event.data;
+    if (!frame.add(channel, reading->timestamp, reading->value)) {
+      // Frame full, ship it now rather than waiting for the next tick
+      if (WiFi.status() == WL_CONNECTED) {
+        send(frame);
+      }
+      frame.reset(++sequence);
+      frame.add(channel, reading->timestamp, reading->value);
+    }
+  }
+
+  uint32_t getFramesSent() { return framesSent; }
+  uint32_t getSendErrors() { return sendErrors; }
+
+ private:
+  void send(TelemetryFrameBuilder& f) {
+    bool ok = udp.beginPacket(host, port);
+    if (ok) {
+      udp.write(f.data(), f.size());
+      ok = udp.endPacket();
+    }
+    if (ok) {
+      framesSent++;
+    } else {
+      sendErrors++;
+    }
+  }
+
+  const char* host;
+  int port;
+  const char* deviceName;
+  WiFiUDP udp;
+  TelemetryFrameBuilder frame;
+  TelemetryFrameBuilder announce;
+  uint32_t sequence = 0;
+  unsigned long lastAnnounce = 0;
+  uint32_t framesSent = 0;
+  uint32_t sendErrors = 0;
+};
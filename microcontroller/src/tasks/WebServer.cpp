@@ -0,0 +1,219 @@
+#pragma once
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <WiFi.h>
+#define _TASK_OO_CALLBACKS
+#define _TASK_STATUS_REQUEST
+#include <EventHandler.h>
+#include <TaskSchedulerDeclarations.h>
+
+#include "events.h"
+#include "tasks/UDPTelemetry.cpp"
+#include "telemetry.h"
+
+// Live data served straight from the device:
+//   ws://<device>/ws             JSON array of the samples acquired since the
+//                                last message, every WEB_SEND_MS
+//   http://<device>/api/snapshot latest value of every sensor and task stats
+// e.g. `websocat ws://<device>/ws` or `curl http://<device>/api/snapshot`.
+//
+// Off unless httpPort is set. With httpToken set, both need ?token=<it>.
+//
+// AsyncTCP owns the sockets on the networking core, so nothing here touches
+// the server from the scheduler core. Samples are queued under a spinlock
+// and a sender task on core 0 passes them on every WEB_SEND_MS, dropping
+// them instead of waiting when the clients can't keep up. They go as one
+// frame built in the queue itself, so the library allocates one message
+// buffer per frame rather than one per sample.
+
+#define WEB_MAX_TASKS 16
+#define WEB_SNAPSHOT_SIZE 1536
+#define WEB_QUEUE_SIZE 4096
+#define WEB_SEND_MS 50
+#define WEB_SEND_STACK 4096
+#define WEB_SEND_CORE 0
+
+class WebServerTask : public Task, public TSEvents::EventHandler {
+ public:
+  WebServerTask(Scheduler& s, TSEvents::EventBus& e, const char* _deviceName, const char* _token, int _port = 80, int _maxClients = 2, unsigned long _interval = 500 * TASK_MILLISECOND)
+      : Task(_interval, TASK_FOREVER, &s, false),
+        TSEvents::EventHandler(&s, &e),
+        server(_port),
+        ws("/ws") {
+    deviceName = _deviceName;
+    token = _token;
+    maxClients = _maxClients;
+    snapshotLock = xSemaphoreCreateMutex();
+    snapshot[0] = '\0';
+  }
+
+  bool OnEnable() {
+    if (sender == NULL) {
+      xTaskCreatePinnedToCore(sendLoop, "web", WEB_SEND_STACK, this, 1, &sender, WEB_SEND_CORE);
+    }
+    return true;
+  }
+
+  bool Callback() {
+    buildSnapshot();
+    return true;
+  }
+
+  void HandleEvent(TSEvents::Event event) {
+    uint8_t channel = telemetryChannelFor(event.id);
+    if (channel == 0) {
+      return;
+    }
+    SensorReading* reading = (SensorReading*)event.data;
+    latest[channel] = *reading;
+
+    if (!started || clients == 0) {
+      return;
+    }
+    char message[96];
+    int n = snprintf(message, sizeof(message), "{\"ch\":\"%s\",\"t\":%lld,\"v\":%g}", telemetryChannelName(channel), reading->timestamp, reading->value);
+    queue(message, n);
+  }
+
+  // Registers a scheduler task whose run count appears in the snapshot
+  void addTask(const char* name, Task* task) {
+    if (taskCount < WEB_MAX_TASKS) {
+      taskNames[taskCount] = name;
+      tasks[taskCount] = task;
+      taskCount++;
+    }
+  }
+
+ private:
+  static void sendLoop(void* self) {
+    WebServerTask* task = (WebServerTask*)self;
+    while (WiFi.status() != WL_CONNECTED) {
+      vTaskDelay(pdMS_TO_TICKS(WEB_SEND_MS));
+    }
+    task->begin();
+    while (true) {
+      vTaskDelay(pdMS_TO_TICKS(WEB_SEND_MS));
+      task->send();
+    }
+  }
+
+  // On the scheduler core. Messages are comma separated in the queue, after
+  // a byte left for the opening bracket and with one kept for the closing.
+  void queue(const char* message, int n) {
+    portENTER_CRITICAL(&queueMux);
+    size_t separator = queued > 0 ? 1 : 0;
+    if (1 + queued + separator + n + 1 <= WEB_QUEUE_SIZE) {
+      char* end = queues[filling] + 1 + queued;
+      if (separator) {
+        *end++ = ',';
+      }
+      memcpy(end, message, n);
+      queued += separator + n;
+    } else {
+      queueDropped++;
+    }
+    portEXIT_CRITICAL(&queueMux);
+  }
+
+  // On the sender task, swaps the queues and sends what was in the full one
+  void send() {
+    portENTER_CRITICAL(&queueMux);
+    char* frame = queues[filling];
+    size_t length = queued;
+    filling = 1 - filling;
+    queued = 0;
+    portEXIT_CRITICAL(&queueMux);
+
+    ws.cleanupClients(maxClients);
+    clients = ws.count();
+    if (length == 0 || clients == 0) {
+      return;
+    }
+    if (!ws.availableForWriteAll()) {
+      sendDropped++;
+      return;
+    }
+    frame[0] = '[';
+    frame[1 + length] = ']';
+    ws.textAll(frame, length + 2);
+  }
+
+  bool authorized(AsyncWebServerRequest* request) {
+    if (token[0] == '\0') {
+      return true;
+    }
+    const AsyncWebParameter* param = request->getParam("token");
+    return param != NULL && param->value() == token;
+  }
+
+  void begin() {
+    auto filter = [this](AsyncWebServerRequest* request) { return authorized(request); };
+    ws.setFilter(filter);
+    ws.onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t len) {
+      if (type == WS_EVT_CONNECT && server->count() > (size_t)maxClients) {
+        client->close(1013, "Too many clients");
+      }
+    });
+    server.addHandler(&ws);
+    server.on("/api/snapshot", HTTP_GET, [this](AsyncWebServerRequest* request) {
+      // Runs on the networking core, so copy the snapshot under the lock
+      AsyncResponseStream* response = request->beginResponseStream("application/json");
+      xSemaphoreTake(snapshotLock, portMAX_DELAY);
+      response->print(snapshot);
+      xSemaphoreGive(snapshotLock);
+      request->send(response);
+    }).setFilter(filter);
+    server.begin();
+    started = true;
+  }
+
+  void buildSnapshot() {
+    char buffer[WEB_SNAPSHOT_SIZE];
+    size_t n = snprintf(buffer, sizeof(buffer), "{\"device\":\"%s\",\"uptime_ms\":%lu,\"free_heap\":%u,\"ws_clients\":%u,\"ws_dropped\":%u,\"ws_frames_dropped\":%u,\"values\":{",
+                        deviceName, millis(), (unsigned)ESP.getFreeHeap(), (unsigned)clients, (unsigned)queueDropped, (unsigned)sendDropped);
+    for (int i = 1; i < TELEMETRY_CHANNEL_COUNT && n < sizeof(buffer); i++) {
+      n += snprintf(buffer + n, sizeof(buffer) - n, "%s\"%s\":{\"t\":%lld,\"v\":%g}", i > 1 ? "," : "", telemetryChannelName(i), latest[i].timestamp, latest[i].value);
+    }
+    if (n < sizeof(buffer)) {
+      n += snprintf(buffer + n, sizeof(buffer) - n, "},\"tasks\":{");
+    }
+    for (int i = 0; i < taskCount && n < sizeof(buffer); i++) {
+      n += snprintf(buffer + n, sizeof(buffer) - n, "%s\"%s\":{\"enabled\":%s,\"interval_ms\":%lu,\"runs\":%lu}", i > 0 ? "," : "", taskNames[i],
+                    tasks[i]->isEnabled() ? "true" : "false", tasks[i]->getInterval() / TASK_MILLISECOND, tasks[i]->getRunCounter());
+    }
+    if (n < sizeof(buffer)) {
+      snprintf(buffer + n, sizeof(buffer) - n, "}}");
+    }
+
+    xSemaphoreTake(snapshotLock, portMAX_DELAY);
+    memcpy(snapshot, buffer, sizeof(snapshot));
+    xSemaphoreGive(snapshotLock);
+  }
+
+  const char* deviceName;
+  const char* token;
+  int maxClients;
+  volatile bool started = false;  // Set by the sender task
+  volatile size_t clients = 0;
+  AsyncWebServer server;
+  AsyncWebSocket ws;
+  TaskHandle_t sender = NULL;
+
+  portMUX_TYPE queueMux = portMUX_INITIALIZER_UNLOCKED;
+  char queues[2][WEB_QUEUE_SIZE];
+  int filling = 0;
+  size_t queued = 0;
+  uint32_t queueDropped = 0;  // Samples
+  uint32_t sendDropped = 0;   // Frames
+
+  SensorReading latest[TELEMETRY_CHANNEL_COUNT] = {};
+
+  const char* taskNames[WEB_MAX_TASKS];
+  Task* tasks[WEB_MAX_TASKS];
+  int taskCount = 0;
+
+  SemaphoreHandle_t snapshotLock;
+  char snapshot[WEB_SNAPSHOT_SIZE];
+};
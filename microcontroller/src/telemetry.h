@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Compact binary telemetry frames, shared between the device and the host
+// tools in /tools, so this header must stay free of Arduino dependencies.
+//
+// A frame is a fixed header followed by `count` sample records. Records store
+// their timestamp as an offset from the header's base timestamp to keep them
+// at 9 bytes. All fields are little endian, as on both the ESP32 and x86.
+
+#define TELEMETRY_MAGIC 0x534D  // "MS"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_FRAME 1400  // Fits a single unfragmented UDP datagram
+#define TELEMETRY_UNSTAMPED 0xFFFFFFFFUL
+
+enum TelemetryFrameType : uint8_t {
+  TELEMETRY_SAMPLES = 0,
+  TELEMETRY_ANNOUNCE,        // Payload is the device name
+  TELEMETRY_UPTIME_SAMPLES,  // As TELEMETRY_SAMPLES, but timestamps are us since boot
+  TELEMETRY_TEXT,            // Payload is a line of text, e.g. a command reply
+};
+
+enum TelemetryChannel : uint8_t {
+  TELEMETRY_STIRRER_RPM = 1,
+  TELEMETRY_FLOW_RATE,
+  TELEMETRY_WATER_TEMP,
+  TELEMETRY_COND_RATE,
+  TELEMETRY_CHANNEL_COUNT
+};
+
+static const char* const telemetryChannelNames[TELEMETRY_CHANNEL_COUNT] = {
+    "unknown",
+    "stirrer_rpm",
+    "flow_rate",
+    "water_temp",
+    "cond_rate",
+};
+
+inline const char* telemetryChannelName(uint8_t channel) {
+  return channel < TELEMETRY_CHANNEL_COUNT ? telemetryChannelNames[channel] : telemetryChannelNames[0];
+}
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint32_t sequence;
+  int64_t baseTimestamp;  // us since the Unix epoch
+  uint8_t count;
+} TelemetryHeader;
+
+typedef struct __attribute__((packed)) {
+  uint8_t channel;
+  uint32_t offset;  // us after baseTimestamp, or TELEMETRY_UNSTAMPED
+  float value;
+} TelemetryRecord;
+
+// Fills a frame in place. add() returns false once the frame can't take the
+// record, after which it should be sent and reset().
+class TelemetryFrameBuilder {
+ public:
+  void reset(uint32_t sequence, TelemetryFrameType type = TELEMETRY_SAMPLES) {
+    header()->magic = TELEMETRY_MAGIC;
+    header()->version = TELEMETRY_VERSION;
+    header()->type = type;
+    header()->sequence = sequence;
+    header()->baseTimestamp = 0;
+    header()->count = 0;
+    length = sizeof(TelemetryHeader);
+  }
+
+  bool add(uint8_t channel, int64_t timestamp, float value) {
+    TelemetryHeader* h = header();
+    if (h->count == 255 || length + sizeof(TelemetryRecord) > TELEMETRY_MAX_FRAME) {
+      return false;
+    }
+    uint32_t offset = TELEMETRY_UNSTAMPED;
+    if (timestamp != 0) {
+      if (h->baseTimestamp == 0) {
+        h->baseTimestamp = timestamp;
+      }
+      int64_t delta = timestamp - h->baseTimestamp;
+      if (delta < 0 || delta >= (int64_t)TELEMETRY_UNSTAMPED) {
+        return false;
+      }
+      offset = (uint32_t)delta;
+    }
+    TelemetryRecord record = {channel, offset, value};
+    memcpy(buffer + length, &record, sizeof(record));
+    length += sizeof(record);
+    h->count++;
+    return true;
+  }
+
+  bool setPayload(const char* text) {
+    size_t n = strlen(text);
+    if (length + n > TELEMETRY_MAX_FRAME) {
+      return false;
+    }
+    memcpy(buffer + length, text, n);
+    length += n;
+    return true;
+  }
+
+  bool isEmpty() { return header()->count == 0; }
+  const uint8_t* data() { return buffer; }
+  size_t size() { return length; }
+
+ private:
+  TelemetryHeader* header() { return (TelemetryHeader*)buffer; }
+
+  uint8_t buffer[TELEMETRY_MAX_FRAME];
+  size_t length = 0;
+};
+
+// Validates a received frame. On success `records` points at the first
+// record (or the announce payload) inside `data`.
+inline bool telemetryParse(const uint8_t* data, size_t length, TelemetryHeader* header, const uint8_t** records) {
+  if (length < sizeof(TelemetryHeader)) {
+    return false;
+  }
+  memcpy(header, data, sizeof(TelemetryHeader));
+  if (header->magic != TELEMETRY_MAGIC || header->version != TELEMETRY_VERSION) {
+    return false;
+  }
+  bool samples = header->type == TELEMETRY_SAMPLES || header->type == TELEMETRY_UPTIME_SAMPLES;
+  if (samples && length != sizeof(TelemetryHeader) + header->count * sizeof(TelemetryRecord)) {
+    return false;
+  }
+  *records = data + sizeof(TelemetryHeader);
+  return true;
+}
+
+inline TelemetryRecord telemetryRecord(const uint8_t* records, int index) {
+  TelemetryRecord record;
+  memcpy(&record, records + index * sizeof(TelemetryRecord), sizeof(record));
+  return record;
+}
+
+inline int64_t telemetryTimestamp(const TelemetryHeader& header, const TelemetryRecord& record) {
+  return record.offset == TELEMETRY_UNSTAMPED ? 0 : header.baseTimestamp + record.offset;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+
+// Anything earlier than this means SNTP hasn't set the clock yet
+#define TIMESYNC_MIN_VALID_EPOCH 1700000000L
+#define TIMESYNC_INTERVAL_MS (10 * 60 * 1000UL)
+
+static portMUX_TYPE timeSyncMux = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool timeSyncPending = false;
+static int64_t timeSyncOffset = 0;      // us, server minus local at the last sync
+static int64_t timeSyncLastSync = 0;    // us, local time of the last sync
+static float timeSyncDrift = 0;         // ppm, local oscillator error between syncs
+
+inline int64_t timeSyncLocalMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Wall-clock acquisition timestamp in microseconds since the Unix epoch, or 0
+// while the clock has not been synchronised
+inline int64_t timestampMicros() {
+  int64_t now = timeSyncLocalMicros();
+  return now < TIMESYNC_MIN_VALID_EPOCH * 1000000LL ? 0 : now;
+}
+
+// Runs on the LwIP task, so it only records the measurement
+static void onTimeSync(struct timeval* tv) {
+  int64_t server = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+  int64_t local = timeSyncLocalMicros();
+
+  portENTER_CRITICAL(&timeSyncMux);
+  // In smooth mode the clock is slewed, not stepped, so it still reads the
+  // uncorrected time here. The very first sync steps it from 1970 instead.
+  if (timeSyncLastSync != 0) {
+    timeSyncOffset = server - local;
+    timeSyncDrift = (float)timeSyncOffset / (float)(local - timeSyncLastSync) * 1e6f;
+    timeSyncPending = true;
+  }
+  timeSyncLastSync = local;
+  portEXIT_CRITICAL(&timeSyncMux);
+}
+
+inline void startTimeSync(const char* server) {
+  sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+  sntp_set_sync_interval(TIMESYNC_INTERVAL_MS);
+  sntp_set_time_sync_notification_cb(onTimeSync);
+  configTime(0, 0, server != NULL ? server : "pool.ntp.org");
+}
+
+// Returns true once per sync that produced a new offset measurement
+inline bool takeTimeSyncResult(float* offsetMs, float* driftPpm) {
+  if (!timeSyncPending) {
+    return false;
+  }
+  portENTER_CRITICAL(&timeSyncMux);
+  *offsetMs = timeSyncOffset / 1000.0f;
+  *driftPpm = timeSyncDrift;
+  timeSyncPending = false;
+  portEXIT_CRITICAL(&timeSyncMux);
+  return true;
+}
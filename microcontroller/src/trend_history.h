@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-size, decimated history of one sensor for the trend view. Samples
+// are folded into min/max columns of columnMs each, and the newest `capacity`
+// columns are kept in a ring buffer whose storage is owned by the caller
+// (PSRAM on the device).
+
+typedef struct {
+  float min;
+  float max;
+} TrendColumn;
+
+class TrendHistory {
+ public:
+  void begin(TrendColumn* _storage, int _capacity, uint32_t _columnMs) {
+    storage = _storage;
+    capacity = _capacity;
+    columnMs = _columnMs;
+    count = 0;
+    head = 0;
+    open = false;
+  }
+
+  // Returns true when this sample closed a column
+  bool add(float value, uint32_t now) {
+    if (storage == 0 || value != value) {  // NaN never makes it onto the plot
+      return false;
+    }
+    bool closed = false;
+    if (open && now - columnStart >= columnMs) {
+      storage[head] = current;
+      head = (head + 1) % capacity;
+      if (count < capacity) {
+        count++;
+      }
+      open = false;
+      closed = true;
+    }
+    if (!open) {
+      current.min = value;
+      current.max = value;
+      columnStart = now;
+      open = true;
+    } else {
+      current.min = value < current.min ? value : current.min;
+      current.max = value > current.max ? value : current.max;
+    }
+    return closed;
+  }
+
+  int size() const { return count; }
+
+  // 0 is the oldest column
+  const TrendColumn& at(int i) const {
+    return storage[(head - count + i + capacity) % capacity];
+  }
+
+  const TrendColumn& latest() const { return at(count - 1); }
+
+ private:
+  TrendColumn* storage = 0;
+  int capacity = 0;
+  int count = 0;
+  int head = 0;
+  uint32_t columnMs = 1000;
+  uint32_t columnStart = 0;
+  TrendColumn current;
+  bool open = false;
+};
@@ -0,0 +1,149 @@
+// Host tests for filters.h: the spec parser's errors and each filter's
+// output. Run with `pio test -e native`.
+
+#include <unity.h>
+
+#include "filters.h"
+
+void setUp() {}
+void tearDown() {}
+
+static void assertSpecError(const char* spec, const char* error) {
+  SensorFilterSpec parsed;
+  TEST_ASSERT_EQUAL_STRING_MESSAGE(error, parseSensorFilterSpec(spec, &parsed), spec);
+}
+
+static void test_parse_valid() {
+  SensorFilterSpec parsed;
+  TEST_ASSERT_NULL(parseSensorFilterSpec("none", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_NONE, parsed.type);
+  TEST_ASSERT_EQUAL_FLOAT(0, parsed.deadband);
+
+  TEST_ASSERT_NULL(parseSensorFilterSpec("", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_NONE, parsed.type);
+
+  TEST_ASSERT_NULL(parseSensorFilterSpec("mean 5", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_MEAN, parsed.type);
+  TEST_ASSERT_EQUAL(5, parsed.window);
+
+  TEST_ASSERT_NULL(parseSensorFilterSpec("ema 0.2", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_EMA, parsed.type);
+  TEST_ASSERT_EQUAL_FLOAT(0.2f, parsed.alpha);
+
+  TEST_ASSERT_NULL(parseSensorFilterSpec("median 16 deadband 2.5", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_MEDIAN, parsed.type);
+  TEST_ASSERT_EQUAL(16, parsed.window);
+  TEST_ASSERT_EQUAL_FLOAT(2.5f, parsed.deadband);
+
+  TEST_ASSERT_NULL(parseSensorFilterSpec("deadband 10", &parsed));
+  TEST_ASSERT_EQUAL(SENSOR_FILTER_NONE, parsed.type);
+  TEST_ASSERT_EQUAL_FLOAT(10, parsed.deadband);
+}
+
+static void test_parse_errors() {
+  assertSpecError("mean 5 deadband 2 and more", "filter spec too long");
+  assertSpecError("average 5", "use none|mean N|ema A|median N [deadband D]");
+  assertSpecError("mean 5 median 5", "use none|mean N|ema A|median N [deadband D]");
+  assertSpecError("none mean 5", "use none|mean N|ema A|median N [deadband D]");
+  assertSpecError("mean", "filter is missing a number");
+  assertSpecError("mean five", "filter is missing a number");
+  assertSpecError("ema 0.2x", "filter is missing a number");
+  assertSpecError("mean 0", "filter window must be 1 to 16");
+  assertSpecError("median 17", "filter window must be 1 to 16");
+  assertSpecError("mean 2.5", "filter window must be 1 to 16");
+  assertSpecError("ema 0", "ema alpha must be 0 to 1");
+  assertSpecError("ema 1.5", "ema alpha must be 0 to 1");
+  assertSpecError("ema nan", "ema alpha must be 0 to 1");
+  assertSpecError("deadband -1", "deadband must be at least 0");
+  assertSpecError("deadband 2 mean 5", "deadband must come last");
+}
+
+static void test_moving_average() {
+  MovingAverage<4> mean(3);
+  TEST_ASSERT_EQUAL_FLOAT(3, mean.update(3));
+  TEST_ASSERT_EQUAL_FLOAT(4, mean.update(5));
+  TEST_ASSERT_EQUAL_FLOAT(5, mean.update(7));
+  TEST_ASSERT_EQUAL_FLOAT(7, mean.update(9));  // 3 has left the window
+  mean.setWindow(10);
+  TEST_ASSERT_EQUAL(4, mean.getWindow());
+}
+
+static void test_ema() {
+  ExponentialFilter ema(0.25f);
+  // Starts at the first value rather than from 0
+  TEST_ASSERT_EQUAL_FLOAT(8, ema.update(8));
+  TEST_ASSERT_EQUAL_FLOAT(7, ema.update(4));
+  TEST_ASSERT_EQUAL_FLOAT(6.25f, ema.update(4));
+  ema.reset();
+  TEST_ASSERT_EQUAL_FLOAT(100, ema.update(100));
+
+  ExponentialFilter passthrough(1);
+  passthrough.update(1);
+  TEST_ASSERT_EQUAL_FLOAT(-3, passthrough.update(-3));
+}
+
+static void test_median() {
+  RunningMedian<5> median(3);
+  TEST_ASSERT_EQUAL_FLOAT(10, median.update(10));
+  TEST_ASSERT_EQUAL_FLOAT(10, median.update(10));
+  // A single spike is rejected
+  TEST_ASSERT_EQUAL_FLOAT(10, median.update(500));
+  TEST_ASSERT_EQUAL_FLOAT(11, median.update(11));
+  TEST_ASSERT_EQUAL_FLOAT(12, median.update(12));  // 500 has left the window
+}
+
+static void test_deadband() {
+  Deadband deadband(2);
+  TEST_ASSERT_EQUAL_FLOAT(100, deadband.update(100));
+  TEST_ASSERT_EQUAL_FLOAT(100, deadband.update(101.5f));
+  TEST_ASSERT_EQUAL_FLOAT(100, deadband.update(98));  // Exactly band away holds
+  TEST_ASSERT_EQUAL_FLOAT(102.5f, deadband.update(102.5f));
+  TEST_ASSERT_EQUAL_FLOAT(102.5f, deadband.update(101));
+  deadband.reset();
+  TEST_ASSERT_EQUAL_FLOAT(101, deadband.update(101));
+
+  Deadband none;
+  none.update(1);
+  TEST_ASSERT_EQUAL_FLOAT(1.01f, none.update(1.01f));
+}
+
+static void test_sensor_filter() {
+  SensorFilter filter;
+  TEST_ASSERT_EQUAL_FLOAT(5, filter.update(5));
+  TEST_ASSERT_EQUAL_FLOAT(0, filter.getDelaySamples());
+
+  TEST_ASSERT_NULL(filter.configure("mean 2 deadband 1"));
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, filter.getDelaySamples());
+  TEST_ASSERT_EQUAL_FLOAT(10, filter.update(10));
+  TEST_ASSERT_EQUAL_FLOAT(10, filter.update(11));    // Mean 10.5 is inside the deadband
+  TEST_ASSERT_EQUAL_FLOAT(12.5f, filter.update(14));  // Mean 12.5 isn't
+
+  // A bad spec leaves the filter as it was
+  TEST_ASSERT_EQUAL_STRING("filter window must be 1 to 16", filter.configure("median 20"));
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, filter.getDelaySamples());
+
+  TEST_ASSERT_NULL(filter.configure("ema 0.5"));
+  TEST_ASSERT_EQUAL_FLOAT(1, filter.getDelaySamples());
+  TEST_ASSERT_EQUAL_FLOAT(4, filter.update(4));
+  TEST_ASSERT_EQUAL_FLOAT(6, filter.update(8));
+  filter.reset();
+  TEST_ASSERT_EQUAL_FLOAT(8, filter.update(8));
+
+  TEST_ASSERT_NULL(filter.configure("median 3"));
+  TEST_ASSERT_EQUAL_FLOAT(1, filter.getDelaySamples());
+  filter.update(1);
+  filter.update(2);
+  TEST_ASSERT_EQUAL_FLOAT(2, filter.update(100));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_valid);
+  RUN_TEST(test_parse_errors);
+  RUN_TEST(test_moving_average);
+  RUN_TEST(test_ema);
+  RUN_TEST(test_median);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_sensor_filter);
+  return UNITY_END();
+}
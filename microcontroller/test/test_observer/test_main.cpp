@@ -0,0 +1,53 @@
+// Host tests for MotorModelIdentifier (speed_observer.h). Run with
+// `pio test -e native`.
+
+#include <unity.h>
+
+#include "speed_observer.h"
+
+void setUp() {}
+void tearDown() {}
+
+static const uint32_t TICK_US = 25000;
+
+// PWM stepping between two levels with the motor following at tau 300 ms
+static void excite(MotorModelIdentifier& identifier, int estimates) {
+  float rpm = 100;
+  for (int i = 0; i < estimates; i++) {
+    float pwm = (i / 100) % 2 ? 200 : 120;
+    float next = rpm + (1.8f * (pwm - 40) - rpm) * (TICK_US / 300000.0f);
+    identifier.update(rpm, next + (i % 3 - 1) * 0.5f, pwm, TICK_US);
+    rpm = next;
+  }
+}
+
+static void test_fits_stepped_pwm() {
+  MotorModelIdentifier identifier;
+  MotorModel model;
+  excite(identifier, 400);
+  TEST_ASSERT_TRUE(identifier.getModel(&model));
+  TEST_ASSERT_FLOAT_WITHIN(0.2f, 1.8f, model.gain);
+  TEST_ASSERT_FLOAT_WITHIN(10, 40, model.offset);
+  TEST_ASSERT_FLOAT_WITHIN(50, 300, model.tauMs);
+}
+
+// Half an hour at a steady speed used to wind P up until the fit went NaN
+static void test_steady_speed_keeps_model() {
+  MotorModelIdentifier identifier;
+  MotorModel model;
+  excite(identifier, 400);
+  for (long i = 0; i < 30L * 60 * 40; i++) {
+    float noise = (i % 3 - 1) * 0.5f;
+    identifier.update(288 + noise, 288 - noise, 200, TICK_US);
+  }
+  TEST_ASSERT_TRUE(identifier.getModel(&model));
+  TEST_ASSERT_TRUE(isfinite(model.gain) && isfinite(model.offset) && isfinite(model.tauMs));
+  TEST_ASSERT_FLOAT_WITHIN(0.2f, 1.8f, model.gain);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fits_stepped_pwm);
+  RUN_TEST(test_steady_speed_keeps_model);
+  return UNITY_END();
+}
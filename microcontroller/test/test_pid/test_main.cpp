@@ -0,0 +1,58 @@
+// Host tests for PidController (pid.h). Run with `pio test -e native`.
+
+#include <unity.h>
+
+#include "pid.h"
+
+void setUp() {}
+void tearDown() {}
+
+static const uint32_t TICK_US = 25000;
+
+// Back to automatic with the setpoint well away from the measurement: the
+// first output is the manual one, whether or not the setpoint is ramped
+static void assertBumpless(float rampRate) {
+  FeedforwardMap feedforward;
+  feedforward.add(0, 40);
+  feedforward.add(400, 240);
+  PidController pid(0, 255);
+  pid.setGains({0.6f, 1, 0, rampRate, 0});
+  pid.setFeedforward(&feedforward);
+  pid.reset(200);
+
+  pid.setManual(150);
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(150, pid.update(300, 200, TICK_US));
+  }
+  pid.setAuto();
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 150, pid.update(300, 200, TICK_US));
+  // And carries on from there towards the setpoint
+  TEST_ASSERT_TRUE(pid.update(300, 200, TICK_US) > 150);
+}
+
+static void test_bumpless_without_ramp() { assertBumpless(0); }
+
+static void test_bumpless_with_ramp() { assertBumpless(300); }
+
+static void test_integral_holds_while_ramping() {
+  PidController pid(0, 255);
+  pid.setGains({0.6f, 1, 0, 100, 0});
+  pid.reset(100);
+  pid.update(100, 100, TICK_US);
+  pid.update(200, 100, TICK_US);  // 1 s of ramp left
+  TEST_ASSERT_EQUAL_FLOAT(0, pid.getI());
+  for (int i = 0; i < 50; i++) {
+    pid.update(200, 100, TICK_US);
+  }
+  // Arrived, so now integrating the 100 rpm error
+  TEST_ASSERT_EQUAL_FLOAT(200, pid.getSetpoint());
+  TEST_ASSERT_TRUE(pid.getI() > 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bumpless_without_ramp);
+  RUN_TEST(test_bumpless_with_ramp);
+  RUN_TEST(test_integral_holds_while_ramping);
+  return UNITY_END();
+}
@@ -0,0 +1,189 @@
+// Runs the relay autotune (autotune.h) on the simulated stirrer and pump
+// (tools/common/plant.h) through the same sensing as the firmware: the
+// encoder estimator with "mean 5" every 25 ms, and the flowmeter with
+// "mean 5" every 100 ms. Besides plant.h's own motor and pump, there are
+// heavier and lighter variants the config.h defaults weren't tuned on.
+// Each loop first holds its setpoint under the default gains, then tunes,
+// then runs a few setpoint steps under the defaults and under the tuned
+// gains.
+//
+// Prints how long the tune took, the ultimate gain and period it found and
+// the gains from them, then overshoot and settling time for each step.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "autotune.h"
+#include "filters.h"
+#include "pid.h"
+#include "plant.h"
+#include "rpm_estimator.h"
+#include "sensor_math.h"
+
+static const uint64_t STEP_US = 8000000;
+
+// A plant with its sensing, ticked by HBridgeTask
+struct Loop {
+  const char* name;
+  double gain;   // Plant gain and time constant, 0 for plant.h's
+  double tauMs;
+  uint32_t tickUs;
+  float tuneSetpoint;
+  float tuneStep;
+  float hysteresis;
+  float band;  // Settled within this of the setpoint
+  double profile[4];
+};
+
+struct Stirrer {
+  SimMotor motor;
+  RpmEstimator estimator;
+  SensorFilter filter;
+  float reading = 0;
+  uint64_t now = 0;
+
+  void setPlant(double gain, double tauMs) {
+    if (gain > 0) {
+      motor.model.gain = gain;
+      motor.model.tauMs = tauMs;
+    }
+  }
+  Stirrer() {
+    filter.configure("mean 5");
+    estimator.update(0, 0);
+  }
+  // Steps the plant by dt at pwm and takes a reading
+  void step(int pwm, uint32_t dt) {
+    motor.step(pwm, dt);
+    now += dt;
+    if (estimator.update(motor.count(), now)) {
+      reading = filter.update(estimator.getRPM());
+    }
+  }
+  double truth() const { return motor.rpm; }
+};
+
+struct Pump {
+  SimPump pump;
+  SensorFilter filter;
+  float reading = 0;
+  uint64_t now = 0;
+  uint32_t lastCount = 0;
+
+  Pump() { filter.configure("mean 5"); }
+  void setPlant(double gain, double tauMs) {
+    if (gain > 0) {
+      pump.gain = gain;
+      pump.tauMs = tauMs;
+    }
+  }
+  void step(int pwm, uint32_t dt) {
+    pump.step(pwm, dt);
+    uint32_t dtMs = (now + dt) / 1000 - now / 1000;
+    now += dt;
+    uint32_t count = pump.count();
+    reading = filter.update(flowRate(counterDelta(count, lastCount), dtMs, flowScale(pump.kValue, 1)));
+    lastCount = count;
+  }
+  double truth() const { return pump.meteredFlow(); }
+};
+
+struct StepResult {
+  double overshoot = 0;
+  double settleMs = 0;
+};
+
+template <typename Plant>
+static void runSteps(Plant& plant, const Loop& loop, const PidGains& gains, float output, StepResult* results,
+                     std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  PidController pid(0, 255);
+  pid.setGains(gains);
+  pid.reset(plant.reading, output);
+  int pwm = output;
+  for (int s = 0; s < 4; s++) {
+    double previous = s == 0 ? loop.tuneSetpoint : loop.profile[s - 1];
+    double setpoint = loop.profile[s];
+    StepResult& r = results[s];
+    for (uint64_t t = 0; t < STEP_US;) {
+      uint32_t dt = loop.tickUs + jitter(random);
+      plant.step(pwm, dt);
+      t += dt;
+      pwm = std::clamp(roundToInt(pid.update(setpoint, plant.reading, dt)), 0, 255);
+      r.overshoot = std::max(r.overshoot, (plant.truth() - setpoint) * (setpoint > previous ? 1 : -1));
+      if (std::fabs(plant.truth() - setpoint) > loop.band) {
+        r.settleMs = t / 1000.0;
+      }
+    }
+  }
+}
+
+template <typename Plant>
+static void run(const Loop& loop, const PidGains& defaults, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  Plant plant;
+  plant.setPlant(loop.gain, loop.tauMs);
+  PidController pid(0, 255);
+  pid.setGains(defaults);
+  int pwm = 0;
+  for (uint64_t t = 0; t < 5000000;) {
+    uint32_t dt = loop.tickUs + jitter(random);
+    plant.step(pwm, dt);
+    t += dt;
+    pwm = std::clamp(roundToInt(pid.update(loop.tuneSetpoint, plant.reading, dt)), 0, 255);
+  }
+
+  RelayAutotuner tuner;
+  tuner.configure(loop.tuneStep, loop.hysteresis, 0, 255, 55000000);
+  tuner.start(loop.tuneSetpoint, pwm, plant.reading, plant.now);
+  while (tuner.isRunning()) {
+    plant.step(pwm, loop.tickUs + jitter(random));
+    pwm = std::clamp(roundToInt(tuner.update(plant.reading, plant.now)), 0, 255);
+  }
+  float seconds = tuner.getElapsedUs(plant.now) / 1e6f;
+  if (tuner.getState() != AUTOTUNE_DONE) {
+    printf("%-8s tune failed after %.1f s: %s\n", loop.name, seconds, tuner.getError());
+    return;
+  }
+  PidGains tuned = defaults;
+  tuner.getGains(&tuned);
+  printf("%-8s tuned in %.1f s: Ku %.3f, Tu %.3f s -> kp %.3f, ki %.3f (defaults kp %.3f, ki %.3f)\n", loop.name, seconds,
+         tuner.getUltimateGain(), tuner.getUltimatePeriod(), tuned.kp, tuned.ki, defaults.kp, defaults.ki);
+
+  const struct {
+    const char* name;
+    PidGains gains;
+  } rows[] = {{"default", defaults}, {"tuned", tuned}};
+  for (const auto& row : rows) {
+    Plant copy = plant;
+    StepResult results[4];
+    runSteps(copy, loop, row.gains, pwm, results, random);
+    for (int s = 0; s < 4; s++) {
+      printf("%-8s %-8s %7.2f %7.2f %10.3f %10.0f\n", loop.name, row.name, s == 0 ? loop.tuneSetpoint : loop.profile[s - 1],
+             loop.profile[s], results[s].overshoot, results[s].settleMs);
+    }
+  }
+}
+
+int main() {
+  std::mt19937 random(1);
+  const Loop loops[] = {
+      {"stirrer", 0, 0, 25000, 250, 40, 3, 5, {150, 300, 100, 250}},
+      {"heavy", 1.2, 700, 25000, 150, 40, 3, 5, {100, 200, 60, 150}},
+      {"light", 3.0, 150, 25000, 250, 40, 3, 5, {150, 300, 100, 250}},
+      {"pump", 0, 0, 100000, 1.0f, 40, 0.03f, 0.05f, {0.5, 1.5, 2.0, 1.0}},
+      {"pump2", 0.006, 900, 100000, 0.6f, 40, 0.03f, 0.05f, {0.3, 0.9, 1.2, 0.6}},
+  };
+  printf("%-8s %-8s %7s %7s %10s %10s\n", "loop", "gains", "from", "to", "overshoot", "settle_ms");
+  for (const Loop& loop : loops) {
+    if (loop.tickUs == 25000) {
+      run<Stirrer>(loop, {0.6f, 1, 0, 300, 0}, random);  // config.h defaults
+    } else {
+      run<Pump>(loop, {40, 80, 0, 0, 0}, random);
+    }
+  }
+  return 0;
+}
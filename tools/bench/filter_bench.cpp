@@ -0,0 +1,114 @@
+// Times the filters in filters.h per sample against straightforward
+// versions (shift the window along and re-sum or re-sort it every sample,
+// as EncoderTask's rolling average used to), and checks the two agree on
+// the same noisy input. Exits non-zero if any pair differs by more than
+// TOLERANCE, so it can gate a change to filters.h.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench_timing.h"
+#include "filters.h"
+
+static const double TOLERANCE = 1e-3;  // Float rounding in the running sums
+
+template <int N>
+struct ShiftAverage {
+  float values[N] = {};
+  int count = 0;
+
+  float update(float value) {
+    for (int i = N - 1; i > 0; i--) {
+      values[i] = values[i - 1];
+    }
+    values[0] = value;
+    count = std::min(count + 1, N);
+    float total = 0;
+    for (int i = 0; i < count; i++) {
+      total += values[i];
+    }
+    return total / count;
+  }
+};
+
+template <int N>
+struct SortMedian {
+  float values[N] = {};
+  int count = 0;
+
+  float update(float value) {
+    for (int i = N - 1; i > 0; i--) {
+      values[i] = values[i - 1];
+    }
+    values[0] = value;
+    count = std::min(count + 1, N);
+    float sorted[N];
+    for (int i = 0; i < count; i++) {
+      int j = i;
+      for (; j > 0 && sorted[j - 1] > values[i]; j--) {
+        sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = values[i];
+    }
+    return count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+  }
+};
+
+template <typename Filter>
+static double nsPerSample(Filter& filter, const std::vector<float>& input) {
+  return nsPerCall([&](uint32_t i) { return filter.update(input[i]); }, input.size());
+}
+
+template <typename Filter, typename Reference>
+static double maxDifference(Filter filter, Reference reference, const std::vector<float>& input) {
+  double worst = 0;
+  for (float value : input) {
+    worst = std::max(worst, (double)std::fabs(filter.update(value) - reference.update(value)));
+  }
+  return worst;
+}
+
+// Returns false when the filter and reference disagree
+template <typename Filter, typename Reference>
+static bool row(const char* name, Filter filter, Reference reference, const std::vector<float>& input) {
+  double difference = maxDifference(filter, reference, input);
+  double referenceNs = nsPerSample(reference, input);
+  double filterNs = nsPerSample(filter, input);
+  bool ok = difference <= TOLERANCE;
+  printf("%-10s %12.2f %12.2f %12.2e%s\n", name, referenceNs, filterNs, difference, ok ? "" : "  FAIL");
+  return ok;
+}
+
+template <typename Filter>
+static void row(const char* name, Filter filter, const std::vector<float>& input) {
+  printf("%-10s %12s %12.2f %12s\n", name, "-", nsPerSample(filter, input), "-");
+}
+
+int main() {
+  // Stirrer-like RPM: a setpoint around 350 with encoder quantisation noise
+  // and the odd spike
+  std::mt19937 random(1);
+  std::normal_distribution<float> noise(0, 4);
+  std::vector<float> input(5000000);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = 350 + 20 * std::sin(i * 0.001f) + noise(random) + (i % 997 == 0 ? 200 : 0);
+  }
+
+  SensorFilter spec;
+  spec.configure("median 5 deadband 2");
+
+  printf("%-10s %12s %12s %12s\n", "filter", "naive_ns", "filter_ns", "max_diff");
+  bool ok = true;
+  ok &= row("mean 5", MovingAverage<5>(), ShiftAverage<5>(), input);
+  ok &= row("mean 16", MovingAverage<16>(), ShiftAverage<16>(), input);
+  ok &= row("median 5", RunningMedian<5>(), SortMedian<5>(), input);
+  ok &= row("median 16", RunningMedian<16>(), SortMedian<16>(), input);
+  row("ema", ExponentialFilter(0.2f), input);
+  row("deadband", Deadband(2), input);
+  row("median+db", spec, input);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+// Times the encoder, flow and stirrer PI computations in their previous
+// double form and their current float form (sensor_math_bench.h), and checks
+// the two agree.
+//
+// A host FPU does doubles in hardware, so the host ratio is close to 1 and
+// mostly shows the float path is no slower. The saving is on the ESP32,
+// where double is emulated in software: send `bench` over serial for the
+// same kernels in CPU cycles on the device.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include "bench_timing.h"
+#include "sensor_math_bench.h"
+
+int main() {
+  const uint32_t iterations = 20000000;
+
+  printf("%-8s %12s %12s %8s %12s\n", "kernel", "double_ns", "float_ns", "ratio", "max_rel_err");
+  for (int b = 0; b < mathBenchCount; b++) {
+    const MathBench& bench = mathBenches[b];
+
+    // Both kernels keep state between calls, so compare them over the same
+    // sequence of inputs before timing
+    double maxError = 0;
+    for (uint32_t i = 0; i < 100000; i++) {
+      float reference = bench.reference(i);
+      float current = bench.current(i);
+      double scale = std::fabs(reference) > 1 ? std::fabs(reference) : 1;
+      maxError = std::fmax(maxError, std::fabs(current - reference) / scale);
+    }
+
+    double referenceNs = nsPerCall(bench.reference, iterations);
+    double currentNs = nsPerCall(bench.current, iterations);
+    printf("%-8s %12.2f %12.2f %8.2f %12.2e\n", bench.name, referenceNs, currentNs, referenceNs / currentNs, maxError);
+  }
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Closes the pump flow loop (PidController, pid.h) around a simulated pump
+// and flowmeter (tools/common/plant.h), with the pump ticked every 100 ms
+// like HBridgeTask and the loop run once per flow reading. Compares the
+// flowmeter read as before, pulses over each 500 ms flowInterval, with
+// readings every 100 ms through a few flowFilter settings.
+//
+// For each setpoint step, prints overshoot and settling time into +/-0.05
+// L/min of the true flow, and the RMS error of the flow reading and of the
+// true flow once settled.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "filters.h"
+#include "pid.h"
+#include "plant.h"
+#include "sensor_math.h"
+
+static const uint32_t PUMP_TICK_US = 100000;
+static const uint64_t STEP_US = 10000000;
+static const double profile[] = {0, 1.0, 2.0, 0.5, 1.5};
+static const int stepCount = sizeof(profile) / sizeof(double);
+
+struct Sampling {
+  const char* name;
+  uint32_t pollUs;
+  const char* filter;
+};
+
+struct StepResult {
+  double overshoot = 0;  // L/min past the new setpoint
+  double settleMs = 0;
+};
+
+struct Run {
+  StepResult steps[stepCount];
+  double readingRms = 0;   // Reading against the metered flow, settled
+  double trackingRms = 0;  // True flow against the setpoint, settled
+};
+
+static Run run(const Sampling& sampling, const PidGains& gains, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  SimPump pump;
+  float scale = flowScale(pump.kValue, 1);
+  SensorFilter filter;
+  filter.configure(sampling.filter);
+  PidController pid(0, 255);
+  pid.setGains(gains);
+
+  uint64_t now = 0;
+  uint64_t nextPoll = 0;
+  uint64_t nextTick = 0;
+  uint64_t lastReadingUs = 0;
+  uint32_t lastCount = 0;
+  uint64_t lastPollUs = 0;  // FlowSensorTask times with millis()
+  float reading = 0;
+  uint32_t readings = 0, usedReadings = 0;
+  int pwm = 0;
+  double readingSquares = 0, trackingSquares = 0;
+  long settled = 0;
+  Run result;
+
+  while (now < STEP_US * stepCount) {
+    uint64_t next = std::min(nextPoll, nextTick);
+    pump.step(pwm, next - now);
+    now = next;
+    int step = now / STEP_US;
+    double setpoint = profile[step];
+    double previous = step > 0 ? profile[step - 1] : 0;
+
+    if (now == nextPoll) {
+      nextPoll += sampling.pollUs + jitter(random);
+      uint32_t count = pump.count();
+      reading = filter.update(flowRate(counterDelta(count, lastCount), now / 1000 - lastPollUs / 1000, scale));
+      readings++;
+      lastCount = count;
+      lastPollUs = now;
+    }
+    if (now != nextTick) {
+      continue;
+    }
+    nextTick += PUMP_TICK_US + jitter(random);
+
+    // HBridgeTask runs the loop once per new reading
+    if (setpoint == 0) {
+      pwm = 0;
+      pid.reset(reading);
+      lastReadingUs = now;
+    } else if (readings != usedReadings) {
+      usedReadings = readings;
+      pwm = std::clamp(roundToInt(pid.update(setpoint, reading, now - lastReadingUs)), 0, 255);
+      lastReadingUs = now;
+    }
+
+    double stepMs = (now - step * STEP_US) / 1000.0;
+    StepResult& r = result.steps[step];
+    double size = setpoint - previous;
+    if (size != 0) {
+      r.overshoot = std::max(r.overshoot, (pump.meteredFlow() - setpoint) * (size > 0 ? 1 : -1));
+      if (std::fabs(pump.meteredFlow() - setpoint) > 0.05) {
+        r.settleMs = stepMs;
+      }
+    }
+    if (stepMs > STEP_US / 2000.0) {
+      readingSquares += (reading - pump.meteredFlow()) * (reading - pump.meteredFlow());
+      trackingSquares += (pump.meteredFlow() - setpoint) * (pump.meteredFlow() - setpoint);
+      settled++;
+    }
+  }
+  result.readingRms = std::sqrt(readingSquares / settled);
+  result.trackingRms = std::sqrt(trackingSquares / settled);
+  return result;
+}
+
+int main() {
+  std::mt19937 random(1);
+  PidGains gains = {40, 80, 0, 0, 0};  // config.h defaults
+  const Sampling samplings[] = {
+      {"500 ms", 500000, "none"},
+      {"100 ms", 100000, "none"},
+      {"100 ms, mean 5", 100000, "mean 5"},
+      {"100 ms, ema 0.3", 100000, "ema 0.3"},
+  };
+
+  printf("%-18s %5s %5s %10s %10s %12s %12s\n", "sampling", "from", "to", "overshoot", "settle_ms", "reading_rms", "tracking_rms");
+  for (const auto& sampling : samplings) {
+    Run r = run(sampling, gains, random);
+    for (int s = 1; s < stepCount; s++) {
+      printf("%-18s %5.1f %5.1f %10.3f %10.0f %12.3f %12.3f\n", sampling.name, profile[s - 1], profile[s], r.steps[s].overshoot,
+             r.steps[s].settleMs, r.readingRms, r.trackingRms);
+    }
+  }
+  return 0;
+}
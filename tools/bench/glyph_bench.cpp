@@ -0,0 +1,127 @@
+// Compares a value field update through the glyph atlas (off-screen compose,
+// one push) with the previous path (fillRect, then per-run font rendering
+// straight to the LCD), using the bundled FreeSans8pt7b font.
+//
+// CPU time is measured on the host. LCD cost is modelled from the pixels and
+// address-window commands each path sends over SPI, which dominates on the
+// device.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#define PROGMEM
+typedef struct {
+  uint16_t bitmapOffset;
+  uint8_t width, height, xAdvance;
+  int8_t xOffset, yOffset;
+} GFXglyph;
+typedef struct {
+  uint8_t* bitmap;
+  GFXglyph* glyph;
+  uint16_t first, last;
+  uint8_t yAdvance;
+} GFXfont;
+
+#include "assets/Regular 400.h"
+#include "glyph_atlas.h"
+
+static const int W = 70;
+static const int H = 25;
+static const double SPI_MHZ = 40.0;
+static const int WINDOW_BYTES = 11;  // CASET + RASET + RAMWR with arguments
+
+struct Lcd {
+  uint16_t pixels[320 * 240];
+  long pixelsSent = 0;
+  long windows = 0;
+
+  void fillRect(int x, int y, int w, int h, uint16_t color) {
+    windows++;
+    for (int r = 0; r < h; r++) {
+      for (int c = 0; c < w; c++) {
+        pixels[(y + r) * 320 + x + c] = color;
+      }
+    }
+    pixelsSent += w * h;
+  }
+
+  void pushImage(int x, int y, int w, int h, const uint16_t* data) {
+    windows++;
+    for (int r = 0; r < h; r++) {
+      for (int c = 0; c < w; c++) {
+        pixels[(y + r) * 320 + x + c] = data[r * w + c];
+      }
+    }
+    pixelsSent += w * h;
+  }
+};
+
+// Same approach as TFT_eSPI::drawChar for GFX fonts: walk the glyph bitmap
+// and draw each horizontal run of set pixels as its own fill
+static void drawTextDirect(Lcd& lcd, const GFXfont* font, int x, int y, const char* text, uint16_t color) {
+  for (const char* p = text; *p; p++) {
+    const GFXglyph& g = font->glyph[*p - font->first];
+    const uint8_t* bitmap = font->bitmap + g.bitmapOffset;
+    int bit = 0;
+    for (int r = 0; r < g.height; r++) {
+      int run = 0;
+      int start = 0;
+      for (int c = 0; c < g.width; c++, bit++) {
+        bool set = bitmap[bit >> 3] & (0x80 >> (bit & 7));
+        if (set) {
+          if (run == 0) {
+            start = c;
+          }
+          run++;
+        }
+        if ((!set || c == g.width - 1) && run > 0) {
+          lcd.fillRect(x + g.xOffset + start, y + g.yOffset + r, run, 1, color);
+          run = 0;
+        }
+      }
+    }
+    x += g.xAdvance;
+  }
+}
+
+int main() {
+  static Lcd lcd;
+  static GlyphAtlas atlas;
+  static uint16_t field[W * H];
+  const char* values[] = {"21.37", "0.00", "-3.14", "379", "12.85", "1024", "7.50", "99.99"};
+  const int count = sizeof(values) / sizeof(values[0]);
+  const int iterations = 200000;
+
+  atlas.build(&FreeSans8pt7b);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    lcd.fillRect(220, 48, W, H, 0);
+    drawTextDirect(lcd, &FreeSans8pt7b, 232, 66, values[i % count], 0xF800);
+  }
+  double directUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+  double directPixels = (double)lcd.pixelsSent / iterations;
+  double directWindows = (double)lcd.windows / iterations;
+
+  lcd.pixelsSent = 0;
+  lcd.windows = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    for (int p = 0; p < W * H; p++) {
+      field[p] = 0;
+    }
+    atlas.draw(field, W, H, 12, 18, values[i % count], 0xF800);
+    lcd.pushImage(220, 48, W, H, field);
+  }
+  double atlasUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+  double atlasPixels = (double)lcd.pixelsSent / iterations;
+  double atlasWindows = (double)lcd.windows / iterations;
+
+  auto spiUs = [](double pixels, double windows) { return (pixels * 2 + windows * WINDOW_BYTES) * 8 / SPI_MHZ; };
+
+  printf("%-8s %12s %12s %12s %14s\n", "path", "cpu_us", "lcd_pixels", "lcd_windows", "spi_us@40MHz");
+  printf("%-8s %12.3f %12.1f %12.1f %14.1f\n", "direct", directUs, directPixels, directWindows, spiUs(directPixels, directWindows));
+  printf("%-8s %12.3f %12.1f %12.1f %14.1f\n", "atlas", atlasUs, atlasPixels, atlasWindows, spiUs(atlasPixels, atlasWindows));
+  return 0;
+}
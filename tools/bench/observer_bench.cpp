@@ -0,0 +1,154 @@
+// Closes the original per-tick stirrer PI loop (fixed gains, 25 ms ticks)
+// around a simulated motor and encoder, feeding it back either the filtered
+// encoder speed or SpeedObserver's estimate (speed_observer.h). The
+// simulated motor deliberately differs from the observer's default model.
+//
+// Reports how far each feedback signal is from the true speed, and the
+// loop's tracking error and overshoot over a setpoint profile. Also checks
+// MotorModelIdentifier recovers the simulated motor's parameters.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "filters.h"
+#include "plant.h"
+#include "rpm_estimator.h"
+#include "speed_observer.h"
+
+static const uint32_t TICK_US = 25000;
+
+enum Feedback { ENCODER, OBSERVER, IDENTIFIED };
+
+struct Result {
+  double feedbackRms;  // Feedback signal against the true speed
+  double trackingRms;  // True speed against the setpoint, after each step settles
+  double overshoot;    // Largest, in rpm
+};
+
+static double setpointAt(uint64_t us) {
+  static const double profile[] = {200, 350, 150, 300};
+  return profile[std::min<uint64_t>(us / 5000000, 3)];
+}
+
+static Result run(Feedback feedback, const MotorModel& model, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  SimMotor motor;
+  RpmEstimator estimator;
+  SensorFilter filter;
+  filter.configure("mean 5");
+  SpeedObserver observer;
+  observer.configure(model, 20000);
+
+  float cumError = 0;
+  int pwm = 0;
+  uint64_t now = 0;
+  uint32_t estimates = 0;
+  float encoderRpm = 0;
+  double feedbackSquares = 0, trackingSquares = 0, overshoot = 0;
+  int feedbackSamples = 0, trackingSamples = 0;
+
+  estimator.update(0, 0);
+  while (now < 20000000) {
+    uint32_t dt = TICK_US + jitter(random);
+    motor.step(pwm, dt);
+    now += dt;
+
+    // EncoderTask and HBridgeTask run at the same rate, modelled here as
+    // the encoder polled just before each control tick
+    if (estimator.update(motor.count(), now)) {
+      encoderRpm = filter.update(estimator.getRPM());
+    }
+    observer.predict(pwm, dt);
+    if (estimator.getEstimates() != estimates) {
+      estimates = estimator.getEstimates();
+      float resolution = estimator.getResolution();
+      observer.correct(estimator.getRPM(), resolution * resolution / 12 + 4);
+    }
+
+    float rpm = feedback == ENCODER ? encoderRpm : observer.getRPM();
+    double setpoint = setpointAt(now);
+    float error = setpoint - rpm;
+    cumError = std::clamp(cumError + error, -5000.0f, 5000.0f);
+    pwm = std::clamp(127 + roundToInt(0.6f * error + 0.05f * cumError), 0, 255);
+
+    feedbackSquares += (rpm - motor.rpm) * (rpm - motor.rpm);
+    feedbackSamples++;
+    if (now % 5000000 > 2000000) {
+      trackingSquares += (motor.rpm - setpoint) * (motor.rpm - setpoint);
+      trackingSamples++;
+    }
+    bool rising = now >= 5000000 && setpointAt(now - 5000000) < setpoint;
+    overshoot = std::max(overshoot, rising || now < 5000000 ? motor.rpm - setpoint : setpoint - motor.rpm);
+  }
+  return {std::sqrt(feedbackSquares / feedbackSamples), std::sqrt(trackingSquares / trackingSamples), overshoot};
+}
+
+// Open loop PWM steps with the identifier fed from the encoder estimates
+static bool identify(MotorModel* fitted, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  std::uniform_int_distribution<int> pwms(90, 255);
+  SimMotor motor;
+  RpmEstimator estimator;
+  MotorModelIdentifier identifier;
+  int pwm = 150;
+  uint64_t now = 0;
+  uint32_t estimates = 0;
+  float lastRpm = 0;
+  double pwmSum = 0;
+  uint32_t pwmUs = 0;
+
+  estimator.update(0, 0);
+  while (now < 60000000) {
+    if (now % 1500000 < TICK_US + 2000) {
+      pwm = pwms(random);
+    }
+    uint32_t dt = TICK_US + jitter(random);
+    motor.step(pwm, dt);
+    now += dt;
+    pwmSum += pwm * (double)dt;
+    pwmUs += dt;
+    estimator.update(motor.count(), now);
+    if (estimator.getEstimates() != estimates) {
+      estimates = estimator.getEstimates();
+      identifier.update(lastRpm, estimator.getRPM(), pwmSum / pwmUs, estimator.getWindowUs());
+      lastRpm = estimator.getRPM();
+      pwmSum = 0;
+      pwmUs = 0;
+    }
+  }
+  return identifier.getModel(fitted);
+}
+
+int main() {
+  std::mt19937 random(1);
+  MotorModel nominal = {1.8f, 40, 300};  // config.h defaults
+  MotorModel fitted;
+  bool identified = identify(&fitted, random);
+  SimMotor truth;
+
+  printf("%-10s %8s %8s %8s\n", "model", "gain", "offset", "tau_ms");
+  printf("%-10s %8.2f %8.1f %8.0f\n", "simulated", truth.model.gain, truth.model.offset, truth.model.tauMs);
+  printf("%-10s %8.2f %8.1f %8.0f\n", "default", nominal.gain, nominal.offset, nominal.tauMs);
+  if (identified) {
+    printf("%-10s %8.2f %8.1f %8.0f\n", "fitted", fitted.gain, fitted.offset, fitted.tauMs);
+  } else {
+    printf("%-10s %8s\n", "fitted", "failed");
+  }
+
+  printf("\n%-20s %16s %16s %14s\n", "feedback", "feedback_rms", "tracking_rms", "overshoot");
+  const struct {
+    const char* name;
+    Feedback feedback;
+  } rows[] = {{"encoder (mean 5)", ENCODER}, {"observer (default)", OBSERVER}, {"observer (fitted)", IDENTIFIED}};
+  for (const auto& row : rows) {
+    if (row.feedback == IDENTIFIED && !identified) {
+      continue;
+    }
+    Result r = run(row.feedback, row.feedback == IDENTIFIED ? fitted : nominal, random);
+    printf("%-20s %16.2f %16.2f %14.1f\n", row.name, r.feedbackRms, r.trackingRms, r.overshoot);
+  }
+  return 0;
+}
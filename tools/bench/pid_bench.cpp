@@ -0,0 +1,137 @@
+// Step responses of the stirrer loop on a simulated motor (tools/common/
+// plant.h), polled and ticked every 25 ms like EncoderTask and HBridgeTask:
+// the previous per-tick PI with its fixed midPWM offset against
+// PidController (pid.h) with feedforward and setpoint ramping, fed back
+// from the filtered encoder or the speed observer.
+//
+// For each setpoint step, prints rise time (10-90%), overshoot and settling
+// time into +/-5 rpm of the true speed, and the mean |PWM change| per tick
+// as the control effort.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "filters.h"
+#include "pid.h"
+#include "plant.h"
+#include "rpm_estimator.h"
+#include "speed_observer.h"
+
+static const uint32_t TICK_US = 25000;
+static const uint64_t STEP_US = 4000000;
+static const double profile[] = {0, 350, 100, 300, 200};
+static const int stepCount = sizeof(profile) / sizeof(double);
+
+enum Loop { LEGACY_PI, PID, PID_OBSERVER };
+
+struct StepResult {
+  double riseMs = -1;
+  double overshoot = 0;  // rpm past the new setpoint
+  double settleMs = 0;
+};
+
+struct Run {
+  StepResult steps[stepCount];
+  double effort = 0;
+};
+
+static Run run(Loop loop, const PidGains& gains, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  SimMotor motor;
+  RpmEstimator estimator;
+  SensorFilter filter;
+  filter.configure("mean 5");
+  SpeedObserver observer;
+  observer.configure({1.8f, 40, 300}, 20000);  // config.h defaults
+  FeedforwardMap feedforward;
+  feedforward.add(0, 40);  // motorOffset + rpm / motorGain, as HBridgeTask builds it
+  feedforward.add(380, 40 + 380 / 1.8f);
+  PidController pid(0, 255);
+  pid.setGains(gains);
+  pid.setFeedforward(&feedforward);
+
+  float cumError = 0;
+  int pwm = 0;
+  float encoderRpm = 0;
+  uint32_t estimates = 0;
+  uint64_t now = 0;
+  Run result;
+  long ticks = 0;
+
+  estimator.update(0, 0);
+  while (now < STEP_US * stepCount) {
+    uint32_t dt = TICK_US + jitter(random);
+    motor.step(pwm, dt);
+    now += dt;
+    int step = now / STEP_US;
+    double setpoint = profile[step];
+    double previous = step > 0 ? profile[step - 1] : 0;
+    double stepUs = now - step * STEP_US;
+
+    if (estimator.update(motor.count(), now)) {
+      encoderRpm = filter.update(estimator.getRPM());
+    }
+    observer.predict(pwm, dt);
+    if (estimator.getEstimates() != estimates) {
+      estimates = estimator.getEstimates();
+      float resolution = estimator.getResolution();
+      observer.correct(estimator.getRPM(), resolution * resolution / 12 + 4);
+    }
+    float rpm = loop == PID_OBSERVER ? observer.getRPM() : encoderRpm;
+
+    int next;
+    if (setpoint == 0) {
+      next = 0;
+      cumError = 0;
+      pid.reset(rpm);
+    } else if (loop == LEGACY_PI) {
+      float error = setpoint - rpm;
+      cumError = std::clamp(cumError + error, -5000.0f, 5000.0f);
+      next = std::clamp(127 + roundToInt(0.6f * error + 0.05f * cumError), 0, 255);
+    } else {
+      next = std::clamp(roundToInt(pid.update(setpoint, rpm, dt)), 0, 255);
+    }
+    result.effort += std::abs(next - pwm);
+    pwm = next;
+    ticks++;
+
+    // Metrics on the true speed
+    StepResult& r = result.steps[step];
+    double size = setpoint - previous;
+    if (size == 0) {
+      continue;
+    }
+    double progress = (motor.rpm - previous) / size;
+    if (r.riseMs < 0 && progress >= 0.9) {
+      r.riseMs = stepUs / 1000;
+    }
+    r.overshoot = std::max(r.overshoot, (motor.rpm - setpoint) * (size > 0 ? 1 : -1));
+    if (std::fabs(motor.rpm - setpoint) > 5) {
+      r.settleMs = stepUs / 1000;
+    }
+  }
+  result.effort /= ticks;
+  return result;
+}
+
+int main() {
+  std::mt19937 random(1);
+  PidGains gains = {0.6f, 1, 0, 300, 0};  // config.h defaults
+  const struct {
+    const char* name;
+    Loop loop;
+  } loops[] = {{"legacy PI", LEGACY_PI}, {"pid", PID}, {"pid+observer", PID_OBSERVER}};
+
+  printf("%-14s %6s %6s %8s %11s %10s %10s\n", "loop", "from", "to", "rise_ms", "overshoot", "settle_ms", "effort");
+  for (const auto& loop : loops) {
+    Run r = run(loop.loop, gains, random);
+    for (int s = 1; s < stepCount; s++) {
+      printf("%-14s %6.0f %6.0f %8.0f %11.1f %10.0f %10.2f\n", loop.name, profile[s - 1], profile[s], r.steps[s].riseMs,
+             r.steps[s].overshoot, r.steps[s].settleMs, r.effort);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+// Runs RpmEstimator (rpm_estimator.h) against a simulated encoder polled
+// every 25 ms like EncoderTask, at a range of steady speeds and through a
+// step, with the old estimate-every-poll behaviour (minCounts 0) alongside.
+// Reports the RMS error, the noise and window the estimator reports itself,
+// and how long it takes to get halfway through a step down in speed, all
+// without the SensorFilter on top.
+//
+// Poll times jitter by up to 2 ms and the micros() and count starting
+// values sit just below 2^32, so both wrap during every run.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "rpm_estimator.h"
+
+static const uint32_t POLL_US = 25000;
+
+struct Shaft {
+  double position = 0;  // counts
+  uint32_t countOffset = 0xFFFFF000u;
+
+  uint32_t count() const { return countOffset + (uint32_t)(int64_t)std::floor(position); }
+};
+
+struct Result {
+  double rmsError;
+  float noise;
+  float windowMs;
+  double stepMs;  // Until the estimate is halfway to the new speed
+};
+
+static Result run(int minCounts, double rpm, double stepTo, std::mt19937& random) {
+  std::uniform_int_distribution<int> jitter(0, 2000);
+  RpmEstimator estimator(minCounts, 250000);
+  Shaft shaft;
+  uint32_t clockOffset = 0xFFFF0000u;
+  uint64_t now = 0;
+  double squaredError = 0;
+  int samples = 0;
+  float noise = 0;
+  float windowMs = 0;
+  uint64_t stepStart = 0;  // Speed changes at the start of the first poll after this
+  double stepMs = -1;
+  const uint64_t stepAt = 10000000;
+
+  estimator.update(shaft.count(), clockOffset);
+  while (now < 20000000) {
+    uint64_t next = now + POLL_US + jitter(random);
+    if (now >= stepAt && stepStart == 0) {
+      stepStart = now;
+      noise = estimator.getNoise();
+      windowMs = estimator.getWindowUs() / 1000.0f;
+    }
+    double speed = stepStart ? stepTo : rpm;
+    shaft.position += speed * ENCODER_COUNTS_PER_REV / 60e6 * (next - now);
+    now = next;
+    estimator.update(shaft.count(), clockOffset + (uint32_t)now);
+    float estimate = estimator.getRPM();
+
+    // Steady state error before the step, after letting it settle
+    if (now > 1000000 && !stepStart) {
+      squaredError += (estimate - rpm) * (estimate - rpm);
+      samples++;
+    }
+    if (stepStart && stepMs < 0 && estimate <= (rpm + stepTo) / 2) {
+      stepMs = (now - stepStart) / 1000.0;
+    }
+  }
+  return {std::sqrt(squaredError / samples), noise, windowMs, stepMs};
+}
+
+int main() {
+  std::mt19937 random(1);
+  const double speeds[] = {2, 5, 10, 30, 100, 350};
+
+  printf("%-9s %8s %8s %12s %10s %10s %10s\n", "min_count", "rpm", "step_to", "rms_err_rpm", "noise_rpm", "window_ms", "step_ms");
+  for (int minCounts : {0, 4, 8, 16}) {
+    for (double rpm : speeds) {
+      // Steps to half speed, and from the slowest speed down to a stop
+      double stepTo = rpm == speeds[0] ? 0 : rpm / 2;
+      Result r = run(minCounts, rpm, stepTo, random);
+      printf("%-9d %8.0f %8.0f %12.2f %10.2f %10.1f %10.0f\n", minCounts, rpm, stepTo, r.rmsError, r.noise, r.windowMs, r.stepMs);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Runs the knob, conductivity and thermocouple sampling (adaptive_rate.h)
+// over 10 simulated minutes of a tank: two knob turns, two tracer
+// injections washing out, and a heater ramp, with quiet stretches between.
+// Compares the fixed config.h intervals, fixed intervals as fast as the
+// adaptive ones get, and adaptive sampling under a few bus budgets. The
+// budgets cover the control loops too, which take the 5.5% of the bus
+// tank_sim measures whatever the sensors do.
+//
+// For each sensor, prints samples taken, the share of bus time they took,
+// how long after the signal moved past its activity threshold the next
+// sample came, and the RMS error of the samples joined up by straight lines
+// against the true signal, during the events and in the quiet. Each is the
+// mean of RUNS runs with the sensors starting at random points in their
+// intervals, as otherwise a fixed interval can land a sample right where
+// an event starts and look better than it is.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "adaptive_rate.h"
+
+static const uint32_t RUN_MS = 600000;
+static const int RUNS = 10;
+static const uint32_t EVENT_MS = 30000;  // Counted as an event after each start
+
+struct Sensor {
+  const char* name;
+  uint32_t intervalMs;  // config.h default
+  uint32_t minimumMs;   // The interval's config minimum
+  float threshold;      // config.h default activity
+  float costUs;         // PaHub select and read at 100 kHz
+  float noise;
+  std::vector<uint32_t> events;  // Starts, ms
+  float (*truth)(uint32_t ms);
+};
+
+static float knob(uint32_t ms) {
+  // Turned over a second at 2 and 6.5 minutes
+  float t = ms / 1000.0f;
+  float value = 1000;
+  value += 1500 * std::clamp(t - 120, 0.0f, 1.0f);
+  value -= 2000 * std::clamp((t - 390) / 1.5f, 0.0f, 1.0f);
+  return value;
+}
+
+static float conductivity(uint32_t ms) {
+  // Tracer at 1 and 6 minutes, mixing in over ~2 s and washing out over
+  // a 60 s residence time
+  float t = ms / 1000.0f;
+  float value = 1.0f;
+  for (float start : {60.0f, 360.0f}) {
+    if (t > start) {
+      value += 0.6f * (1 - expf(-(t - start) / 2)) * expf(-(t - start) / 60);
+    }
+  }
+  return value;
+}
+
+static float temperature(uint32_t ms) {
+  // Heater on from 3 to 5 minutes
+  float t = ms / 1000.0f;
+  return 20 + 0.05f * std::clamp(t - 180, 0.0f, 120.0f);
+}
+
+// Bus users on fixed intervals: the config.h control loop intervals, with
+// the HBridge costs averaged over ticks with and without a write
+struct FixedUser {
+  const char* name;
+  uint32_t intervalMs;
+  float costUs;
+};
+
+static const FixedUser fixedUsers[] = {
+    {"encoder", 25, 900},
+    {"stirrer", 25, 200},
+    {"flow", 100, 900},
+    {"pump", 100, 200},
+};
+
+struct Mode {
+  const char* name;
+  bool adaptive;
+  bool fast;     // Fixed at the adaptive fast interval
+  float budget;  // Fraction, 0 for none
+};
+
+struct Result {
+  uint32_t samples = 0;
+  double busUs = 0;
+  double lagMs = 0;
+  double eventRms = 0;
+  double quietRms = 0;
+};
+
+static void run(const Mode& mode, std::vector<Sensor>& sensors, std::vector<Result>& results, std::mt19937& random) {
+  std::normal_distribution<float> gaussian(0, 1);
+  SampleBudget budget;
+  budget.setBudget(mode.budget);
+  FixedRate loops[sizeof(fixedUsers) / sizeof(FixedUser)];
+  for (size_t i = 0; i < sizeof(fixedUsers) / sizeof(FixedUser); i++) {
+    loops[i].setBudget(&budget);
+    for (int k = 0; k < 20; k++) {  // Settle the cost average
+      loops[i].update(fixedUsers[i].costUs, fixedUsers[i].intervalMs);
+    }
+  }
+  size_t count = sensors.size();
+  std::vector<AdaptiveRate> rates(count);
+  std::vector<uint32_t> next(count, 0);
+  std::vector<std::vector<std::pair<uint32_t, float>>> samples(count);
+
+  for (size_t i = 0; i < count; i++) {
+    const Sensor& s = sensors[i];
+    uint32_t fastMs = std::max(s.intervalMs / 4, s.minimumMs);  // sampleBoost 4
+    rates[i].configure(fastMs, s.intervalMs, s.threshold);      // sampleBackoff 1
+    if (mode.budget > 0) {
+      rates[i].setBudget(&budget);
+    }
+    next[i] = std::uniform_int_distribution<uint32_t>(0, s.intervalMs - 1)(random);
+  }
+
+  while (true) {
+    size_t i = std::min_element(next.begin(), next.end()) - next.begin();
+    uint32_t ms = next[i];
+    if (ms >= RUN_MS) {
+      break;
+    }
+    const Sensor& s = sensors[i];
+    float value = s.truth(ms) + s.noise * gaussian(random);
+    samples[i].push_back({ms, value});
+    results[i].samples++;
+    results[i].busUs += s.costUs;
+    uint32_t interval = s.intervalMs;
+    if (mode.adaptive) {
+      interval = rates[i].update(value, ms * 1000, s.costUs);
+    } else if (mode.fast) {
+      interval = std::max(s.intervalMs / 4, s.minimumMs);
+    }
+    next[i] = ms + interval;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const Sensor& s = sensors[i];
+    Result& r = results[i];
+    const auto& taken = samples[i];
+
+    // First sample after the truth moves past the threshold
+    for (uint32_t start : s.events) {
+      float before = s.truth(start);
+      uint32_t moved = start;
+      while (fabsf(s.truth(moved) - before) <= s.threshold) {
+        moved++;
+      }
+      auto after = std::lower_bound(taken.begin(), taken.end(), std::make_pair(moved, -INFINITY));
+      r.lagMs += after->first - moved;
+    }
+    r.lagMs /= s.events.size();
+
+    double eventSquares = 0, quietSquares = 0;
+    long eventCount = 0, quietCount = 0;
+    size_t k = 0;
+    for (uint32_t ms = taken.front().first; ms < taken.back().first; ms++) {
+      while (taken[k + 1].first <= ms) {
+        k++;
+      }
+      float f = (ms - taken[k].first) / float(taken[k + 1].first - taken[k].first);
+      float error = taken[k].second + f * (taken[k + 1].second - taken[k].second) - s.truth(ms);
+      bool inEvent = std::any_of(s.events.begin(), s.events.end(), [ms](uint32_t start) { return ms >= start && ms < start + EVENT_MS; });
+      if (inEvent) {
+        eventSquares += error * error;
+        eventCount++;
+      } else {
+        quietSquares += error * error;
+        quietCount++;
+      }
+    }
+    r.eventRms = std::sqrt(eventSquares / eventCount);
+    r.quietRms = std::sqrt(quietSquares / quietCount);
+  }
+}
+
+int main() {
+  std::vector<Sensor> sensors = {
+      {"angle1", 100, 10, 30, 900, 3, {120000, 390000}, knob},
+      {"angle2", 100, 10, 30, 900, 3, {}, knob},  // Left alone
+      {"conduct", 100, 50, 0.05f, 1000, 0.01f, {60000, 360000}, conductivity},
+      {"thermocouple", 1000, 250, 0.5f, 600, 0.1f, {180000}, temperature},
+  };
+  sensors[1].truth = [](uint32_t) { return 2500.0f; };
+  const Mode modes[] = {
+      {"fixed", false, false, 0},
+      {"fixed fast", false, true, 0},
+      {"adaptive", true, false, 0},
+      {"adaptive 15%", true, false, 0.15f},
+      {"adaptive 10%", true, false, 0.1f},
+      {"adaptive 7%", true, false, 0.07f},
+  };
+
+  printf("%-14s %-13s %8s %7s %8s %10s %10s\n", "mode", "sensor", "samples", "bus_%", "lag_ms", "event_rms", "quiet_rms");
+  for (const Mode& mode : modes) {
+    std::mt19937 random(1);
+    std::vector<Result> results(sensors.size());
+    for (int n = 0; n < RUNS; n++) {
+      std::vector<Result> one(sensors.size());
+      run(mode, sensors, one, random);
+      for (size_t i = 0; i < sensors.size(); i++) {
+        results[i].samples += one[i].samples;
+        results[i].busUs += one[i].busUs / RUNS;
+        results[i].lagMs += one[i].lagMs / RUNS;
+        results[i].eventRms += one[i].eventRms / RUNS;
+        results[i].quietRms += one[i].quietRms / RUNS;
+      }
+    }
+    double total = 0;
+    for (size_t i = 0; i < sensors.size(); i++) {
+      Result r = results[i];
+      r.samples /= RUNS;
+      total += r.busUs;
+      if (sensors[i].events.empty()) {
+        printf("%-14s %-13s %8u %7.2f %8s %10s %10.3f\n", mode.name, sensors[i].name, r.samples, r.busUs / (RUN_MS * 10.0), "-", "-",
+               r.quietRms);
+      } else {
+        printf("%-14s %-13s %8u %7.2f %8.0f %10.3f %10.3f\n", mode.name, sensors[i].name, r.samples, r.busUs / (RUN_MS * 10.0), r.lagMs,
+               r.eventRms, r.quietRms);
+      }
+    }
+    double loops = 0;
+    for (const FixedUser& user : fixedUsers) {
+      loops += user.costUs / (user.intervalMs * 10.0);
+    }
+    printf("%-14s %-13s %8s %7.2f\n", mode.name, "control loops", "", loops);
+    printf("%-14s %-13s %8s %7.2f\n", mode.name, "total", "", total / (RUN_MS * 10.0) + loops);
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Wall-clock timing for the host benches. The calls' results are summed
+// into a volatile so the optimiser can't drop the work being timed.
+
+#include <chrono>
+#include <cstdint>
+
+static volatile float benchSink;
+
+// Nanoseconds per call of call(i), for i from 0 to iterations - 1
+template <typename Call>
+static double nsPerCall(Call call, uint32_t iterations) {
+  auto start = std::chrono::steady_clock::now();
+  float total = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    total += call(i);
+  }
+  benchSink = total;
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
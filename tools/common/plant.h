@@ -0,0 +1,72 @@
+#pragma once
+
+// Simulated tank hardware for the host benches: the stirrer motor and its
+// encoder, and the inflow pump and its flowmeter, stepped in microseconds
+// with the PWM HBridgeTask would send.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "sensor_math.h"
+#include "speed_observer.h"
+
+// A first order motor with a little curvature in its speed/PWM line, so it
+// never quite matches the linear model the firmware assumes. Negative PWM
+// runs it backward. The encoder count is the integrated shaft position.
+struct SimMotor {
+  MotorModel model = {2.0f, 50, 250};
+  double curvature = 0.0008;  // rpm lost per PWM step squared above offset
+  double rpm = 0;
+  double position = 0;  // counts
+
+  double steadyRpm(double pwm) const {
+    double drive = std::fabs(pwm) - model.offset;
+    double rpm = drive > 0 ? model.gain * drive - curvature * drive * drive : 0;
+    return pwm < 0 ? -rpm : rpm;
+  }
+
+  void step(double pwm, double dtUs) {
+    double a = std::exp(-dtUs / 1000 / model.tauMs);
+    double next = a * rpm + (1 - a) * steadyRpm(pwm);
+    position += (rpm + next) / 2 * ENCODER_COUNTS_PER_REV / 60e6 * dtUs;
+    rpm = next;
+  }
+
+  uint32_t count() const { return (uint32_t)(int64_t)std::floor(position); }
+};
+
+// The inflow pump: first order from PWM to flow above a stall PWM, seen by
+// the flowmeter after a transport delay down the tube. The pulse count is
+// the integrated volume through the flowmeter.
+struct SimPump {
+  double gain = 0.012;        // L/min per PWM step above offset
+  double offset = 40;         // PWM below which nothing flows
+  double tauMs = 400;
+  double delayMs = 150;       // Pump to flowmeter
+  double kValue = 1420;       // Flowmeter pulses per litre
+  double flow = 0;            // L/min at the pump
+  double pulses = 0;
+  double delayed[64] = {};    // flow at the pump over the last delayMs, 5 ms a slot
+  int slot = 0;
+  double carryUs = 0;
+
+  double steadyFlow(double pwm) const { return pwm > offset ? gain * (pwm - offset) : 0; }
+
+  // Flow through the flowmeter
+  double meteredFlow() const { return delayed[(slot + 64 - delaySlots()) % 64]; }
+
+  void step(double pwm, double dtUs) {
+    double a = std::exp(-dtUs / 1000 / tauMs);
+    flow = a * flow + (1 - a) * steadyFlow(pwm);
+    for (carryUs += dtUs; carryUs >= 5000; carryUs -= 5000) {
+      slot = (slot + 1) % 64;
+      delayed[slot] = flow;
+    }
+    pulses += meteredFlow() / 60e6 * kValue * dtUs;
+  }
+
+  uint32_t count() const { return (uint32_t)(int64_t)std::floor(pulses); }
+
+  int delaySlots() const { return std::min(63, (int)(delayMs / 5)); }
+};
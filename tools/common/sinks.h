@@ -0,0 +1,177 @@
+#pragma once
+
+// Output sinks shared by the host-side telemetry tools. Each decoded sample
+// goes to a CSV file, to per-channel columnar files or is batched to the
+// InfluxDB v2 write API.
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "telemetry.h"
+
+class Sink {
+ public:
+  virtual ~Sink() {}
+  virtual void write(const std::string& device, uint8_t channel, int64_t timestamp, float value) = 0;
+  virtual void flush() {}
+};
+
+class CsvSink : public Sink {
+ public:
+  explicit CsvSink(FILE* _out) : out(_out) {
+    fprintf(out, "device,channel,timestamp_us,value\n");
+  }
+
+  void write(const std::string& device, uint8_t channel, int64_t timestamp, float value) override {
+    fprintf(out, "%s,%s,%lld,%g\n", device.c_str(), telemetryChannelName(channel), (long long)timestamp, value);
+  }
+
+  void flush() override { fflush(out); }
+
+ private:
+  FILE* out;
+};
+
+// Two raw little endian arrays per channel, <prefix>_<channel>.us (int64
+// timestamps) and <prefix>_<channel>.f32 (values), for numpy.fromfile and
+// friends. The device name isn't recorded, use one prefix per device.
+class ColumnarSink : public Sink {
+ public:
+  explicit ColumnarSink(std::string _prefix) : prefix(_prefix) {}
+
+  ~ColumnarSink() override {
+    for (auto& entry : columns) {
+      fclose(entry.second.timestamps);
+      fclose(entry.second.values);
+    }
+  }
+
+  void write(const std::string&, uint8_t channel, int64_t timestamp, float value) override {
+    auto it = columns.find(channel);
+    if (it == columns.end()) {
+      std::string base = prefix + "_" + telemetryChannelName(channel);
+      Columns files = {fopen((base + ".us").c_str(), "wb"), fopen((base + ".f32").c_str(), "wb")};
+      if (!files.timestamps || !files.values) {
+        perror(base.c_str());
+        exit(1);
+      }
+      it = columns.emplace(channel, files).first;
+    }
+    fwrite(&timestamp, sizeof(timestamp), 1, it->second.timestamps);
+    fwrite(&value, sizeof(value), 1, it->second.values);
+  }
+
+  void flush() override {
+    for (auto& entry : columns) {
+      fflush(entry.second.timestamps);
+      fflush(entry.second.values);
+    }
+  }
+
+ private:
+  struct Columns {
+    FILE* timestamps;
+    FILE* values;
+  };
+
+  std::string prefix;
+  std::map<uint8_t, Columns> columns;
+};
+
+// Minimal HTTP/1.1 client, one request per connection, enough for
+// /api/v2/write on the docker-compose InfluxDB
+class InfluxSink : public Sink {
+ public:
+  InfluxSink(std::string _host, std::string _port, std::string org, std::string bucket, std::string token, size_t _batchLines = 500)
+      : host(_host), port(_port), batchLines(_batchLines) {
+    path = "/api/v2/write?org=" + org + "&bucket=" + bucket + "&precision=ns";
+    auth = "Token " + token;
+  }
+
+  ~InfluxSink() override { flush(); }
+
+  void write(const std::string& device, uint8_t channel, int64_t timestamp, float value) override {
+    char line[160];
+    if (timestamp != 0) {
+      snprintf(line, sizeof(line), "mostr,device=%s %s=%g %lld000\n", device.c_str(), telemetryChannelName(channel), value, (long long)timestamp);
+    } else {
+      snprintf(line, sizeof(line), "mostr,device=%s %s=%g\n", device.c_str(), telemetryChannelName(channel), value);
+    }
+    body += line;
+    if (++lines >= batchLines) {
+      flush();
+    }
+  }
+
+  void flush() override {
+    if (lines == 0) {
+      return;
+    }
+    int status = post();
+    if (status != 204) {
+      fprintf(stderr, "influx: write of %zu lines failed (%d)\n", lines, status);
+      failed += lines;
+    }
+    body.clear();
+    lines = 0;
+  }
+
+  size_t failedLines() { return failed; }
+
+ private:
+  int post() {
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addr) != 0) {
+      return -1;
+    }
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+      freeaddrinfo(addr);
+      if (fd >= 0) {
+        close(fd);
+      }
+      return -1;
+    }
+    freeaddrinfo(addr);
+
+    std::string request = "POST " + path + " HTTP/1.1\r\nHost: " + host + "\r\nAuthorization: " + auth +
+                          "\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: " + std::to_string(body.size()) +
+                          "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < request.size()) {
+      ssize_t n = send(fd, request.data() + sent, request.size() - sent, 0);
+      if (n <= 0) {
+        close(fd);
+        return -1;
+      }
+      sent += n;
+    }
+
+    char response[64] = {};
+    ssize_t n = recv(fd, response, sizeof(response) - 1, 0);
+    close(fd);
+    int status = -1;
+    if (n > 0) {
+      sscanf(response, "HTTP/1.%*d %d", &status);
+    }
+    return status;
+  }
+
+  std::string host;
+  std::string port;
+  std::string path;
+  std::string auth;
+  std::string body;
+  size_t batchLines;
+  size_t lines = 0;
+  size_t failed = 0;
+};
@@ -0,0 +1,235 @@
+// Switches a tethered tank into the binary serial stream (SerialTelemetryTask)
+// and decodes it to CSV or columnar files, reporting dropped and corrupt
+// frames. On exit the device is put back into the PPEMD text mode.
+//
+//   serial-capture --port /dev/ttyUSB0 [--baud 1500000] [--from 115200] [--csv out.csv | --columns run1]
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#include "serial_frame.h"
+#include "sinks.h"
+#include "telemetry.h"
+
+struct CaptureStats {
+  bool started = false;
+  uint32_t nextSequence = 0;
+  uint64_t frames = 0;
+  uint64_t lost = 0;
+  uint64_t samples = 0;
+  uint64_t bytes = 0;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) { running = 0; }
+
+static void usage() {
+  fprintf(stderr,
+          "usage: serial-capture --port DEVICE [--baud N] [--from N] [--csv FILE | --columns PREFIX]\n"
+          "                      [--stats SECONDS]\n");
+  exit(2);
+}
+
+static speed_t speedFor(long baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+  }
+  fprintf(stderr, "unsupported baud rate %ld\n", baud);
+  exit(2);
+}
+
+static bool setBaud(int fd, long baud) {
+  termios tty = {};
+  if (tcgetattr(fd, &tty) != 0) {
+    return false;
+  }
+  cfmakeraw(&tty);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+  cfsetispeed(&tty, speedFor(baud));
+  cfsetospeed(&tty, speedFor(baud));
+  return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
+
+static void sendCommand(int fd, const char* command) {
+  if (write(fd, command, strlen(command)) < 0) {
+    perror("write");
+  }
+  tcdrain(fd);
+}
+
+static void printStats(const CaptureStats& s, const SerialFrameDecoder& decoder) {
+  uint64_t expected = s.frames + s.lost;
+  double loss = expected ? 100.0 * s.lost / expected : 0;
+  fprintf(stderr, "%llu bytes, %llu frames, %llu samples, %llu lost, %u corrupt, %.2f%% loss\n", (unsigned long long)s.bytes,
+          (unsigned long long)s.frames, (unsigned long long)s.samples, (unsigned long long)s.lost,
+          decoder.getErrors(), loss);
+}
+
+int main(int argc, char** argv) {
+  const char* port = NULL;
+  long baud = 1500000;
+  long from = 115200;
+  int statsInterval = 10;
+  const char* csvPath = NULL;
+  const char* columns = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+    }
+    if (arg == "--port") {
+      port = argv[++i];
+    } else if (arg == "--baud") {
+      baud = atol(argv[++i]);
+    } else if (arg == "--from") {
+      from = atol(argv[++i]);
+    } else if (arg == "--csv") {
+      csvPath = argv[++i];
+    } else if (arg == "--columns") {
+      columns = argv[++i];
+    } else if (arg == "--stats") {
+      statsInterval = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (port == NULL) {
+    usage();
+  }
+
+  std::unique_ptr<Sink> sink;
+  FILE* csv = NULL;
+  if (columns) {
+    sink.reset(new ColumnarSink(columns));
+  } else {
+    csv = csvPath ? fopen(csvPath, "w") : stdout;
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    sink.reset(new CsvSink(csv));
+  }
+
+  int fd = open(port, O_RDWR | O_NOCTTY);
+  if (fd < 0 || !setBaud(fd, from)) {
+    perror(port);
+    return 1;
+  }
+
+  // The reply to this still arrives as text at the old rate, the device
+  // only changes rate once it has gone out
+  char command[48];
+  snprintf(command, sizeof(command), "\nstream#binary#%ld\n", baud);
+  sendCommand(fd, command);
+  usleep(200000);
+  if (!setBaud(fd, baud)) {
+    perror(port);
+    return 1;
+  }
+  tcflush(fd, TCIFLUSH);
+
+  struct sigaction action = {};
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  SerialFrameDecoder decoder;
+  CaptureStats stats;
+  time_t lastStats = time(NULL);
+  uint8_t buffer[4096];
+
+  while (running) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(fd, &readable);
+    timeval timeout = {1, 0};
+    int ready = select(fd + 1, &readable, NULL, NULL, &timeout);
+
+    if (time(NULL) - lastStats >= statsInterval) {
+      sink->flush();
+      printStats(stats, decoder);
+      lastStats = time(NULL);
+    }
+    if (ready <= 0) {
+      continue;
+    }
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      continue;
+    }
+    stats.bytes += n;
+
+    for (ssize_t i = 0; i < n; i++) {
+      if (!decoder.push(buffer[i])) {
+        continue;
+      }
+      TelemetryHeader header;
+      const uint8_t* records;
+      if (!telemetryParse(decoder.data(), decoder.size(), &header, &records)) {
+        fprintf(stderr, "malformed frame (%zu bytes)\n", decoder.size());
+        continue;
+      }
+
+      // One sequence counts sample and text frames alike, a frame dropped
+      // on the device still used up its number
+      int32_t gap = stats.started ? (int32_t)(header.sequence - stats.nextSequence) : 0;
+      if (gap > 0) {
+        stats.lost += gap;
+      } else if (gap < 0) {
+        fprintf(stderr, "sequence restarted\n");
+      }
+      stats.started = true;
+      stats.nextSequence = header.sequence + 1;
+      stats.frames++;
+
+      if (header.type == TELEMETRY_TEXT) {
+        fprintf(stderr, "device: %.*s", (int)(decoder.size() - sizeof(TelemetryHeader)), (const char*)records);
+        continue;
+      }
+      if (header.type != TELEMETRY_UPTIME_SAMPLES && header.type != TELEMETRY_SAMPLES) {
+        continue;
+      }
+      for (int r = 0; r < header.count; r++) {
+        TelemetryRecord record = telemetryRecord(records, r);
+        sink->write(port, record.channel, telemetryTimestamp(header, record), record.value);
+        stats.samples++;
+      }
+    }
+  }
+
+  snprintf(command, sizeof(command), "\nstream#text#%ld\n", from);
+  sendCommand(fd, command);
+  close(fd);
+
+  sink->flush();
+  printStats(stats, decoder);
+  sink.reset();
+  if (csv && csv != stdout) {
+    fclose(csv);
+  }
+  return 0;
+}
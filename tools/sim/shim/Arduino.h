@@ -0,0 +1,88 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core the control tasks use.
+// Time is simulated: micros() and millis() read simClock, which only moves
+// when the harness or a bus transaction calls simAdvance().
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+struct SimClock {
+  uint64_t us = 0;
+  // Steps the plant models along with the clock, set by the harness
+  void (*onAdvance)(uint32_t us) = NULL;
+};
+
+inline SimClock simClock;
+
+inline void simAdvance(uint32_t us) {
+  simClock.us += us;
+  if (simClock.onAdvance != NULL) {
+    simClock.onAdvance(us);
+  }
+}
+
+inline unsigned long micros() { return (uint32_t)simClock.us; }
+inline unsigned long millis() { return (uint32_t)(simClock.us / 1000); }
+inline void delay(unsigned long ms) { simAdvance(ms * 1000); }
+inline void yield() {}
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return length < 0 ? 0 : write((const uint8_t*)buffer, strnlen(buffer, sizeof(buffer)));
+  }
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(long value, int base = DEC) { return printf(base == HEX ? "%lX" : "%ld", value); }
+  size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+  size_t println() { return write("\n"); }
+
+  template <typename T>
+  size_t println(T value) {
+    return print(value) + println();
+  }
+
+  template <typename T>
+  size_t println(T value, int format) {
+    return print(value, format) + println();
+  }
+};
+
+// Firmware log output goes to stderr, keeping stdout for the harness
+class HardwareSerial : public Print {
+ public:
+  size_t write(uint8_t c) { return fputc(c, stderr) == EOF ? 0 : 1; }
+  using Print::write;
+};
+
+inline HardwareSerial Serial;
@@ -0,0 +1,69 @@
+#pragma once
+
+// Host stand-in for TaskSchedulerEvents. Events go straight to every
+// handler from dispatch() rather than on the next scheduler pass, which
+// the harness's 1 ms passes make no practical difference to.
+
+#include <TaskSchedulerDeclarations.h>
+
+namespace TSEvents {
+
+#define TSEVENTS_MAX_HANDLERS 16
+#define TSEVENTS_MAX_DATA 32
+
+struct Event {
+  uint16_t id;
+  void* data;
+  size_t size;
+};
+
+class EventHandler;
+
+class EventBus {
+ public:
+  void subscribe(EventHandler* handler) {
+    if (handlerCount < TSEVENTS_MAX_HANDLERS) {
+      handlers[handlerCount++] = handler;
+    }
+  }
+
+  void publish(uint16_t id, const void* data, size_t size);
+
+ private:
+  EventHandler* handlers[TSEVENTS_MAX_HANDLERS];
+  int handlerCount = 0;
+};
+
+class EventEmitter {
+ public:
+  EventEmitter(EventBus* _bus) : bus(_bus) {}
+
+  void dispatch(uint16_t id, const void* data = NULL, size_t size = 0) {
+    bus->publish(id, data, size);
+  }
+
+ private:
+  EventBus* bus;
+};
+
+class EventHandler : public EventEmitter {
+ public:
+  EventHandler(Scheduler*, EventBus* e) : EventEmitter(e) { e->subscribe(this); }
+  virtual ~EventHandler() {}
+  virtual void HandleEvent(Event event) = 0;
+};
+
+inline void EventBus::publish(uint16_t id, const void* data, size_t size) {
+  // A copy, as the real bus queues one
+  uint8_t copy[TSEVENTS_MAX_DATA];
+  size = data == NULL ? 0 : size < sizeof(copy) ? size : sizeof(copy);
+  if (size > 0) {
+    memcpy(copy, data, size);
+  }
+  for (int i = 0; i < handlerCount; i++) {
+    Event event = {id, size > 0 ? copy : (void*)data, size};
+    handlers[i]->HandleEvent(event);
+  }
+}
+
+}  // namespace TSEvents
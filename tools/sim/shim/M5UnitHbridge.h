@@ -0,0 +1,56 @@
+#pragma once
+
+// Host stand-in for the M5 H-bridge unit. Writes cost bus time like the
+// real register writes and land in simUnits for the channel selected on
+// the PaHub.
+
+#include <Wire.h>
+
+#include "sim_units.h"
+
+#define HBRIDGE_ADDR 0x20
+#define HBRIDGE_CONFIG_REG 0x00
+#define HBRIDGE_PWM8BIT_REG 0x10
+
+typedef enum {
+  HBRIDGE_STOP = 0,
+  HBRIDGE_FORWARD,
+  HBRIDGE_BACKWARD,
+} hbridge_direction_t;
+
+class M5UnitHbridge {
+ public:
+  bool begin(TwoWire* _wire = &Wire, uint8_t _address = HBRIDGE_ADDR, uint8_t = 21, uint8_t = 22, uint32_t = 100000L) {
+    wire = _wire;
+    address = _address;
+    return true;
+  }
+
+  void setDriverDirection(hbridge_direction_t direction) {
+    writeRegister(HBRIDGE_CONFIG_REG, direction);
+    if (wire->getChannel() >= 0) {
+      simUnits.direction[wire->getChannel()] = direction;
+    }
+  }
+
+  void setDriverSpeed8Bits(uint8_t speed) {
+    writeRegister(HBRIDGE_PWM8BIT_REG, speed);
+    if (wire->getChannel() >= 0) {
+      simUnits.speed[wire->getChannel()] = speed;
+    }
+  }
+
+ private:
+  void writeRegister(uint8_t reg, uint8_t value) {
+    wire->beginTransmission(address);
+    wire->write(reg);
+    wire->write(value);
+    wire->endTransmission();
+    if (wire->getChannel() >= 0) {
+      simUnits.writes[wire->getChannel()]++;
+    }
+  }
+
+  TwoWire* wire = &Wire;
+  uint8_t address = HBRIDGE_ADDR;
+};
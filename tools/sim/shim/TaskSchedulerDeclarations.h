@@ -0,0 +1,117 @@
+#pragma once
+
+// Host stand-in for TaskScheduler with _TASK_OO_CALLBACKS: tasks run from
+// Scheduler::execute() when their interval has passed on the simulated
+// clock, in the order they were constructed. As in TaskScheduler, a task
+// that runs late keeps its schedule rather than drifting, unless it has
+// fallen a whole interval behind.
+
+#include <Arduino.h>
+
+#define TASK_MILLISECOND 1UL
+#define TASK_SECOND 1000UL
+#define TASK_MINUTE 60000UL
+#define TASK_IMMEDIATE 0
+#define TASK_FOREVER (-1)
+#define TASK_ONCE 1
+
+class Scheduler;
+
+class Task {
+ public:
+  Task(unsigned long _interval = 0, long _iterations = 0, Scheduler* s = NULL, bool _enable = false);
+  virtual ~Task() {}
+
+  virtual bool Callback() { return true; }
+  virtual bool OnEnable() { return true; }
+  virtual void OnDisable() {}
+
+  bool enable() {
+    enabled = OnEnable();
+    runs = 0;
+    lastMs = millis() - interval;  // Due straight away
+    return enabled;
+  }
+
+  bool disable() {
+    bool was = enabled;
+    if (enabled) {
+      enabled = false;
+      OnDisable();
+    }
+    return was;
+  }
+
+  bool isEnabled() { return enabled; }
+
+  // Next run is an interval from now
+  void setInterval(unsigned long _interval) {
+    interval = _interval;
+    lastMs = millis();
+  }
+
+  unsigned long getInterval() { return interval; }
+  unsigned long getRunCounter() { return runs; }
+
+ private:
+  friend class Scheduler;
+
+  bool due(uint32_t now) { return enabled && now - lastMs >= interval; }
+
+  void run(uint32_t now) {
+    lastMs += interval;
+    if (now - lastMs >= interval) {
+      lastMs = now;
+    }
+    runs++;
+    Callback();
+    if (iterations > 0 && (long)runs >= iterations) {
+      disable();
+    }
+  }
+
+  unsigned long interval;
+  long iterations;
+  bool enabled = false;
+  uint32_t lastMs = 0;
+  unsigned long runs = 0;
+  Task* next = NULL;
+};
+
+class Scheduler {
+ public:
+  void addTask(Task* task) {
+    Task** tail = &first;
+    while (*tail != NULL) {
+      tail = &(*tail)->next;
+    }
+    *tail = task;
+  }
+
+  // One pass over the chain, returns true if nothing was due
+  bool execute() {
+    bool idle = true;
+    for (Task* task = first; task != NULL; task = task->next) {
+      uint32_t now = millis();
+      if (task->due(now)) {
+        task->run(now);
+        idle = false;
+      }
+    }
+    return idle;
+  }
+
+ private:
+  Task* first = NULL;
+};
+
+inline Task::Task(unsigned long _interval, long _iterations, Scheduler* s, bool _enable) {
+  interval = _interval;
+  iterations = _iterations;
+  if (s != NULL) {
+    s->addTask(this);
+  }
+  if (_enable) {
+    enable();
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Host stand-in for the M5 Ext-encoder unit, returning the count in
+// simUnits for the channel selected on the PaHub. Reads cost the bus time
+// of a register address write and a 4 byte read.
+
+#include <Wire.h>
+
+#include "sim_units.h"
+
+#define UNIT_EXT_ENCODER_ADDR 0x59
+#define UNIT_EXT_ENCODER_ENCODER_REG 0x00
+#define UNIT_EXT_ENCODER_ZERO_PULSE_VALUE_REG 0x20
+
+class UNIT_EXT_ENCODER {
+ public:
+  bool begin(TwoWire* _wire = &Wire, uint8_t _address = UNIT_EXT_ENCODER_ADDR, uint8_t = 21, uint8_t = 22, uint32_t = 100000L) {
+    wire = _wire;
+    address = _address;
+    return true;
+  }
+
+  uint32_t getEncoderValue() { return readCount(UNIT_EXT_ENCODER_ENCODER_REG); }
+
+  // FlowSensorTask reads the flowmeter's pulses here
+  uint32_t getZeroPulseValue() { return readCount(UNIT_EXT_ENCODER_ZERO_PULSE_VALUE_REG); }
+
+  void setZeroPulseValue(uint32_t value) {
+    wire->beginTransmission(address);
+    wire->write(UNIT_EXT_ENCODER_ZERO_PULSE_VALUE_REG);
+    for (int i = 0; i < 4; i++) {
+      wire->write(value >> (8 * i));
+    }
+    wire->endTransmission();
+  }
+
+ private:
+  uint32_t readCount(uint8_t reg) {
+    wire->beginTransmission(address);
+    wire->write(reg);
+    wire->endTransmission();
+    wire->requestFrom(address, 4);
+    while (wire->available()) {
+      wire->read();
+    }
+    return wire->getChannel() >= 0 ? simUnits.count[wire->getChannel()] : 0;
+  }
+
+  TwoWire* wire = &Wire;
+  uint8_t address = UNIT_EXT_ENCODER_ADDR;
+};
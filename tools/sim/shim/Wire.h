@@ -0,0 +1,80 @@
+#pragma once
+
+// Host stand-in for the I2C bus. Nothing is sent anywhere, but every
+// transaction costs the time it would take at 100 kHz, so the tasks see
+// realistic timing and the harness can report bus load. Writes to the
+// PaHub select which channel the simulated units in M5UnitHbridge.h and
+// UNIT_EXT_ENCODER.h answer on.
+
+#include <Arduino.h>
+
+#define SIM_PAHUB_ADDRESS 0x70
+#define SIM_I2C_CLOCK_HZ 100000
+#define SIM_I2C_OVERHEAD_US 20  // Start, stop and the driver around them
+
+class TwoWire {
+ public:
+  bool begin(int = -1, int = -1, uint32_t = 0) { return true; }
+  void setClock(uint32_t) {}
+
+  void beginTransmission(int address) {
+    txAddress = address;
+    txLength = 0;
+  }
+
+  size_t write(uint8_t data) {
+    if (txLength < sizeof(txBuffer)) {
+      txBuffer[txLength++] = data;
+    }
+    return 1;
+  }
+
+  uint8_t endTransmission(bool = true) {
+    if (txAddress == SIM_PAHUB_ADDRESS && txLength == 1) {
+      channel = txBuffer[0] == 0 ? -1 : __builtin_ctz(txBuffer[0]);
+    }
+    transfer(txLength);
+    return 0;
+  }
+
+  // Reads back zeros, the simulated units answer through their own classes
+  uint8_t requestFrom(int, int quantity, bool = true) {
+    transfer(quantity);
+    rxAvailable = quantity;
+    return quantity;
+  }
+
+  int available() { return rxAvailable; }
+
+  int read() {
+    if (rxAvailable == 0) {
+      return -1;
+    }
+    rxAvailable--;
+    return 0;
+  }
+
+  // PaHub channel last selected, -1 for none
+  int getChannel() const { return channel; }
+  uint32_t getTransactions() const { return transactions; }
+  uint64_t getBusyUs() const { return busyUs; }
+
+ private:
+  void transfer(size_t bytes) {
+    // Address byte plus data, 9 clocks a byte with the ack
+    uint32_t us = SIM_I2C_OVERHEAD_US + (1 + bytes) * 9 * 1000000 / SIM_I2C_CLOCK_HZ;
+    transactions++;
+    busyUs += us;
+    simAdvance(us);
+  }
+
+  int txAddress = 0;
+  uint8_t txBuffer[32];
+  size_t txLength = 0;
+  int rxAvailable = 0;
+  int channel = -1;
+  uint32_t transactions = 0;
+  uint64_t busyUs = 0;
+};
+
+inline TwoWire Wire;
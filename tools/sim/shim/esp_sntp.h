@@ -0,0 +1,17 @@
+#pragma once
+
+// Host stand-in for the SNTP and critical section calls in timesync.h.
+// Nothing syncs, so readings are stamped from the host's own clock.
+
+#include <sys/time.h>
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#define SNTP_SYNC_MODE_SMOOTH 1
+inline void sntp_set_sync_mode(int) {}
+inline void sntp_set_sync_interval(uint32_t) {}
+inline void sntp_set_time_sync_notification_cb(void (*)(struct timeval*)) {}
+inline void configTime(long, int, const char*) {}
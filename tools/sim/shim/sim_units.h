@@ -0,0 +1,19 @@
+#pragma once
+
+// State of the simulated M5 units behind each PaHub channel, shared
+// between the unit stand-ins and the harness's plant models
+
+#include <stdint.h>
+
+#define SIM_CHANNELS 8
+
+struct SimUnits {
+  // H-bridge: what was last written, and how many writes
+  uint8_t speed[SIM_CHANNELS] = {};
+  uint8_t direction[SIM_CHANNELS] = {};
+  uint32_t writes[SIM_CHANNELS] = {};
+  // Ext-encoder: the count the plant has got to
+  uint32_t count[SIM_CHANNELS] = {};
+};
+
+inline SimUnits simUnits;
@@ -0,0 +1,529 @@
+// Closed loop simulation of the stirrer and the inflow pump. The firmware's
+// own EncoderTask, FlowSensorTask and HBridgeTask are built against host
+// stand-ins for Arduino, TaskScheduler and the M5 units (tools/sim/shim),
+// sharing one simulated I2C bus, and drive the motor and pump models in
+// tools/common/plant.h. Time is simulated, so a minute of profile runs in
+// a fraction of a second.
+//
+// A profile is a script of setpoint changes. For each step it reports,
+// on the true speed or flow rather than what the firmware measured:
+//
+// - rise_ms: 10% to 90% of the way to the new setpoint
+// - overshoot: furthest past the new setpoint
+// - settle_ms: from the step until it stays within the band (5 rpm,
+//   0.05 L/min), -1 if it never does
+// - ss_error: mean error over the step's last second
+// - effort: total PWM movement per second
+//
+// as CSV (default) or JSON, so runs with different settings can be diffed
+// or plotted. Exits 1 if any step overshoots or takes longer to settle than
+// its loop's limits below, so a control change that regresses the built-in
+// profile fails.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <tasks/FlowSensor.cpp>
+#include <tasks/HBridge.cpp>
+
+#include "config_fields.h"
+#include "plant.h"
+
+#define STIRRER_CHANNEL 0
+#define PUMP_CHANNEL 1
+#define FLOWMETER_CHANNEL 5
+
+#define SAMPLE_US 1000     // Harness passes and metric samples
+#define TRACE_US 10000     // --trace rows
+#define SS_WINDOW_US 1000000
+
+// Pass/fail limits for every step, in rpm and L/min
+#define STIRRER_OVERSHOOT_LIMIT 10
+#define STIRRER_SETTLE_LIMIT_MS 2000
+#define PUMP_OVERSHOOT_LIMIT 0.1
+#define PUMP_SETTLE_LIMIT_MS 3000
+
+enum SettingType { SETTING_FLOAT, SETTING_DOUBLE };
+
+typedef struct {
+  const char* key;
+  SettingType type;
+  void* value;
+} Setting;
+
+// config.h's defaults, except for two set in main() so the sim exercises
+// what the tank does: the flowmeter's K factor is the RS 508-2704's rather
+// than 1, and the pump starts under flow control
+static Config config;
+static SimMotor motor;
+static SimPump pump;
+
+// The simulated hardware, see plant.h
+static const Setting plantSettings[] = {
+    {"motorGain", SETTING_FLOAT, &motor.model.gain},
+    {"motorOffset", SETTING_FLOAT, &motor.model.offset},
+    {"motorTau", SETTING_FLOAT, &motor.model.tauMs},
+    {"motorCurvature", SETTING_DOUBLE, &motor.curvature},
+    {"pumpGain", SETTING_DOUBLE, &pump.gain},
+    {"pumpOffset", SETTING_DOUBLE, &pump.offset},
+    {"pumpTau", SETTING_DOUBLE, &pump.tauMs},
+    {"pumpDelay", SETTING_DOUBLE, &pump.delayMs},
+};
+
+// Applies "key=value" for a config.json key, checked as the firmware checks
+// config.json. Returns an error message or NULL.
+static const char* applyConfigSetting(const char* assignment) {
+  static char error[64];
+  const char* equals = strchr(assignment, '=');
+  if (equals == NULL) {
+    return "use key=value";
+  }
+  char key[32];
+  snprintf(key, sizeof(key), "%.*s", (int)(equals - assignment), assignment);
+  const ConfigField* field = findConfigField(key);
+  if (field == NULL) {
+    return "unknown key";
+  }
+  const char* text = equals + 1;
+  void* value = (uint8_t*)&config + field->offset;
+  char* end;
+  float number = 0;
+  switch (field->type) {
+    case CONFIG_STRING:
+      if (strlen(text) >= field->size) {
+        return "too long";
+      }
+      if (field->check != NULL && field->check(text) != NULL) {
+        return field->check(text);
+      }
+      strcpy((char*)value, text);
+      return NULL;
+    case CONFIG_INT:
+      number = strtol(text, &end, 10);
+      break;
+    case CONFIG_FLOAT:
+      number = strtof(text, &end);
+      break;
+  }
+  if (end == text || *end != '\0') {
+    return "not a number";
+  }
+  if (!(number >= field->minimum && number <= field->maximum)) {
+    snprintf(error, sizeof(error), "must be %g to %g", field->minimum, field->maximum);
+    return error;
+  }
+  if (field->type == CONFIG_INT) {
+    *(int*)value = number;
+  } else {
+    *(float*)value = number;
+  }
+  return NULL;
+}
+
+// Applies "key=value", returns an error message or NULL
+static const char* applySetting(const Setting* settings, int count, const char* assignment) {
+  const char* equals = strchr(assignment, '=');
+  if (equals == NULL) {
+    return "use key=value";
+  }
+  for (int i = 0; i < count; i++) {
+    const Setting& s = settings[i];
+    if (strlen(s.key) != (size_t)(equals - assignment) || strncmp(s.key, assignment, equals - assignment) != 0) {
+      continue;
+    }
+    const char* text = equals + 1;
+    char* end;
+    switch (s.type) {
+      case SETTING_FLOAT:
+        *(float*)s.value = strtof(text, &end);
+        return end == text || *end != '\0' ? "not a number" : NULL;
+      case SETTING_DOUBLE:
+        *(double*)s.value = strtod(text, &end);
+        return end == text || *end != '\0' ? "not a number" : NULL;
+    }
+  }
+  return "unknown key";
+}
+
+// Profile script: one "<seconds> <command> <value>" per line, # for
+// comments. Commands are setpoint (stirrer rpm), reverse (1 to run the
+// stirrer backward, 0 forward), flow (pump L/min, under flow control), pump
+// (open loop PWM) and end.
+typedef struct {
+  uint64_t us;
+  char command[12];
+  float value;
+} ProfileEvent;
+
+static const char* defaultProfile =
+    "1 setpoint 350\n"
+    "2 flow 1.0\n"
+    "5 setpoint 100\n"
+    "7 flow 0.4\n"
+    "9 setpoint 300\n"
+    "12 flow 1.6\n"
+    "13 setpoint 200\n"
+    "17 end\n";
+
+static const char* parseProfile(const char* text, std::vector<ProfileEvent>* events) {
+  static char error[112];
+  int line = 0;
+  for (const char* p = text; *p != '\0'; p = strchr(p, '\n') ? strchr(p, '\n') + 1 : p + strlen(p)) {
+    line++;
+    char row[128];
+    size_t length = strcspn(p, "\n");
+    snprintf(row, sizeof(row), "%.*s", (int)length, p);
+    char* hash = strchr(row, '#');
+    if (hash != NULL) {
+      *hash = '\0';
+    }
+    double seconds;
+    ProfileEvent event = {};
+    int fields = sscanf(row, "%lf %11s %f", &seconds, event.command, &event.value);
+    if (fields <= 0) {
+      continue;
+    }
+    bool known = strcmp(event.command, "setpoint") == 0 || strcmp(event.command, "reverse") == 0 ||
+                 strcmp(event.command, "flow") == 0 || strcmp(event.command, "pump") == 0 || strcmp(event.command, "end") == 0;
+    if (fields < 2 || !known || (fields < 3 && strcmp(event.command, "end") != 0) || seconds < 0 ||
+        (!events->empty() && seconds * 1e6 < events->back().us)) {
+      snprintf(error, sizeof(error), "line %d: use <seconds> setpoint|reverse|flow|pump <value> or <seconds> end, in order", line);
+      return error;
+    }
+    event.us = seconds * 1e6;
+    events->push_back(event);
+  }
+  if (events->empty() || strcmp(events->back().command, "end") != 0) {
+    return "the profile has to finish with <seconds> end";
+  }
+  return NULL;
+}
+
+// Step response metrics from the true plant output, see the top of the file
+struct StepMetrics {
+  const char* loop;
+  double atS;
+  double from;
+  double to;
+  double riseMs;
+  double overshoot;
+  double settleMs;
+  double ssError;
+  double effort;
+};
+
+typedef struct {
+  uint64_t us;
+  double value;
+  int pwm;
+} Sample;
+
+class LoopRecorder {
+ public:
+  LoopRecorder(const char* _name, double _band, double _overshootLimit, double _settleLimitMs)
+      : name(_name), band(_band), overshootLimit(_overshootLimit), settleLimitMs(_settleLimitMs) {}
+
+  // Prints each step past the limits on stderr, returns false if any were
+  bool check(const std::vector<StepMetrics>& results) const {
+    bool ok = true;
+    for (const StepMetrics& r : results) {
+      if (strcmp(r.loop, name) != 0) {
+        continue;
+      }
+      if (r.overshoot > overshootLimit || r.settleMs < 0 || r.settleMs > settleLimitMs) {
+        fprintf(stderr, "FAIL %s %g -> %g: overshoot %.4g (limit %g), settle_ms %.0f (limit %.0f)\n", name, r.from, r.to,
+                r.overshoot, overshootLimit, r.settleMs, settleLimitMs);
+        ok = false;
+      }
+    }
+    return ok;
+  }
+
+  void setpointChanged(double setpoint, uint64_t now, std::vector<StepMetrics>* results) {
+    finish(results);
+    from = to;
+    to = setpoint;
+    startUs = now;
+    samples.clear();
+  }
+
+  void sample(double value, int pwm, uint64_t now) { samples.push_back({now, value, pwm}); }
+
+  // Closes the current step, if it was one
+  void finish(std::vector<StepMetrics>* results) {
+    if (from == to || samples.size() < 2) {
+      return;
+    }
+    double size = to - from;
+    double sign = size > 0 ? 1 : -1;
+    uint64_t endUs = samples.back().us;
+    double riseStart = -1, riseEnd = -1, overshoot = 0, settleUs = 0, errorSum = 0, effort = 0;
+    int errorCount = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      const Sample& s = samples[i];
+      double progress = (s.value - from) / size;
+      double at = s.us - startUs;
+      if (riseStart < 0 && progress >= 0.1) {
+        riseStart = at;
+      }
+      if (riseEnd < 0 && progress >= 0.9) {
+        riseEnd = at;
+      }
+      overshoot = std::max(overshoot, (s.value - to) * sign);
+      if (std::fabs(s.value - to) > band) {
+        settleUs = at;
+      }
+      if (endUs - s.us < SS_WINDOW_US) {
+        errorSum += s.value - to;
+        errorCount++;
+      }
+      if (i > 0) {
+        effort += std::abs(s.pwm - samples[i - 1].pwm);
+      }
+    }
+    bool settled = std::fabs(samples.back().value - to) <= band;
+    results->push_back({name, startUs * 1e-6, from, to, riseEnd >= 0 ? (riseEnd - riseStart) / 1000 : -1, overshoot,
+                        settled ? settleUs / 1000 : -1, errorSum / errorCount, effort / ((endUs - startUs) * 1e-6)});
+  }
+
+ private:
+  const char* name;
+  double band;
+  double overshootLimit;
+  double settleLimitMs;
+  double from = 0;
+  double to = 0;
+  uint64_t startUs = 0;
+  std::vector<Sample> samples;
+};
+
+// Stands in for main.cpp's EventBridge, keeping the latest flow reading
+class FlowReadings : public TSEvents::EventHandler {
+ public:
+  FlowReadings(Scheduler& s, TSEvents::EventBus& e) : TSEvents::EventHandler(&s, &e) {}
+
+  void HandleEvent(TSEvents::Event event) {
+    if (event.id == FLOW_SENSOR_1_DATA) {
+      latest = ((SensorReading*)event.data)->value;
+    }
+  }
+
+  float latest = 0;
+};
+
+// Signed PWM the H-bridge on a channel is driving
+static int drive(int channel) {
+  switch (simUnits.direction[channel]) {
+    case HBRIDGE_FORWARD:
+      return simUnits.speed[channel];
+    case HBRIDGE_BACKWARD:
+      return -simUnits.speed[channel];
+    default:
+      return 0;
+  }
+}
+
+static void stepPlants(uint32_t us) {
+  motor.step(drive(STIRRER_CHANNEL), us);
+  pump.step(std::max(drive(PUMP_CHANNEL), 0), us);
+  simUnits.count[STIRRER_CHANNEL] = motor.count();
+  simUnits.count[FLOWMETER_CHANNEL] = pump.count();
+}
+
+static char* readFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char* text = (char*)malloc(size + 1);
+  size_t read = fread(text, 1, size, file);
+  text[read] = '\0';
+  fclose(file);
+  return text;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: tank-sim [--profile <file>] [--set <config key>=<value>]... [--plant <key>=<value>]...\n"
+          "                [--json] [--trace <file.csv>]\n"
+          "config keys: any from config.json, see config_fields.h\n"
+          "plant keys:");
+  for (const Setting& s : plantSettings) {
+    fprintf(stderr, " %s", s.key);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  setConfigDefaults(config);
+  config.flowK = 1420;
+  config.pumpFlowControl = 1;
+  const char* profileText = defaultProfile;
+  const char* tracePath = NULL;
+  bool json = false;
+  for (int i = 1; i < argc; i++) {
+    const char* error = NULL;
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profileText = readFile(argv[++i]);
+      error = profileText == NULL ? "can't read the profile" : NULL;
+    } else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+      error = applyConfigSetting(argv[++i]);
+    } else if (strcmp(argv[i], "--plant") == 0 && i + 1 < argc) {
+      error = applySetting(plantSettings, sizeof(plantSettings) / sizeof(Setting), argv[++i]);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      usage();
+      return 2;
+    }
+    if (error != NULL) {
+      fprintf(stderr, "%s: %s\n", argv[i], error);
+      return 2;
+    }
+  }
+  std::vector<ProfileEvent> profile;
+  const char* error = parseProfile(profileText, &profile);
+  if (error != NULL) {
+    fprintf(stderr, "profile: %s\n", error);
+    return 2;
+  }
+  FILE* trace = NULL;
+  if (tracePath != NULL) {
+    trace = fopen(tracePath, "w");
+    if (trace == NULL) {
+      fprintf(stderr, "can't write %s\n", tracePath);
+      return 2;
+    }
+    fprintf(trace, "t_ms,rpm_setpoint,rpm,rpm_feedback,stirrer_pwm,flow_setpoint,flow,flow_reading,pump_pwm\n");
+  }
+
+  // Built and configured as main.cpp's setup() and apply* functions do
+  Scheduler ts;
+  TSEvents::EventBus e;
+  I2CHubTask i2cHub(ts, e, SIM_PAHUB_ADDRESS, Wire);
+  EncoderTask encoder(ts, e, &i2cHub, STIRRER_CHANNEL, ENCODER_1_DATA, ENCODER_1_LATENCY_DATA, ENCODER_1_NOISE_DATA, Wire,
+                      config.encoderInterval * TASK_MILLISECOND);
+  encoder.setEstimator(config.encoderMinCounts, config.encoderMaxWindow);
+  HBridgeTask stirrer(ts, e, &i2cHub, &encoder, STIRRER_CHANNEL, Wire, 0x20, config.stirrerInterval * TASK_MILLISECOND);
+  stirrer.setGains({config.rpmKp, config.rpmKi, config.rpmKd, config.rpmRamp, config.rpmTracking});
+  stirrer.setMaxRPM(config.maxRpm);
+  stirrer.setModel({config.motorGain, config.motorOffset, config.motorTau}, config.observerNoise);
+  stirrer.setFeedback(config.rpmFeedback == 1);
+  FeedforwardMap feedforward;
+  buildStirrerFeedforward(config, &feedforward);
+  stirrer.setFeedforward(feedforward);
+  stirrer.setRPM(0);
+  stirrer.setSlewRate(config.stirrerSlew);
+  stirrer.setReverse(config.stirrerReverse == 1);
+  HBridgeTask pumpTask(ts, e, &i2cHub, NULL, PUMP_CHANNEL, Wire, 0x20, config.pumpInterval * TASK_MILLISECOND);
+  feedforward.clear();
+  feedforward.parse(config.flowFeedforward);
+  pumpTask.setGains({config.flowKp, config.flowKi, config.flowKd, 0, 0});
+  pumpTask.setFeedforward(feedforward);
+  pumpTask.setMaxFlow(config.maxFlow);
+  pumpTask.setFlowControl(config.pumpFlowControl == 1);
+  pumpTask.setSlewRate(config.pumpSlew);
+  FlowSensorTask flowSensor(ts, e, &i2cHub, FLOWMETER_CHANNEL, FLOW_SENSOR_1_DATA, config.flowK, config.flowCorrectK, Wire,
+                            config.flowInterval * TASK_MILLISECOND);
+  if (encoder.setFilter(config.encoderFilter) != NULL || flowSensor.setFilter(config.flowFilter) != NULL) {
+    fprintf(stderr, "bad encoderFilter or flowFilter, see filters.h\n");
+    return 2;
+  }
+  FlowReadings flowReadings(ts, e);
+
+  simClock.onAdvance = stepPlants;
+  i2cHub.enable();
+  encoder.enable();
+  stirrer.enable();
+  pumpTask.enable();
+  flowSensor.enable();
+
+  std::vector<StepMetrics> results;
+  LoopRecorder stirrerLoop("stirrer", 5, STIRRER_OVERSHOOT_LIMIT, STIRRER_SETTLE_LIMIT_MS);
+  LoopRecorder pumpLoop("pump", 0.05, PUMP_OVERSHOOT_LIMIT, PUMP_SETTLE_LIMIT_MS);
+  size_t next = 0;
+  uint64_t endUs = profile.back().us;
+  uint64_t nextTraceUs = 0;
+  while (simClock.us < endUs) {
+    for (; next < profile.size() && profile[next].us <= simClock.us; next++) {
+      const ProfileEvent& event = profile[next];
+      // The stirrer's speeds are signed, negative backward
+      if (strcmp(event.command, "setpoint") == 0 || strcmp(event.command, "reverse") == 0) {
+        if (strcmp(event.command, "setpoint") == 0) {
+          stirrer.setRPM(event.value);
+        } else {
+          stirrer.setReverse(event.value != 0);
+        }
+        stirrerLoop.setpointChanged(stirrer.getRPMSetpoint() * (stirrer.isReverse() ? -1 : 1), simClock.us, &results);
+      } else if (strcmp(event.command, "flow") == 0) {
+        if (!pumpTask.isFlowControl()) {
+          fprintf(stderr, "profile: flow needs pumpFlowControl=1\n");
+          return 2;
+        }
+        pumpTask.setFlow(event.value);
+        pumpLoop.setpointChanged(pumpTask.getFlowSetpoint(), simClock.us, &results);
+      } else if (strcmp(event.command, "pump") == 0) {
+        if (pumpTask.isFlowControl()) {
+          fprintf(stderr, "profile: pump needs pumpFlowControl=0\n");
+          return 2;
+        }
+        pumpTask.setPWM(event.value);
+      }
+    }
+
+    ts.execute();
+    // Bus transactions move the clock on too, so wait out the rest of the
+    // millisecond like an idle loop()
+    simAdvance(SAMPLE_US - simClock.us % SAMPLE_US);
+
+    stirrerLoop.sample(motor.rpm, drive(STIRRER_CHANNEL), simClock.us);
+    pumpLoop.sample(pump.flow, simUnits.speed[PUMP_CHANNEL], simClock.us);
+    if (trace != NULL && simClock.us >= nextTraceUs) {
+      nextTraceUs += TRACE_US;
+      fprintf(trace, "%.0f,%d,%.2f,%.2f,%d,%.3f,%.4f,%.4f,%d\n", simClock.us / 1000.0,
+              stirrer.getRPMSetpoint() * (stirrer.isReverse() ? -1 : 1), motor.rpm, encoder.latestRPM, drive(STIRRER_CHANNEL),
+              pumpTask.getFlowSetpoint(), pump.flow,
+              flowReadings.latest, simUnits.speed[PUMP_CHANNEL]);
+    }
+  }
+  stirrerLoop.finish(&results);
+  pumpLoop.finish(&results);
+  if (trace != NULL) {
+    fclose(trace);
+  }
+
+  double busyPct = 100.0 * Wire.getBusyUs() / simClock.us;
+  if (json) {
+    printf("{\n  \"steps\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+      const StepMetrics& r = results[i];
+      printf("    {\"loop\": \"%s\", \"at_s\": %.3f, \"from\": %g, \"to\": %g, \"rise_ms\": %.0f, \"overshoot\": %.4g, "
+             "\"settle_ms\": %.0f, \"ss_error\": %.4g, \"effort\": %.4g}%s\n",
+             r.loop, r.atS, r.from, r.to, r.riseMs, r.overshoot, r.settleMs, r.ssError, r.effort,
+             i + 1 < results.size() ? "," : "");
+    }
+    printf("  ],\n  \"writes\": {\"stirrer\": %u, \"pump\": %u},\n", simUnits.writes[STIRRER_CHANNEL],
+           simUnits.writes[PUMP_CHANNEL]);
+    printf("  \"bus\": {\"transactions\": %u, \"busy_pct\": %.2f}\n}\n", Wire.getTransactions(), busyPct);
+  } else {
+    printf("loop,at_s,from,to,rise_ms,overshoot,settle_ms,ss_error,effort\n");
+    for (const StepMetrics& r : results) {
+      printf("%s,%.3f,%g,%g,%.0f,%.4g,%.0f,%.4g,%.4g\n", r.loop, r.atS, r.from, r.to, r.riseMs, r.overshoot, r.settleMs,
+             r.ssError, r.effort);
+    }
+    fprintf(stderr, "writes: stirrer %u, pump %u; bus: %u transactions, %.2f%% busy\n", simUnits.writes[STIRRER_CHANNEL],
+            simUnits.writes[PUMP_CHANNEL], Wire.getTransactions(), busyPct);
+  }
+  bool stirrerOk = stirrerLoop.check(results);
+  bool pumpOk = pumpLoop.check(results);
+  return stirrerOk && pumpOk ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// Receives the UDP telemetry stream (UDPTelemetryTask) from one or more
+// tanks, writes the samples to CSV or InfluxDB and reports datagram loss.
+//
+//   udp-receiver [--port 5555] [--csv out.csv]
+//   udp-receiver --influx localhost:8086 --org MOSTR --bucket homeassistant --token <token>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "sinks.h"
+#include "telemetry.h"
+
+struct StreamStats {
+  std::string device;
+  bool started = false;
+  uint32_t nextSequence = 0;
+  uint64_t received = 0;
+  uint64_t lost = 0;
+  uint64_t late = 0;  // Arrived after a later frame, already counted lost
+  uint64_t samples = 0;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) { running = 0; }
+
+static void usage() {
+  fprintf(stderr,
+          "usage: udp-receiver [--port N] [--csv FILE | --influx HOST:PORT --org ORG --bucket BUCKET --token TOKEN]\n"
+          "                    [--stats SECONDS]\n");
+  exit(2);
+}
+
+static void printStats(const std::map<std::string, StreamStats>& streams) {
+  for (const auto& entry : streams) {
+    const StreamStats& s = entry.second;
+    uint64_t expected = s.received + s.lost - s.late;
+    double loss = expected ? 100.0 * (s.lost - s.late) / expected : 0;
+    fprintf(stderr, "%s (%s): %llu frames, %llu samples, %llu lost, %llu late, %.2f%% loss\n", s.device.c_str(), entry.first.c_str(),
+            (unsigned long long)s.received, (unsigned long long)s.samples, (unsigned long long)s.lost, (unsigned long long)s.late, loss);
+  }
+}
+
+int main(int argc, char** argv) {
+  int port = 5555;
+  int statsInterval = 10;
+  const char* csvPath = NULL;
+  std::string influx, org, bucket, token;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+    }
+    if (arg == "--port") {
+      port = atoi(argv[++i]);
+    } else if (arg == "--csv") {
+      csvPath = argv[++i];
+    } else if (arg == "--influx") {
+      influx = argv[++i];
+    } else if (arg == "--org") {
+      org = argv[++i];
+    } else if (arg == "--bucket") {
+      bucket = argv[++i];
+    } else if (arg == "--token") {
+      token = argv[++i];
+    } else if (arg == "--stats") {
+      statsInterval = atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+
+  std::unique_ptr<Sink> sink;
+  FILE* csv = NULL;
+  if (!influx.empty()) {
+    size_t colon = influx.find(':');
+    std::string host = influx.substr(0, colon);
+    std::string influxPort = colon == std::string::npos ? "8086" : influx.substr(colon + 1);
+    sink.reset(new InfluxSink(host, influxPort, org, bucket, token));
+  } else {
+    csv = csvPath ? fopen(csvPath, "w") : stdout;
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    sink.reset(new CsvSink(csv));
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    perror("bind");
+    return 1;
+  }
+  // Wake up regularly so stats and flushes happen on a quiet stream too
+  timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct sigaction action = {};
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  std::map<std::string, StreamStats> streams;
+  time_t lastStats = time(NULL);
+  uint8_t buffer[TELEMETRY_MAX_FRAME];
+
+  while (running) {
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    ssize_t n = recvfrom(fd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLength);
+
+    if (time(NULL) - lastStats >= statsInterval) {
+      sink->flush();
+      printStats(streams);
+      lastStats = time(NULL);
+    }
+    if (n <= 0) {
+      continue;
+    }
+
+    char source[32];
+    snprintf(source, sizeof(source), "%s:%d", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+    StreamStats& stream = streams[source];
+    if (stream.device.empty()) {
+      stream.device = inet_ntoa(from.sin_addr);
+    }
+
+    TelemetryHeader header;
+    const uint8_t* records;
+    if (!telemetryParse(buffer, n, &header, &records)) {
+      fprintf(stderr, "%s: malformed datagram (%zd bytes)\n", source, n);
+      continue;
+    }
+
+    if (header.type == TELEMETRY_ANNOUNCE) {
+      stream.device.assign((const char*)records, n - sizeof(TelemetryHeader));
+      continue;
+    }
+
+    // Sequence numbers are per stream and wrap at 2^32
+    int32_t gap = stream.started ? (int32_t)(header.sequence - stream.nextSequence) : 0;
+    if (gap > 0) {
+      stream.lost += gap;
+    }
+    if (gap < 0 && gap > -1000) {
+      stream.late++;
+    } else {
+      if (gap <= -1000) {
+        // Far behind, the device rebooted and restarted its sequence
+        fprintf(stderr, "%s: sequence restarted\n", stream.device.c_str());
+      }
+      stream.nextSequence = header.sequence + 1;
+    }
+    stream.started = true;
+    stream.received++;
+
+    for (int i = 0; i < header.count; i++) {
+      TelemetryRecord record = telemetryRecord(records, i);
+      sink->write(stream.device, record.channel, telemetryTimestamp(header, record), record.value);
+      stream.samples++;
+    }
+  }
+
+  sink->flush();
+  printStats(streams);
+  sink.reset();
+  if (csv && csv != stdout) {
+    fclose(csv);
+  }
+  return 0;
+}